@@ -0,0 +1,106 @@
+/// @file jbwopreffectpool.h
+/// @author Jonny Bergdahl
+/// @brief Header file for the JBWopr library.
+/// @details Contains the effect pool used for effects created at runtime.
+/// This code is distributed under the MIT License. See LICENSE for details.
+/// @date Created: 2026-10-18
+/// @copyright Copyright© 2026, Jonny Bergdahl
+///
+#ifndef ARDUINO_WOPR_JBWOPREFFECTPOOL_H
+#define ARDUINO_WOPR_JBWOPREFFECTPOOL_H
+
+#include "jbwopreffects.h"
+#include <new>
+#include <type_traits>
+#include <utility>
+
+/// @brief Base class for effect pools
+/// @details The JBWoprDevice returns a pooled effect to its pool when the
+/// effect has stopped, so the effect must not be used after that.
+class JBWoprEffectPoolBase {
+public:
+	/// @brief Destructor
+	virtual ~JBWoprEffectPoolBase() = default;
+
+	/// @brief Destroy effect and return its slot to the pool
+	/// @ingroup EffectGroup
+	/// @param effect Effect created by this pool
+	virtual void release(JBWoprEffectBase* effect) = 0;
+
+protected:
+	/// @brief Mark effect as owned by this pool
+	/// @param effect Effect
+	void _attach(JBWoprEffectBase* effect) {
+		effect->_pool = this;
+	}
+};
+
+/// @brief Fixed size effect pool
+/// @details Effects are constructed in place in static storage, so effects
+/// can be created and destroyed at runtime without using the heap.
+/// @tparam T Effect class
+/// @tparam N Number of effects in pool
+template <typename T, size_t N>
+class JBWoprEffectPool : public JBWoprEffectPoolBase {
+public:
+	/// @brief Destructor
+	~JBWoprEffectPool() override {
+		for (size_t i = 0; i < N; i++) {
+			if (_used[i]) {
+				_get(i)->~T();
+			}
+		}
+	}
+
+	/// @brief Create effect
+	/// @ingroup EffectGroup
+	/// @param args Effect constructor arguments
+	/// @return Effect, or nullptr if the pool is full
+	template <typename... Args>
+	T* create(Args&&... args) {
+		for (size_t i = 0; i < N; i++) {
+			if (!_used[i]) {
+				T* effect = new (&_slots[i]) T(std::forward<Args>(args)...);
+				_used[i] = true;
+				_attach(effect);
+				return effect;
+			}
+		}
+		return nullptr;
+	}
+
+	/// @brief Destroy effect and return its slot to the pool
+	/// @ingroup EffectGroup
+	/// @param effect Effect created by this pool
+	void release(JBWoprEffectBase* effect) override {
+		for (size_t i = 0; i < N; i++) {
+			if (_used[i] && static_cast<JBWoprEffectBase*>(_get(i)) == effect) {
+				_get(i)->~T();
+				_used[i] = false;
+				return;
+			}
+		}
+	}
+
+	/// @brief Get number of free slots
+	/// @ingroup EffectGroup
+	/// @return Free slots
+	size_t available() const {
+		size_t result = 0;
+		for (size_t i = 0; i < N; i++) {
+			result += _used[i] ? 0 : 1;
+		}
+		return result;
+	}
+
+private:
+	typename std::aligned_storage<sizeof(T), alignof(T)>::type _slots[N];	///< Effect storage
+	bool _used[N] {};															///< True if slot is in use
+
+	/// @brief Get effect in slot
+	T* _get(size_t index) {
+		return reinterpret_cast<T*>(&_slots[index]);
+	}
+};
+
+#endif //ARDUINO_WOPR_JBWOPREFFECTPOOL_H
@@ -9,12 +9,13 @@
 #include "jbwopr.h"
 #include <Arduino.h>
 #include <Adafruit_NeoPixel.h>
-#include <esp_random.h>
 #include <numeric>
 #include <string>
 #include <utility>
 #include <time.h>
 
+JBLogger JBWoprEffectBase::_log {"effect" };
+
 JBWoprEffectBase::JBWoprEffectBase(JBWoprDevice *woprDevice, uint32_t duration, std::string name) {
 	_woprDevice = woprDevice;
 	_duration = duration;
@@ -25,14 +26,22 @@ void JBWoprEffectBase::start() {
 	_log.setLogLevel(_woprDevice->getLogLevel());
 	_log.trace("Starting effect %s, duration=%i", getName().c_str(), _duration);
 	_startTime = millis();
+	_animationStart = _woprDevice->effectsGetAnimationTime();
 	_isRunning = true;
 }
 
 void JBWoprEffectBase::stop() {
 	_log.trace("Stopping effect %s", getName().c_str());
-	_woprDevice->displayClear();
-	_woprDevice->defconLedsClear();
-	_woprDevice->audioClear();
+	uint8_t resources = getResources();
+	if (resources & RESOURCE_DISPLAY) {
+		_woprDevice->displayClear();
+	}
+	if (resources & RESOURCE_DEFCON_LEDS) {
+		_woprDevice->defconLedsClear();
+	}
+	if (resources & RESOURCE_AUDIO) {
+		_woprDevice->audioClear();
+	}
 	_isRunning = false;
 }
 
@@ -52,6 +61,18 @@ std::string JBWoprEffectBase::getName() {
 	return _name;
 }
 
+uint32_t JBWoprEffectBase::getId() const {
+	return _id;
+}
+
+JBWoprEffectPoolBase* JBWoprEffectBase::getPool() const {
+	return _pool;
+}
+
+uint8_t JBWoprEffectBase::getResources() const {
+	return _resources;
+}
+
 bool JBWoprEffectBase::isRunning() const {
 	return _isRunning;
 }
@@ -60,10 +81,23 @@ uint32_t JBWoprEffectBase::getDuration() const {
 	return _duration;
 }
 
+uint32_t JBWoprEffectBase::_getAnimationTime() const {
+	return _woprDevice->effectsGetAnimationTime() - _animationStart;
+}
+
+void JBWoprEffectBase::_showRainbow() {
+	// Hue moves 256 steps per 40 ms
+	uint16_t hue = (uint16_t)((uint64_t)_getAnimationTime() * 32 / 5);
+	auto leds = _woprDevice->getDefconLeds();
+	for (uint32_t i = 0; i < 5; i++) {
+		uint16_t pixelHue = hue + (i * 65536L / 5);
+		leds->setPixelColor(i, leds->gamma32(leds->ColorHSV(pixelHue)));
+	}
+	_woprDevice->defconLedsShow();
+}
+
 void JBWoprEffectBase::_displayText(const std::string& text, JBTextAlignment alignment)
 {
-	uint8_t curDisplay = 0;
-	uint8_t curDigit = 0;
 	std::string displayText = text;
 	size_t textLength = displayText.length();
 	uint32_t padSize = (12 - textLength) / 2;
@@ -81,25 +115,16 @@ void JBWoprEffectBase::_displayText(const std::string& text, JBTextAlignment ali
 	}
 	uint32_t endIndex = startIndex + textLength;
 
-	auto display = _woprDevice->getDisplay();
 	for ( uint8_t i = 0; i < 12; i++ )
 	{
 		if (i < startIndex || i >= endIndex) {
-			display[curDisplay].writeDigitAscii(curDigit, ' ');
+			_woprDevice->displaySetChar(i, ' ');
 		} else {
-			display[curDisplay].writeDigitAscii(curDigit, displayText.at(i - startIndex));
-		}
-		curDigit++;
-		if (curDigit == 4)
-		{
-			curDigit = 0;
-			curDisplay++;
+			_woprDevice->displaySetChar(i, displayText.at(i - startIndex));
 		}
 	}
 
-	display[0].writeDisplay();
-	display[1].writeDisplay();
-	display[2].writeDisplay();
+	_woprDevice->displayShow();
 }
 
 // ============================================
@@ -112,6 +137,7 @@ JBWoprTextDisplayEffect::JBWoprTextDisplayEffect(JBWoprDevice *woprDevice,
 												 uint32_t duration,
 												 const std::string& name)
 	: JBWoprEffectBase(woprDevice, duration, name) {
+	_resources = RESOURCE_DISPLAY;
 	_alignment = alignment;
 	setText(text);
 }
@@ -159,6 +185,7 @@ JBWoprScrollTextDisplayEffect::JBWoprScrollTextDisplayEffect(JBWoprDevice *woprD
 															 uint32_t duration,
 															 const std::string& name) :
 	JBWoprEffectBase(woprDevice, duration, name) {
+	_resources = RESOURCE_DISPLAY;
 	_text = text;
 	_scrollSpeed = scrollSpeed;
 }
@@ -168,7 +195,7 @@ void JBWoprScrollTextDisplayEffect::start() {
 	_log.setLogLevel(_woprDevice->getLogLevel());
 
 	_done = false;
-	_currentIndex = 0;
+	_currentIndex = SIZE_MAX;
 	_totalLength = _text.length() + 24;
 	_endIndex = _totalLength - 12;
 }
@@ -178,53 +205,38 @@ void JBWoprScrollTextDisplayEffect::loop() {
 		return;
 	}
 	JBWoprEffectBase::loop();
-	if (_nextTick > millis()) {
+	if (!_isRunning || _done) {
 		return;
 	}
 
-	if (_currentIndex > _endIndex) {
-		if (_duration == -1) {
-			_startTime = millis();
-			_currentIndex = 0;
+	// The position follows the animation clock, late frames skip characters
+	size_t index = _scrollSpeed > 0 ? _getAnimationTime() / _scrollSpeed : _endIndex + 1;
+	if (index > _endIndex) {
+		if (_duration == (uint32_t)-1) {
+			index %= _endIndex + 1;
 		} else {
 			_log.trace("Scrolling is done");
+			_startTime = millis();
 			_done = true;
 			return;
 		}
 	}
+	if (index == _currentIndex) {
+		return;
+	}
+	_currentIndex = index;
 
-	uint8_t curDisplay = 0;
-	uint8_t curDigit = 0;
 	size_t startIndex = 12;
 	size_t endIndex = startIndex + _text.length();
-	auto display = _woprDevice->getDisplay();
 
-	curDisplay = 0;
-	curDigit = 0;
 	for (uint8_t j = 0; j < 12; j++ ) {
 		if (_currentIndex + j < startIndex || _currentIndex + j >= endIndex) {
-			display[curDisplay].writeDigitAscii(curDigit, ' ');
+			_woprDevice->displaySetChar(j, ' ');
 		} else {
-			display[curDisplay].writeDigitAscii(curDigit, _text.at(_currentIndex - startIndex + j));
+			_woprDevice->displaySetChar(j, _text.at(_currentIndex - startIndex + j));
 		}
-		curDigit++;
-		if (curDigit == 4) {
-			curDigit = 0;
-			curDisplay++;
-		}
-	}
-	display[0].writeDisplay();
-	display[1].writeDisplay();
-	display[2].writeDisplay();
-
-	_currentIndex++;
-	_nextTick = millis() + _scrollSpeed;
-
-	if (_currentIndex > _endIndex)
-	{
-		_startTime = millis();
-		_nextTick = millis() + _duration;
 	}
+	_woprDevice->displayShow();
 }
 
 void JBWoprScrollTextDisplayEffect::setText(const std::string& text) {
@@ -246,6 +258,7 @@ JBWoprTimeDisplayEffect::JBWoprTimeDisplayEffect(JBWoprDevice *woprDevice,
 												 const std::string& name) :
 	JBWoprEffectBase(woprDevice, duration, name),
 	_rawTimeFormat(std::move(timeFormat)) {
+	_resources = RESOURCE_DISPLAY;
 }
 
 void JBWoprTimeDisplayEffect::start() {
@@ -316,6 +329,7 @@ JBWoprTimeDisplayRainbowEffect::JBWoprTimeDisplayRainbowEffect(JBWoprDevice *wop
 												 uint32_t duration,
 												 const std::string& name) :
 	JBWoprTimeDisplayEffect(woprDevice, std::move(timeFormat), duration, name) {
+	_resources = RESOURCE_DISPLAY | RESOURCE_DEFCON_LEDS;
 }
 
 void JBWoprTimeDisplayRainbowEffect::loop() {
@@ -328,13 +342,7 @@ void JBWoprTimeDisplayRainbowEffect::loop() {
 		return;
 	}
 
-	auto leds = _woprDevice->getDefconLeds();
-	_pixelHue += 256;
-	for (uint32_t i = 0; i < 5; i++) {
-		uint16_t pixelHue = _pixelHue + (i * 65536L / 5);
-		leds->setPixelColor(i, leds->gamma32(leds->ColorHSV(pixelHue)));
-	}
-	leds->show();
+	_showRainbow();
 	_nextLedTick = millis() + 40;
 }
 
@@ -348,6 +356,7 @@ JBWoprDateDisplayEffect::JBWoprDateDisplayEffect(JBWoprDevice *woprDevice,
 												 const std::string& name) :
 	JBWoprEffectBase(woprDevice, duration, name),
 	_rawDateFormat(std::move(dateFormat)) {
+	_resources = RESOURCE_DISPLAY;
 }
 
 void JBWoprDateDisplayEffect::start() {
@@ -400,6 +409,7 @@ JBWoprDateDisplayRainbowEffect::JBWoprDateDisplayRainbowEffect(JBWoprDevice *wop
 												 uint32_t duration,
 												 const std::string& name) :
 		JBWoprDateDisplayEffect(woprDevice, std::move(dateFormat), duration, name) {
+	_resources = RESOURCE_DISPLAY | RESOURCE_DEFCON_LEDS;
 }
 
 void JBWoprDateDisplayRainbowEffect::loop() {
@@ -409,13 +419,7 @@ void JBWoprDateDisplayRainbowEffect::loop() {
 
 	JBWoprDateDisplayEffect::loop();
 	if (_nextLedTick < millis()) {
-		auto leds = _woprDevice->getDefconLeds();
-		_pixelHue += 256;
-		for (uint32_t i = 0; i < 5; i++) {
-			uint16_t pixelHue = _pixelHue + (i * 65536L / 5);
-			leds->setPixelColor(i, leds->gamma32(leds->ColorHSV(pixelHue)));
-		}
-		leds->show();
+		_showRainbow();
 		_nextLedTick = millis() + 40;
 	}
 }
@@ -432,6 +436,7 @@ JBWoprDateTimeDisplayEffect::JBWoprDateTimeDisplayEffect(JBWoprDevice *woprDevic
 	JBWoprEffectBase(woprDevice, duration, name),
 	_rawDateFormat(std::move(dateFormat)),
 	_rawTimeFormat(std::move(timeFormat)) {
+	_resources = RESOURCE_DISPLAY;
 }
 
 void JBWoprDateTimeDisplayEffect::start() {
@@ -525,6 +530,7 @@ JBWoprDateTimeDisplayRainbowEffect::JBWoprDateTimeDisplayRainbowEffect(JBWoprDev
 														 uint32_t duration,
 														 const std::string& name) :
 		JBWoprDateTimeDisplayEffect(woprDevice, std::move(timeFormat), std::move(dateFormat), duration, name) {
+	_resources = RESOURCE_DISPLAY | RESOURCE_DEFCON_LEDS;
 }
 
 void JBWoprDateTimeDisplayRainbowEffect::loop() {
@@ -537,13 +543,7 @@ void JBWoprDateTimeDisplayRainbowEffect::loop() {
 		return;
 	}
 
-	auto leds = _woprDevice->getDefconLeds();
-	_pixelHue += 256;
-	for (uint32_t i = 0; i < 5; i++) {
-		uint16_t pixelHue = _pixelHue + (i * 65536L / 5);
-		leds->setPixelColor(i, leds->gamma32(leds->ColorHSV(pixelHue)));
-	}
-	leds->show();
+	_showRainbow();
 	_nextLedTick = millis() + 40;
 }
 
@@ -580,6 +580,37 @@ void JBWoprXmasSecondsDisplayEffect::setText(const std::string &text) {
 	// Nothing to do
 }
 
+// ============================================
+//
+// JBWoprCoroutineEffect
+//
+JBWoprCoroutineEffect::JBWoprCoroutineEffect(JBWoprDevice *woprDevice,
+											 uint32_t duration,
+											 const std::string& name)
+	: JBWoprEffectBase(woprDevice, duration, name) {
+}
+
+void JBWoprCoroutineEffect::start() {
+	_coLine = 0;
+	JBWoprEffectBase::start();
+}
+
+void JBWoprCoroutineEffect::loop() {
+	if (!_isRunning) {
+		return;
+	}
+	JBWoprEffectBase::loop();
+	if (!_isRunning) {
+		return;
+	}
+	_run();
+}
+
+void JBWoprCoroutineEffect::_coPlayNote(note_t note, uint8_t octave, uint32_t duration) {
+	_woprDevice->audioPlayNote(note, octave);
+	_coNoteEndTime = millis() + duration;
+}
+
 // ============================================
 //
 // WoprMovieDisplayEffect
@@ -588,54 +619,49 @@ JBWoprMissileCodeSolveEffect::JBWoprMissileCodeSolveEffect(JBWoprDevice *woprBoa
 														   CodeSolveVariant solveVariant,
 														   uint32_t duration,
 														   const std::string& name)
-   : JBWoprEffectBase(woprBoard, duration, name),
+   : JBWoprCoroutineEffect(woprBoard, duration, name),
 	 _solveVariant(solveVariant) {
 }
 
 void JBWoprMissileCodeSolveEffect::start() {
-	_currentSolveStep = 0;
-	_nextSolveTick = millis() + _getNextSolveTicks();
 	_currentSolution = _getSolution();
 	_currentGuess = _getStartingGuess();
 	_codeSolveOrder = _getSolveOrder();
-	JBWoprEffectBase::start();
+	JBWoprCoroutineEffect::start();
 }
 
-void JBWoprMissileCodeSolveEffect::loop() {
-	if (_nextTick > millis()) {
-		return;
-	}
-	_nextTick = millis() + 100;
-	if (_currentSolveStep < _codeSolveOrder.size()) {
-		_displayCurrentGuess();
-	}
+void JBWoprMissileCodeSolveEffect::_run() {
+	JBWOPR_CO_BEGIN();
 
-	if (_nextSolveTick < millis()) {
-		// Do next step
-		if (_currentSolveStep < _codeSolveOrder.size()) {
-			// Still solving
-			uint32_t index = _codeSolveOrder[_currentSolveStep];
-			_currentGuess[index] = _currentSolution[index];
-			_nextSolveTick = millis() + _getNextSolveTicks();
+	// Show random guesses every 100 ms, and solve one character at random intervals
+	_nextSolveTick = _woprDevice->effectsGetAnimationTime() + _getNextSolveTicks();
+	for (_currentSolveStep = 0; _currentSolveStep < _codeSolveOrder.size(); ) {
+		_displayCurrentGuess();
+		if ((int32_t)(_woprDevice->effectsGetAnimationTime() - _nextSolveTick) >= 0) {
+			_currentGuess[_codeSolveOrder[_currentSolveStep]] = _currentSolution[_codeSolveOrder[_currentSolveStep]];
+			_nextSolveTick = _woprDevice->effectsGetAnimationTime() + _getNextSolveTicks();
 			_displaySolvedCharacters();
-			_nextTick = millis() + 500;
 			_currentSolveStep++;
+			if (_currentSolveStep < _codeSolveOrder.size()) {
+				JBWOPR_CO_SLEEP(500);
+			}
+		} else {
+			JBWOPR_CO_SLEEP(100);
 		}
 	}
-	if (_currentSolveStep >= _codeSolveOrder.size()) {
-		if (_currentSolveStep < _codeSolveOrder.size() + 6) {
-			_displayBlinkingSolution();
-			_nextTick = millis() + 800;
-		} else if (_currentSolveStep < _codeSolveOrder.size() + 12) {
-			_displayBlinkingLaunching();
-			_nextTick = millis() + 800;
+
+	// Blink the solution, then the launch message
+	for (_blinkStep = 0; _blinkStep < 12; _blinkStep++) {
+		if (_blinkStep < 6) {
+			_displayBlinkingSolution(_blinkStep % 2 == 0);
 		} else {
-			// Done
-			_woprDevice->audioClear();
-			JBWoprEffectBase::stop();
+			_displayBlinkingLaunching(_blinkStep % 2 == 0);
 		}
-		_currentSolveStep++;
+		JBWOPR_CO_SLEEP(800);
 	}
+	_woprDevice->audioClear();
+
+	JBWOPR_CO_END();
 }
 
 void JBWoprMissileCodeSolveEffect::setCodeSolveVariant(CodeSolveVariant solveVariant) {
@@ -654,7 +680,7 @@ void JBWoprMissileCodeSolveEffect::_displayCurrentGuess() {
 			text += _getRandomChar();
 		}
 	}
-	_woprDevice->audioPlayTone(random(90, 250));
+	_woprDevice->audioPlayTone(_woprDevice->effectsGetRandom().next(90, 250));
 	int32_t percentage = 100 * _currentSolveStep / _codeSolveOrder.size();
 	int32_t defconValue = map(percentage, 0, 100, 4, 0);
 	if (defconValue != _defconValue) {
@@ -681,8 +707,8 @@ void JBWoprMissileCodeSolveEffect::_displaySolvedCharacters() {
 	_woprDevice->displayShowText(text);
 }
 
-void JBWoprMissileCodeSolveEffect::_displayBlinkingSolution() {
-	if (_currentSolveStep % 2) {
+void JBWoprMissileCodeSolveEffect::_displayBlinkingSolution(bool visible) {
+	if (!visible) {
 		_woprDevice->audioClear();
 		_woprDevice->displayClear();
 		_woprDevice->defconLedsSetColor(0x000000);
@@ -694,8 +720,8 @@ void JBWoprMissileCodeSolveEffect::_displayBlinkingSolution() {
 	}
 }
 
-void JBWoprMissileCodeSolveEffect::_displayBlinkingLaunching() {
-	if (_currentSolveStep % 2) {
+void JBWoprMissileCodeSolveEffect::_displayBlinkingLaunching(bool visible) {
+	if (!visible) {
 		_woprDevice->audioClear();
 		_woprDevice->displayClear();
 		_woprDevice->defconLedsSetColor(0x000000);
@@ -716,7 +742,7 @@ std::string JBWoprMissileCodeSolveEffect::_getRandomCode() {
 }
 
 char JBWoprMissileCodeSolveEffect::_getRandomChar() {
-	uint32_t rand = random(0, 38);
+	uint32_t rand = _woprDevice->effectsGetRandom().next(38);
 	if (rand < 10) {
 		return '0' + rand;
 	} else if (rand < 36) {
@@ -727,7 +753,7 @@ char JBWoprMissileCodeSolveEffect::_getRandomChar() {
 }
 
 uint32_t JBWoprMissileCodeSolveEffect::_getNextSolveTicks() const {
-	return random(_minSolveTicks, _maxSolveTicks);
+	return _woprDevice->effectsGetRandom().next(_minSolveTicks, _maxSolveTicks);
 }
 
 std::string JBWoprMissileCodeSolveEffect::_getSolution() {
@@ -762,8 +788,9 @@ std::vector<uint32_t> JBWoprMissileCodeSolveEffect::_getSolveOrder() {
 		default:
 			std::vector<uint32_t> result(12);
 			std::iota(std::begin(result), std::end(result), 0);
-			for (int i = 0; i < result.size() - 1; i++) {
-				int j = i + esp_random() % (result.size() - i);
+			JBRandom& random = _woprDevice->effectsGetRandom();
+			for (uint32_t i = 0; i < result.size() - 1; i++) {
+				uint32_t j = i + random.next(result.size() - i);
 				std::swap(result[i], result[j]);
 			}
 			return result;
@@ -778,6 +805,7 @@ JBWoprDefconRainbowEffect::JBWoprDefconRainbowEffect(JBWoprDevice *woprDevice,
 													 uint32_t duration,
 													 const std::string& name)
 	: JBWoprEffectBase(woprDevice, duration, name) {
+	_resources = RESOURCE_DEFCON_LEDS;
 }
 
 void JBWoprDefconRainbowEffect::loop() {
@@ -787,13 +815,7 @@ void JBWoprDefconRainbowEffect::loop() {
 		return;
 	}
 
-	auto leds = _woprDevice->getDefconLeds();
-	_pixelHue += 256;
-	for (uint32_t i = 0; i < 5; i++) {
-		uint16_t pixelHue = _pixelHue + (i * 65536L / 5);
-		leds->setPixelColor(i, leds->gamma32(leds->ColorHSV(pixelHue)));
-	}
-	leds->show();
+	_showRainbow();
 	_nextTick = millis() + 40;
 }
 
@@ -810,6 +832,7 @@ JBWoprSongEffect::JBWoprSongEffect(JBWoprDevice *woprBoard,
 	_song(song),
 	_tempo(tempo),
 	_wholeNote((60000 * 4) / tempo) {
+	_resources = RESOURCE_DISPLAY | RESOURCE_AUDIO;
 }
 
 void JBWoprSongEffect::start() {
@@ -15,6 +15,7 @@
 #include <vector>
 
 class JBWoprDevice;
+class JBWoprEffectPoolBase;
 
 // Note that effect names needs to fit in 12 characters.
 #define JBWOPR_EFFECT_NAME_BASE 			"Base"             	///< Name of JBWoprEffectBase
@@ -31,6 +32,23 @@ class JBWoprDevice;
 #define JBWOPR_EFFECT_NAME_DEFCON_RAINBOW 	"Rainbow"			///< Name of JBWoprDefconRainbowEffect
 #define JBWOPR_EFFECT_NAME_SONG				"Song"				///< Name of JBWoprSongEffect
 
+#define JBWOPR_EFFECT_ID_NONE				UINT32_MAX			///< ID of an effect that is not registered
+
+#define JBWOPR_EFFECT_PRIORITY_LOW			0					///< Low effect priority
+#define JBWOPR_EFFECT_PRIORITY_NORMAL		100					///< Normal effect priority, used by effectsStartEffect()
+#define JBWOPR_EFFECT_PRIORITY_HIGH			200					///< High effect priority, for alerts
+
+/// @brief Device resources used by an effect, values can be combined
+/// @details Each resource is a layer in the effects system, effects that
+/// use different resources can run at the same time.
+enum JBWoprEffectResource {
+	RESOURCE_NONE = 0,					///< No resources
+	RESOURCE_DISPLAY = 1,				///< Display
+	RESOURCE_DEFCON_LEDS = 2,			///< DEFCON LEDs
+	RESOURCE_AUDIO = 4,					///< Audio
+	RESOURCE_ALL = 7					///< All resources
+};
+
 /// @brief Code solve variant for the JBWoprMissileCodeSolveEffect class
 enum CodeSolveVariant {
 	MOVIE, 				///< Movie code solve
@@ -50,11 +68,32 @@ public:
 							  uint32_t duration = -1,
 							  std::string name = JBWOPR_EFFECT_NAME_BASE);
 
+	/// @brief Destructor
+	virtual ~JBWoprEffectBase() = default;
+
 	/// @brief Get name of effect
 	/// @ingroup EffectGroup
 	/// @return Name of effect
 	virtual std::string getName();
 
+	/// @brief Get ID of effect
+	/// @ingroup EffectGroup
+	/// @details The ID is assigned when the effect is registered with
+	/// JBWoprDevice::effectsRegisterEffect() and is stable for as long as
+	/// the registration order is unchanged.
+	/// @return ID of effect, JBWOPR_EFFECT_ID_NONE if not registered
+	uint32_t getId() const;
+
+	/// @brief Get pool owning effect
+	/// @ingroup EffectGroup
+	/// @return Pool, or nullptr if effect is not pooled
+	JBWoprEffectPoolBase* getPool() const;
+
+	/// @brief Get resources used by effect
+	/// @ingroup EffectGroup
+	/// @return Combination of JBWoprEffectResource values, default is RESOURCE_ALL
+	virtual uint8_t getResources() const;
+
 	/// @brief Start effect
 	/// @ingroup EffectGroup
 	virtual void start();
@@ -80,11 +119,27 @@ public:
 protected:
 	JBWoprDevice *_woprDevice;			///< JBWoprDevice instance
 	std::string _name;					///< Name of effect
+	uint32_t _id = JBWOPR_EFFECT_ID_NONE;	///< ID of effect, assigned on registration
+	uint8_t _resources = RESOURCE_ALL;	///< Resources used by effect
 	bool _isRunning = false;			///< True if effect is running
 	bool _done = true;					///< True if effect is done, waiting for duration to end
 	uint32_t _duration = -1;			///< Duration of effect in milliseconds
 	uint32_t _startTime = 0;			///< Start time of effect in milliseconds
 	uint32_t _nextTick = 0; 			///< Next tick time in milliseconds
+	uint32_t _animationStart = 0;		///< Animation clock at start of effect
+
+	/// @brief Get animation time since start of effect
+	/// @ingroup EffectGroup
+	/// @details Based on JBWoprDevice::effectsGetAnimationTime(), so it follows
+	/// the effects speed. Derive animation state from this value instead of
+	/// stepping it each loop, so the animation keeps its speed when frames are delayed.
+	/// @return Animation time in milliseconds
+	uint32_t _getAnimationTime() const;
+
+	/// @brief Show rainbow on DEFCON LEDs
+	/// @ingroup EffectGroup
+	/// @details The hue is derived from the animation time, a full cycle takes about 10 seconds.
+	void _showRainbow();
 
 	/// @brief Display text on raw display
 	/// @ingroup EffectGroup
@@ -94,8 +149,13 @@ protected:
 	/// @param alignment (optional) Text alignment, default is LEFT
 	void _displayText(const std::string& text, JBTextAlignment alignment = JBTextAlignment::LEFT);
 
+	static JBLogger _log;				///< Logger instance, shared by all effects
+
 private:
-	JBLogger _log {"effect" };	///< Logger instance
+	friend class JBWoprDevice;
+	friend class JBWoprEffectPoolBase;
+
+	JBWoprEffectPoolBase* _pool = nullptr;	///< Pool owning effect, nullptr if not pooled
 };
 
 /// @brief Display effect for showing text
@@ -174,12 +234,10 @@ public:
 protected:
 	std::string _text;					///< Text to display
 	uint32_t _scrollSpeed = 200;		///< Scroll speed in milliseconds
-	size_t _currentIndex = 0;			///< Current character index
+	size_t _currentIndex = 0;			///< Character index currently shown
 	size_t _totalLength = 0;			///< Total length of text
 	size_t _endIndex = 0;				///< End index of text
 
-private:
-	JBLogger _log {"scroll" };	///< Logger instance
 };
 
 /// @brief Display effect for showing the current time
@@ -221,8 +279,6 @@ protected:
 	std::string _timeFormatEven;		///< Time format for even
 	std::string _timeFormatOdd;			///< Time format for odd
 
-private:
-	JBLogger _log {"time" };			///< Logger instance
 };
 
 /// @brief Display effect for showing the current time
@@ -245,10 +301,7 @@ public:
 
 protected:
 	uint64_t _nextLedTick = 0;			///< Next LED tick
-	uint16_t _pixelHue = 0;				///< Pixel hue
 
-private:
-	JBLogger _log {"time" };			///< Logger instance
 };
 
 /// @brief Display effect for showing the current date
@@ -285,8 +338,6 @@ protected:
 	std::string _rawDateFormat;			///< Raw date format
 	std::string _dateFormat;			///< Date format
 
-private:
-	JBLogger _log {"date" };	///< Logger instance
 };
 
 /// @brief Display effect for showing the current date, with rainbow colors
@@ -310,10 +361,7 @@ public:
 
 protected:
 	uint64_t _nextLedTick = 0;			///< Next LED tick
-	uint16_t _pixelHue = 0;				///< Pixel hue
 
-private:
-	JBLogger _log {"date" };	///< Logger instance
 };
 
 /// @brief Display effect for showing the current date and time
@@ -359,8 +407,6 @@ protected:
 //	uint64_t _nextLedTick = 0;			///< Next LED tick
 //	uint16_t _pixelHue = 0;				///< Pixel hue
 private:
-	JBLogger _log {"datetime" };		///< Logger instance
-
 	/// @brief Get time format
 	/// @ingroup EffectGroup
 	/// @param format
@@ -388,10 +434,7 @@ public:
 
 protected:
 	uint64_t _nextLedTick = 0;						///< Next LED tick
-	uint16_t _pixelHue = 0;							///< Pixel hue
 
-private:
-	JBLogger _log {"datetime" };		///< Logger instance
 };
 
 /// @brief Display effect for showing seconds un til Xmas
@@ -417,11 +460,73 @@ private:
 	void setText(const std::string& text);
 #pragma GCC diagnostic pop
 
-	JBLogger _log {"xmas" };	///< Logger instance
+};
+
+// Stackless coroutine macros for JBWoprCoroutineEffect::_run().
+// The body is a switch on the line of the last suspension point, so local
+// variables do not survive a suspension, keep such state in members. Only one
+// suspension macro can be used per source line.
+
+/// @brief Start coroutine body
+#define JBWOPR_CO_BEGIN() switch (_coLine) { case 0:
+
+/// @brief End coroutine body, the effect is stopped when it is reached
+#define JBWOPR_CO_END() } _coLine = 0; stop(); return
+
+/// @brief Suspend until the next loop() call
+#define JBWOPR_CO_NEXT_FRAME() do { _coLine = __LINE__; return; case __LINE__:; } while (0)
+
+/// @brief Suspend for a number of milliseconds
+/// @details Uses the animation clock, so the wait follows the effects speed.
+#define JBWOPR_CO_SLEEP(ms) do { _coWakeTime = _woprDevice->effectsGetAnimationTime() + (ms); _coLine = __LINE__; return; \
+	case __LINE__: if ((int32_t)(_woprDevice->effectsGetAnimationTime() - _coWakeTime) < 0) return; } while (0)
+
+/// @brief Suspend until the note started with _coPlayNote() is done, then stop audio
+#define JBWOPR_CO_NOTE_DONE() do { _coLine = __LINE__; return; \
+	case __LINE__: if ((int32_t)(millis() - _coNoteEndTime) < 0) return; _woprDevice->audioClear(); } while (0)
+
+/// @brief Base class for effects written as stackless coroutines
+/// @details Override _run() and write the effect from start to end using
+/// the JBWOPR_CO_* macros. The coroutine state is a few integers, nothing is
+/// allocated when suspending.
+class JBWoprCoroutineEffect : public JBWoprEffectBase {
+public:
+	/// @brief Constructor
+	/// @ingroup EffectGroup
+	/// @param woprDevice JBWoprDevice instance
+	/// @param duration (optional) Duration of effect in milliseconds, default is -1 (infinite)
+	/// @param name (optional) Name of effect
+	explicit JBWoprCoroutineEffect(JBWoprDevice *woprDevice,
+								   uint32_t duration = -1,
+								   const std::string& name = JBWOPR_EFFECT_NAME_BASE);
+
+	/// @brief Start effect
+	/// @ingroup EffectGroup
+	void start() override;
+
+	/// @brief Run loop
+	/// @ingroup EffectGroup
+	void loop() override;
+
+protected:
+	/// @brief Coroutine body, resumed from the last suspension point on each loop
+	/// @ingroup EffectGroup
+	virtual void _run() = 0;
+
+	/// @brief Play a note, use JBWOPR_CO_NOTE_DONE() to wait for it
+	/// @ingroup EffectGroup
+	/// @param note Note
+	/// @param octave Octave
+	/// @param duration Note duration in milliseconds
+	void _coPlayNote(note_t note, uint8_t octave, uint32_t duration);
+
+	uint32_t _coLine = 0;				///< Line of last suspension point, 0 at start
+	uint32_t _coWakeTime = 0;			///< Wake up time for JBWOPR_CO_SLEEP, on the animation clock
+	uint32_t _coNoteEndTime = 0;		///< End time of note for JBWOPR_CO_NOTE_DONE
 };
 
 /// @brief Display effect for showing the WOPR movie code solve
-class JBWoprMissileCodeSolveEffect : public JBWoprEffectBase {
+class JBWoprMissileCodeSolveEffect : public JBWoprCoroutineEffect {
 public:
 	/// @brief Constructor
 	/// @ingroup EffectGroup
@@ -439,15 +544,16 @@ public:
 	/// @param duration Duration of effect (after it is done) in milliseconds
 	void start() override;
 
-	/// @brief Run loop
-	/// @ingroup EffectGroup
-	void loop() override;
-
 	/// @brief Set code solve variant
 	/// @ingroup EffectGroup
 	/// @param solveVariant Code solve variant
 	void setCodeSolveVariant(CodeSolveVariant solveVariant);
 
+protected:
+	/// @brief Code solve sequence
+	/// @ingroup EffectGroup
+	void _run() override;
+
 private:
 	/// @brief Display current solution
 	/// @ingroup EffectGroup
@@ -459,11 +565,13 @@ private:
 
 	/// @brief Display blinking solution
 	/// @ingroup EffectGroup
-	void _displayBlinkingSolution();
+	/// @param visible True to show solution, false for blank
+	void _displayBlinkingSolution(bool visible);
 
 	/// @brief Display blinking launching
 	/// @ingroup EffectGroup
-	void _displayBlinkingLaunching();
+	/// @param visible True to show text, false for blank
+	void _displayBlinkingLaunching(bool visible);
 
 	/// @brief Setup current solution
 	/// @ingroup EffectGroup
@@ -488,7 +596,7 @@ private:
 	/// @brief Get a random char
 	/// @ingroup EffectGroup
 	/// @return Random char
-	static char _getRandomChar();
+	char _getRandomChar();
 
 	/// @brief Get next solve ticks
 	/// @ingroup EffectGroup
@@ -497,7 +605,8 @@ private:
 
 	CodeSolveVariant _solveVariant = CodeSolveVariant::MOVIE; ///< Code solve variant
 	uint32_t _currentSolveStep = 0;                          ///< Current solve step (0 - 9)
-	uint32_t _nextSolveTick = 0;                             ///< Next tick for solve step
+	uint32_t _blinkStep = 0;                                 ///< Current blink step (0 - 11)
+	uint32_t _nextSolveTick = 0;                             ///< Next tick for solve step, on the animation clock
 	int32_t _defconValue = -1;								 ///< Defcon level
 	std::string _currentSolution;                            ///< Current solution
 	std::string _currentGuess;                               ///< Current guess
@@ -521,9 +630,6 @@ public:
 	/// @brief Run loop
 	/// @ingroup EffectGroup
 	void loop() override;
-
-private:
-	uint16_t _pixelHue = 0;		///< Pixel hue
 };
 
 /// @brief Base class for song effects
@@ -575,8 +681,6 @@ protected:
 	uint32_t _wholeNote = (60000 * 4) / _tempo;		///< Whole note duration
 	bool _done = false;								///< True if done
 
-private:
-	JBLogger _log {"song" };	///< Logger instance
 };
 
 
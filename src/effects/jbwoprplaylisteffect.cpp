@@ -0,0 +1,265 @@
+/// @file jbwoprplaylisteffect.cpp
+/// @author Jonny Bergdahl
+/// @brief Source file for the JBWoprPlaylistEffect.
+/// @details Contains implementation of the JBWoprPlaylistEffect class.
+/// This code is distributed under the MIT License. See LICENSE for details.
+/// @date Created: 2026-10-18
+/// @copyright Copyright© 2026, Jonny Bergdahl
+///
+#include "jbwoprplaylisteffect.h"
+#include "jbwopr.h"
+
+// ============================================
+//
+// JBWoprPlaylistEffect
+//
+JBWoprPlaylistEffect::JBWoprPlaylistEffect(JBWoprDevice *woprDevice,
+										   uint32_t duration,
+										   const std::string& name)
+	: JBWoprEffectBase(woprDevice, duration, name) {
+}
+
+void JBWoprPlaylistEffect::start() {
+	_log.setLogLevel(_woprDevice->getLogLevel());
+	JBWoprEffectBase::start();
+	_currentEffect = nullptr;
+	_transitioning = false;
+	_nextIndex = _entries.empty() ? 0 : _entries.size() - 1;
+	_preloadNext();
+}
+
+void JBWoprPlaylistEffect::stop() {
+	if (_currentEffect != nullptr && _currentEffect->isRunning()) {
+		_currentEffect->stop();
+	}
+	_currentEffect = nullptr;
+	_transitioning = false;
+	JBWoprEffectBase::stop();
+}
+
+void JBWoprPlaylistEffect::loop() {
+	if (!_isRunning) {
+		return;
+	}
+	JBWoprEffectBase::loop();
+	if (!_isRunning) {
+		return;
+	}
+
+	if (!_transitioning) {
+		bool entryDone = _currentEffect == nullptr ||
+						 !_currentEffect->isRunning() ||
+						 (_entries[_currentIndex].duration > 0 &&
+						  millis() - _entryStartTime >= _entries[_currentIndex].duration);
+		if (entryDone) {
+			_switchToNext();
+			if (!_isRunning) {
+				return;
+			}
+		}
+	}
+
+	if (_transitioning) {
+		// Let the effect draw on top of its own last frame, not the blended one
+		for (uint8_t i = 0; i < 12; i++) {
+			_woprDevice->displaySetRaw(i, _toFrame[i]);
+		}
+	}
+
+	if (_currentEffect->isRunning()) {
+		_currentEffect->loop();
+	}
+
+	if (_transitioning) {
+		for (uint8_t i = 0; i < 12; i++) {
+			_toFrame[i] = _woprDevice->displayGetRaw(i);
+		}
+		uint32_t elapsed = millis() - _transitionStart;
+		if (elapsed >= _transitionTime) {
+			_transitioning = false;
+		} else {
+			_renderTransition(elapsed);
+		}
+		_woprDevice->displayShow();
+	}
+}
+
+void JBWoprPlaylistEffect::addEntry(const std::string& effectName,
+									uint32_t duration,
+									uint8_t weight,
+									JBWoprPlaylistTransition transition) {
+	_entries.push_back({ effectName, duration, weight, transition });
+	if (_isRunning && _nextEffect == nullptr) {
+		_preloadNext();
+	}
+}
+
+void JBWoprPlaylistEffect::clearEntries() {
+	if (_currentEffect != nullptr && _currentEffect->isRunning()) {
+		_currentEffect->stop();
+	}
+	_currentEffect = nullptr;
+	_nextEffect = nullptr;
+	_transitioning = false;
+	_entries.clear();
+	_nextIndex = 0;
+}
+
+const std::vector<JBWoprPlaylistEffect::Entry>& JBWoprPlaylistEffect::getEntries() const {
+	return _entries;
+}
+
+void JBWoprPlaylistEffect::setMode(JBWoprPlaylistMode mode) {
+	_mode = mode;
+}
+
+void JBWoprPlaylistEffect::setTransitionTime(uint32_t transitionTime) {
+	_transitionTime = transitionTime;
+}
+
+bool JBWoprPlaylistEffect::setFromJsonDocument(const JsonDocument& jsonDoc) {
+	JsonArrayConst entries = jsonDoc[JSON_KEY_ENTRIES].as<JsonArrayConst>();
+	if (entries.isNull()) {
+		_log.error("Playlist JSON has no entries");
+		return false;
+	}
+
+	clearEntries();
+	_mode = jsonDoc[JSON_KEY_MODE].as<std::string>() == MODE_NAMES[PLAYLIST_WEIGHTED] ?
+			JBWoprPlaylistMode::PLAYLIST_WEIGHTED :
+			JBWoprPlaylistMode::PLAYLIST_ORDERED;
+	if (!jsonDoc[JSON_KEY_TRANSITION_TIME].isNull()) {
+		_transitionTime = jsonDoc[JSON_KEY_TRANSITION_TIME].as<uint32_t>();
+	}
+	for (JsonObjectConst item : entries) {
+		JBWoprPlaylistTransition transition = JBWoprPlaylistTransition::TRANSITION_CUT;
+		std::string transitionName = item[JSON_KEY_TRANSITION].as<std::string>();
+		if (transitionName == TRANSITION_NAMES[TRANSITION_WIPE]) {
+			transition = JBWoprPlaylistTransition::TRANSITION_WIPE;
+		} else if (transitionName == TRANSITION_NAMES[TRANSITION_DISSOLVE]) {
+			transition = JBWoprPlaylistTransition::TRANSITION_DISSOLVE;
+		}
+		uint8_t weight = item[JSON_KEY_WEIGHT].isNull() ? 1 : item[JSON_KEY_WEIGHT].as<uint8_t>();
+		_entries.push_back({ item[JSON_KEY_EFFECT].as<std::string>(),
+							 item[JSON_KEY_DURATION].as<uint32_t>(),
+							 weight,
+							 transition });
+	}
+	_log.debug("Playlist set, %i entries", _entries.size());
+
+	if (_isRunning) {
+		// Restart from the first entry
+		_nextIndex = _entries.empty() ? 0 : _entries.size() - 1;
+		_preloadNext();
+	}
+	return true;
+}
+
+void JBWoprPlaylistEffect::setJsonDocument(JsonDocument& jsonDoc) {
+	jsonDoc[JSON_KEY_MODE] = MODE_NAMES[_mode];
+	jsonDoc[JSON_KEY_TRANSITION_TIME] = _transitionTime;
+	JsonArray entries = jsonDoc[JSON_KEY_ENTRIES].to<JsonArray>();
+	for (const auto& entry : _entries) {
+		JsonObject item = entries.add<JsonObject>();
+		item[JSON_KEY_EFFECT] = entry.effectName;
+		item[JSON_KEY_DURATION] = entry.duration;
+		item[JSON_KEY_WEIGHT] = entry.weight;
+		item[JSON_KEY_TRANSITION] = TRANSITION_NAMES[entry.transition];
+	}
+}
+
+void JBWoprPlaylistEffect::_preloadNext() {
+	_nextEffect = nullptr;
+	if (_entries.empty()) {
+		return;
+	}
+
+	uint32_t totalWeight = 0;
+	for (const auto& entry : _entries) {
+		totalWeight += entry.weight;
+	}
+
+	// Try each entry at most once, skipping effects that are not registered
+	size_t candidate = _nextIndex;
+	for (size_t attempt = 0; attempt < _entries.size(); attempt++) {
+		if (_mode == JBWoprPlaylistMode::PLAYLIST_WEIGHTED && totalWeight > 0) {
+			uint32_t pick = _woprDevice->effectsGetRandom().next(totalWeight);
+			for (size_t i = 0; i < _entries.size(); i++) {
+				if (pick < _entries[i].weight) {
+					candidate = i;
+					break;
+				}
+				pick -= _entries[i].weight;
+			}
+		} else {
+			candidate = (candidate + 1) % _entries.size();
+		}
+
+		JBWoprEffectBase* effect = _woprDevice->effectsGetEffect(_entries[candidate].effectName.c_str());
+		if (effect != nullptr && effect != this) {
+			_nextIndex = candidate;
+			_nextEffect = effect;
+			return;
+		}
+		_log.warning("Playlist effect %s not found", _entries[candidate].effectName.c_str());
+	}
+}
+
+void JBWoprPlaylistEffect::_switchToNext() {
+	if (_nextEffect == nullptr) {
+		_log.warning("Playlist has no playable entries");
+		stop();
+		return;
+	}
+
+	// The first entry is always a cut
+	_transition = _currentEffect == nullptr ?
+				  JBWoprPlaylistTransition::TRANSITION_CUT :
+				  _entries[_nextIndex].transition;
+	if (_transition != JBWoprPlaylistTransition::TRANSITION_CUT) {
+		for (uint8_t i = 0; i < 12; i++) {
+			_fromFrame[i] = _woprDevice->displayGetRaw(i);
+		}
+	}
+	if (_currentEffect != nullptr && _currentEffect->isRunning()) {
+		_currentEffect->stop();
+	}
+
+	_currentEffect = _nextEffect;
+	_currentIndex = _nextIndex;
+	_log.trace("Playlist entry %i: %s", _currentIndex, _currentEffect->getName().c_str());
+	_entryStartTime = millis();
+	_currentEffect->start();
+
+	if (_transition != JBWoprPlaylistTransition::TRANSITION_CUT) {
+		for (uint8_t i = 0; i < 12; i++) {
+			_toFrame[i] = _woprDevice->displayGetRaw(i);
+		}
+		_transitionStart = millis();
+		_transitioning = true;
+	}
+	_preloadNext();
+}
+
+void JBWoprPlaylistEffect::_renderTransition(uint32_t elapsed) {
+	if (_transition == JBWoprPlaylistTransition::TRANSITION_WIPE) {
+		uint32_t column = elapsed * 12 / _transitionTime;
+		for (uint8_t i = 0; i < 12; i++) {
+			_woprDevice->displaySetRaw(i, i < column ? _toFrame[i] : _fromFrame[i]);
+		}
+		return;
+	}
+
+	// Dissolve switches the 12 x 16 segments in a scattered but fixed order,
+	// multiplying by 113 (coprime with 192) gives each segment a unique slot.
+	uint32_t threshold = elapsed * 192 / _transitionTime;
+	for (uint8_t i = 0; i < 12; i++) {
+		uint16_t mask = 0;
+		for (uint8_t bit = 0; bit < 16; bit++) {
+			if ((uint32_t)((i * 16 + bit) * 113) % 192 < threshold) {
+				mask |= 1 << bit;
+			}
+		}
+		_woprDevice->displaySetRaw(i, (_toFrame[i] & mask) | (_fromFrame[i] & ~mask));
+	}
+}
@@ -0,0 +1,142 @@
+/// @file jbwoprplaylisteffect.h
+/// @author Jonny Bergdahl
+/// @brief Header file for the JBWoprPlaylistEffect.
+/// @details Contains declarations for the JBWoprPlaylistEffect class.
+/// This code is distributed under the MIT License. See LICENSE for details.
+/// @date Created: 2026-10-18
+/// @copyright Copyright© 2026, Jonny Bergdahl
+///
+#ifndef ARDUINO_WOPR_JBWOPRPLAYLISTEFFECT_H
+#define ARDUINO_WOPR_JBWOPRPLAYLISTEFFECT_H
+
+#include "jbwopreffects.h"
+#include <ArduinoJson.h>
+
+#define JBWOPR_EFFECT_NAME_PLAYLIST "Playlist"		///< Name of JBWoprPlaylistEffect
+
+/// @brief Playlist modes
+enum JBWoprPlaylistMode {
+	PLAYLIST_ORDERED = 0,					///< Entries are played in order
+	PLAYLIST_WEIGHTED						///< Entries are picked at random, based on weight
+};
+
+/// @brief Playlist transitions, used when switching to an entry
+enum JBWoprPlaylistTransition {
+	TRANSITION_CUT = 0,						///< Switch immediately
+	TRANSITION_WIPE,						///< Wipe from left to right, one character at a time
+	TRANSITION_DISSOLVE						///< Dissolve, one display segment at a time
+};
+
+/// @brief Playlist effect
+/// @details Runs registered effects one after another, with a duration
+/// and transition per entry. The next entry is selected and looked up when
+/// the previous one starts, so switching only starts the next effect.
+class JBWoprPlaylistEffect : public JBWoprEffectBase {
+public:
+	/// @brief Playlist entry
+	struct Entry {
+		std::string effectName;					///< Name of registered effect
+		uint32_t duration;						///< Duration in milliseconds, 0 runs until effect stops
+		uint8_t weight;							///< Weight, used in PLAYLIST_WEIGHTED mode
+		JBWoprPlaylistTransition transition;	///< Transition used when switching to this entry
+	};
+
+	/// @brief Constructor
+	/// @ingroup EffectGroup
+	/// @param woprDevice JBWoprDevice instance
+	/// @param duration (optional) Duration of effect in milliseconds, default is -1 (infinite)
+	/// @param name (optional) Name of effect
+	explicit JBWoprPlaylistEffect(JBWoprDevice *woprDevice,
+								  uint32_t duration = -1,
+								  const std::string& name=JBWOPR_EFFECT_NAME_PLAYLIST);
+
+	/// @brief Start effect
+	/// @ingroup EffectGroup
+	void start() override;
+
+	/// @brief Stop effect
+	/// @ingroup EffectGroup
+	void stop() override;
+
+	/// @brief Run loop
+	/// @ingroup EffectGroup
+	void loop() override;
+
+	/// @brief Add entry to playlist
+	/// @ingroup EffectGroup
+	/// @param effectName Name of registered effect
+	/// @param duration (optional) Duration in milliseconds, default is 0 (until effect stops)
+	/// @param weight (optional) Weight, default is 1
+	/// @param transition (optional) Transition, default is TRANSITION_CUT
+	void addEntry(const std::string& effectName,
+				  uint32_t duration = 0,
+				  uint8_t weight = 1,
+				  JBWoprPlaylistTransition transition = JBWoprPlaylistTransition::TRANSITION_CUT);
+
+	/// @brief Remove all entries
+	/// @ingroup EffectGroup
+	void clearEntries();
+
+	/// @brief Get playlist entries
+	/// @ingroup EffectGroup
+	/// @return Entries
+	const std::vector<Entry>& getEntries() const;
+
+	/// @brief Set playlist mode
+	/// @ingroup EffectGroup
+	/// @param mode Playlist mode
+	void setMode(JBWoprPlaylistMode mode);
+
+	/// @brief Set transition time
+	/// @ingroup EffectGroup
+	/// @param transitionTime Transition time in milliseconds
+	void setTransitionTime(uint32_t transitionTime);
+
+	/// @brief Set playlist from JSON document
+	/// @ingroup EffectGroup
+	/// @param jsonDoc JSON document
+	/// @return True if successful
+	bool setFromJsonDocument(const JsonDocument& jsonDoc);
+
+	/// @brief Set JSON document from playlist
+	/// @ingroup EffectGroup
+	/// @param jsonDoc JSON document
+	void setJsonDocument(JsonDocument& jsonDoc);
+
+protected:
+	std::vector<Entry> _entries;								///< Playlist entries
+	JBWoprPlaylistMode _mode = JBWoprPlaylistMode::PLAYLIST_ORDERED;	///< Playlist mode
+	uint32_t _transitionTime = 600;								///< Transition time in milliseconds
+	size_t _currentIndex = 0;									///< Current entry index
+	size_t _nextIndex = 0;										///< Next entry index
+	JBWoprEffectBase* _currentEffect = nullptr;					///< Current effect
+	JBWoprEffectBase* _nextEffect = nullptr;					///< Next effect, looked up in advance
+	uint32_t _entryStartTime = 0;								///< Start time of current entry
+	bool _transitioning = false;								///< True while a transition is running
+	uint32_t _transitionStart = 0;								///< Start time of transition
+	JBWoprPlaylistTransition _transition = JBWoprPlaylistTransition::TRANSITION_CUT;	///< Current transition
+	uint16_t _fromFrame[12] {};									///< Display of previous entry
+	uint16_t _toFrame[12] {};									///< Display of current entry
+
+	const char* JSON_KEY_MODE = "mode";							///< Mode key name
+	const char* JSON_KEY_TRANSITION_TIME = "transitionTime";	///< Transition time key name
+	const char* JSON_KEY_ENTRIES = "entries";					///< Entries key name
+	const char* JSON_KEY_EFFECT = "effect";						///< Entry effect key name
+	const char* JSON_KEY_DURATION = "duration";					///< Entry duration key name
+	const char* JSON_KEY_WEIGHT = "weight";						///< Entry weight key name
+	const char* JSON_KEY_TRANSITION = "transition";				///< Entry transition key name
+	const char* TRANSITION_NAMES[3] { "cut", "wipe", "dissolve" };	///< Transition names
+	const char* MODE_NAMES[2] { "ordered", "weighted" };		///< Mode names
+
+	/// @brief Select next entry and look up its effect
+	void _preloadNext();
+
+	/// @brief Stop current entry and start the preloaded one
+	void _switchToNext();
+
+	/// @brief Write transition frame to display
+	/// @param elapsed Milliseconds since transition start
+	void _renderTransition(uint32_t elapsed);
+};
+
+#endif //ARDUINO_WOPR_JBWOPRPLAYLISTEFFECT_H
@@ -0,0 +1,284 @@
+/// @file jbwoprscripteffect.cpp
+/// @author Jonny Bergdahl
+/// @brief Source file for the JBWoprScriptEffect.
+/// @details Contains implementation of the JBWoprScriptEffect class.
+/// This code is distributed under the MIT License. See LICENSE for details.
+/// @date Created: 2026-10-18
+/// @copyright Copyright© 2026, Jonny Bergdahl
+///
+#include "jbwoprscripteffect.h"
+#include "jbwopr.h"
+#include <algorithm>
+
+// ============================================
+//
+// JBWoprScriptEffect
+//
+JBWoprScriptEffect::JBWoprScriptEffect(JBWoprDevice *woprDevice,
+									   const std::string& name,
+									   uint32_t duration)
+	: JBWoprEffectBase(woprDevice, duration, name) {
+	_resources = RESOURCE_NONE;
+}
+
+void JBWoprScriptEffect::start() {
+	JBWoprEffectBase::start();
+	_done = false;
+	_pc = 0;
+	_cycleStart = 0;
+	_audioActive = false;
+	_fadeActive = 0;
+}
+
+void JBWoprScriptEffect::loop() {
+	if (!_isRunning) {
+		return;
+	}
+	JBWoprEffectBase::loop();
+	if (!_isRunning) {
+		return;
+	}
+
+	if (_audioActive && (int32_t)(_woprDevice->effectsGetAnimationTime() - _audioEnd) >= 0) {
+		_woprDevice->audioClear();
+		_audioActive = false;
+	}
+	if (_done || _steps.empty()) {
+		return;
+	}
+
+	uint32_t time = _getAnimationTime() - _cycleStart;
+	if (time >= _length) {
+		// Finish the timeline, then restart it if the effect runs until stopped
+		_runSteps(_length);
+		if (_duration != (uint32_t)-1) {
+			_startTime = millis();
+			_done = true;
+			return;
+		}
+		_cycleStart += time - time % _length;
+		time %= _length;
+		_pc = 0;
+		_fadeActive = 0;
+	}
+	_runSteps(time);
+	_updateFades(time);
+}
+
+bool JBWoprScriptEffect::setFromJsonDocument(const JsonDocument& jsonDoc) {
+	std::vector<Step> steps;
+	std::string texts;
+	std::vector<uint16_t> segments;
+	uint8_t resources = RESOURCE_NONE;
+	uint32_t end = 0;
+
+	for (JsonVariantConst item : jsonDoc[JSON_KEY_DISPLAY].as<JsonArrayConst>()) {
+		Step step { item[JSON_KEY_AT].as<uint32_t>(), 0, 0, JBWOPR_SCRIPT_STEP_NONE, SCRIPT_OP_TEXT, 0, false };
+		JsonArrayConst raw = item[JSON_KEY_SEGMENTS].as<JsonArrayConst>();
+		if (!raw.isNull()) {
+			step.op = SCRIPT_OP_SEGMENTS;
+			step.value = segments.size();
+			for (size_t i = 0; i < 12; i++) {
+				segments.push_back(i < raw.size() ? raw[i].as<uint16_t>() : 0);
+			}
+		} else {
+			std::string text = item[JSON_KEY_TEXT].as<const char*>() == nullptr ? "" : item[JSON_KEY_TEXT].as<const char*>();
+			std::string align = item[JSON_KEY_ALIGN].as<const char*>() == nullptr ? "" : item[JSON_KEY_ALIGN].as<const char*>();
+			if (align == ALIGN_NAMES[JBTextAlignment::CENTER]) {
+				text = JBStringHelper::getCenteredString(text, 12);
+			} else if (align == ALIGN_NAMES[JBTextAlignment::RIGHT]) {
+				text = JBStringHelper::getRightAlignedString(text, 12);
+			}
+			text.resize(12, ' ');
+			step.value = texts.size();
+			texts += text;
+		}
+		steps.push_back(step);
+		resources |= RESOURCE_DISPLAY;
+		end = std::max(end, step.time);
+	}
+
+	for (JsonVariantConst item : jsonDoc[JSON_KEY_LEDS].as<JsonArrayConst>()) {
+		uint8_t led = item[JSON_KEY_LED].isNull() ? JBWOPR_SCRIPT_LED_ALL : item[JSON_KEY_LED].as<uint8_t>();
+		if (led != JBWOPR_SCRIPT_LED_ALL && led >= 5) {
+			_log.warning("Script %s: LED index %u out of range", getName().c_str(), led);
+			continue;
+		}
+		Step step { item[JSON_KEY_AT].as<uint32_t>(), _getColor(item[JSON_KEY_COLOR]), 0,
+					JBWOPR_SCRIPT_STEP_NONE, SCRIPT_OP_LEDS, led, item[JSON_KEY_FADE].as<bool>() };
+		steps.push_back(step);
+		resources |= RESOURCE_DEFCON_LEDS;
+		end = std::max(end, step.time);
+	}
+
+	for (JsonVariantConst item : jsonDoc[JSON_KEY_AUDIO].as<JsonArrayConst>()) {
+		Step step { item[JSON_KEY_AT].as<uint32_t>(), 0,
+					item[JSON_KEY_LENGTH].isNull() ? 200 : item[JSON_KEY_LENGTH].as<uint32_t>(),
+					JBWOPR_SCRIPT_STEP_NONE, SCRIPT_OP_TONE, 0, false };
+		if (!item[JSON_KEY_TONE].isNull()) {
+			step.value = item[JSON_KEY_TONE].as<uint32_t>();
+		} else {
+			const char* noteName = item[JSON_KEY_NOTE].as<const char*>();
+			step.op = SCRIPT_OP_NOTE;
+			step.value = NOTE_MAX;
+			for (uint8_t i = 0; noteName != nullptr && i < 12; i++) {
+				if (strcmp(noteName, NOTE_NAMES[i]) == 0) {
+					step.value = i;
+					break;
+				}
+			}
+			if (step.value == NOTE_MAX) {
+				_log.warning("Script %s: unknown note %s", getName().c_str(), noteName == nullptr ? "" : noteName);
+				continue;
+			}
+			step.arg = item[JSON_KEY_OCTAVE].isNull() ? 4 : item[JSON_KEY_OCTAVE].as<uint8_t>();
+		}
+		steps.push_back(step);
+		resources |= RESOURCE_AUDIO;
+		end = std::max(end, step.time + step.length);
+	}
+
+	if (steps.empty()) {
+		_log.error("Script %s has no steps", getName().c_str());
+		return false;
+	}
+	if (steps.size() >= JBWOPR_SCRIPT_STEP_NONE) {
+		_log.error("Script %s has too many steps", getName().c_str());
+		return false;
+	}
+
+	// Tracks are merged into one timeline, steps at the same time keep track order
+	std::stable_sort(steps.begin(), steps.end(), [](const Step& a, const Step& b) {
+		return a.time < b.time;
+	});
+	for (size_t i = 0; i < steps.size(); i++) {
+		if (steps[i].op != SCRIPT_OP_LEDS) {
+			continue;
+		}
+		for (size_t j = i + 1; j < steps.size(); j++) {
+			if (steps[j].op == SCRIPT_OP_LEDS && steps[j].arg == steps[i].arg) {
+				steps[i].next = j;
+				break;
+			}
+		}
+	}
+
+	if (_isRunning) {
+		stop();
+	}
+	_steps = std::move(steps);
+	_texts = std::move(texts);
+	_segments = std::move(segments);
+	_resources = resources;
+	_length = jsonDoc[JSON_KEY_LENGTH].isNull() ? end : jsonDoc[JSON_KEY_LENGTH].as<uint32_t>();
+	if (_length == 0) {
+		_length = 1;
+	}
+	_log.debug("Script %s compiled, %i steps, length %u ms", getName().c_str(), _steps.size(), _length);
+	return true;
+}
+
+const std::vector<JBWoprScriptEffect::Step>& JBWoprScriptEffect::getSteps() const {
+	return _steps;
+}
+
+uint32_t JBWoprScriptEffect::getLength() const {
+	return _length;
+}
+
+std::string JBWoprScriptEffect::getNameFromJsonDocument(const JsonDocument& jsonDoc) {
+	const char* name = jsonDoc[JBWOPR_SCRIPT_JSON_KEY_NAME].as<const char*>();
+	return name == nullptr ? "" : name;
+}
+
+void JBWoprScriptEffect::_runSteps(uint32_t time) {
+	while (_pc < _steps.size() && _steps[_pc].time <= time) {
+		_runStep(_steps[_pc]);
+		_pc++;
+	}
+}
+
+void JBWoprScriptEffect::_runStep(const Step& step) {
+	switch (step.op) {
+		case SCRIPT_OP_TEXT:
+			for (uint8_t i = 0; i < 12; i++) {
+				_woprDevice->displaySetChar(i, _texts[step.value + i]);
+			}
+			_woprDevice->displayShow();
+			break;
+		case SCRIPT_OP_SEGMENTS:
+			for (uint8_t i = 0; i < 12; i++) {
+				_woprDevice->displaySetRaw(i, _segments[step.value + i]);
+			}
+			_woprDevice->displayShow();
+			break;
+		case SCRIPT_OP_LEDS: {
+			uint8_t mask = step.arg == JBWOPR_SCRIPT_LED_ALL ? 0x1F : 1 << step.arg;
+			const Step* next = step.next == JBWOPR_SCRIPT_STEP_NONE ? nullptr : &_steps[step.next];
+			auto leds = _woprDevice->getDefconLeds();
+			for (uint8_t i = 0; i < 5; i++) {
+				if (!(mask & (1 << i))) {
+					continue;
+				}
+				leds->setPixelColor(i, step.value);
+				_fadeActive &= ~(1 << i);
+				if (next != nullptr && next->fade) {
+					_fadeFrom[i] = step.value;
+					_fadeTo[i] = next->value;
+					_fadeStart[i] = step.time;
+					_fadeEnd[i] = next->time;
+					_fadeActive |= 1 << i;
+				}
+			}
+			_woprDevice->defconLedsShow();
+			break;
+		}
+		case SCRIPT_OP_NOTE:
+			_woprDevice->audioPlayNote((note_t)step.value, step.arg);
+			_audioEnd = _woprDevice->effectsGetAnimationTime() + step.length;
+			_audioActive = true;
+			break;
+		case SCRIPT_OP_TONE:
+			_woprDevice->audioPlayTone(step.value);
+			_audioEnd = _woprDevice->effectsGetAnimationTime() + step.length;
+			_audioActive = true;
+			break;
+		default:
+			break;
+	}
+}
+
+void JBWoprScriptEffect::_updateFades(uint32_t time) {
+	if (_fadeActive == 0) {
+		return;
+	}
+	auto leds = _woprDevice->getDefconLeds();
+	for (uint8_t i = 0; i < 5; i++) {
+		if (!(_fadeActive & (1 << i))) {
+			continue;
+		}
+		uint32_t span = _fadeEnd[i] - _fadeStart[i];
+		uint32_t position = time - _fadeStart[i];
+		if (span == 0 || position >= span) {
+			leds->setPixelColor(i, _fadeTo[i]);
+			_fadeActive &= ~(1 << i);
+			continue;
+		}
+		uint32_t color = 0;
+		for (uint8_t shift = 0; shift < 24; shift += 8) {
+			int32_t from = (_fadeFrom[i] >> shift) & 0xFF;
+			int32_t to = (_fadeTo[i] >> shift) & 0xFF;
+			color |= (uint32_t)(from + (to - from) * (int32_t)position / (int32_t)span) << shift;
+		}
+		leds->setPixelColor(i, color);
+	}
+	_woprDevice->defconLedsShow();
+}
+
+uint32_t JBWoprScriptEffect::_getColor(JsonVariantConst value) {
+	const char* text = value.as<const char*>();
+	if (text != nullptr) {
+		return JBStringHelper::stringToRgb(text);
+	}
+	return value.as<uint32_t>();
+}
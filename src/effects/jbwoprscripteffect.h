@@ -0,0 +1,154 @@
+/// @file jbwoprscripteffect.h
+/// @author Jonny Bergdahl
+/// @brief Header file for the JBWoprScriptEffect.
+/// @details Contains declarations for the JBWoprScriptEffect class.
+/// This code is distributed under the MIT License. See LICENSE for details.
+/// @date Created: 2026-10-18
+/// @copyright Copyright© 2026, Jonny Bergdahl
+///
+#ifndef ARDUINO_WOPR_JBWOPRSCRIPTEFFECT_H
+#define ARDUINO_WOPR_JBWOPRSCRIPTEFFECT_H
+
+#include "jbwopreffects.h"
+#include <ArduinoJson.h>
+
+#define JBWOPR_SCRIPT_STEP_NONE 0xFFFF		///< No step index
+#define JBWOPR_SCRIPT_LED_ALL 0xFF			///< Step applies to all DEFCON LEDs
+#define JBWOPR_SCRIPT_JSON_KEY_NAME "name"	///< Script name key name
+
+/// @brief Script step operations
+enum JBWoprScriptOp {
+	SCRIPT_OP_TEXT = 0,						///< Show text, value is offset in text pool
+	SCRIPT_OP_SEGMENTS,						///< Show raw segments, value is offset in segment pool
+	SCRIPT_OP_LEDS,							///< Set DEFCON LED color, value is RGB color
+	SCRIPT_OP_NOTE,							///< Play note, value is note, arg is octave
+	SCRIPT_OP_TONE							///< Play tone, value is frequency
+};
+
+/// @brief Effect running a declarative script
+/// @details A script is a JSON document with display, LED and audio tracks
+/// on a common timeline. It is compiled once, into a flat list of steps
+/// sorted by time, so running it does not allocate memory.
+///
+/// @code{.json}
+/// {
+///   "name": "Alert",
+///   "length": 2000,
+///   "display": [ { "at": 0, "text": "ALERT", "align": "center" },
+///                { "at": 1000, "segments": [ 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 ] } ],
+///   "leds": [ { "at": 0, "color": "255,0,0" },
+///             { "at": 1000, "color": 0, "fade": true },
+///             { "at": 0, "led": 4, "color": "0,0,255" } ],
+///   "audio": [ { "at": 0, "note": "A", "octave": 5, "length": 200 },
+///              { "at": 500, "tone": 440, "length": 100 } ]
+/// }
+/// @endcode
+///
+/// The timeline restarts after `length` milliseconds if the effect duration is
+/// infinite, otherwise it plays once. A LED keyframe with `fade` fades from the
+/// previous keyframe of the same LED.
+class JBWoprScriptEffect : public JBWoprEffectBase {
+public:
+	/// @brief Compiled script step
+	struct Step {
+		uint32_t time;						///< Time from start of timeline, milliseconds
+		uint32_t value;						///< Operation value
+		uint32_t length;					///< Length of note or tone, milliseconds
+		uint16_t next;						///< Next LED keyframe for the same LED, JBWOPR_SCRIPT_STEP_NONE if none
+		uint8_t op;							///< JBWoprScriptOp
+		uint8_t arg;						///< LED index or octave
+		bool fade;							///< Fade from previous LED keyframe
+	};
+
+	/// @brief Constructor
+	/// @ingroup EffectGroup
+	/// @param woprDevice JBWoprDevice instance
+	/// @param name Name of effect
+	/// @param duration (optional) Duration of effect in milliseconds, default is -1 (infinite)
+	explicit JBWoprScriptEffect(JBWoprDevice *woprDevice,
+								const std::string& name,
+								uint32_t duration = -1);
+
+	/// @brief Start effect
+	/// @ingroup EffectGroup
+	void start() override;
+
+	/// @brief Run loop
+	/// @ingroup EffectGroup
+	void loop() override;
+
+	/// @brief Compile script from JSON document
+	/// @ingroup EffectGroup
+	/// @details The effect is stopped if it is running. The previous script is
+	/// kept if the document is invalid.
+	/// @param jsonDoc JSON document
+	/// @return True if successful
+	bool setFromJsonDocument(const JsonDocument& jsonDoc);
+
+	/// @brief Get compiled steps
+	/// @ingroup EffectGroup
+	/// @return Steps, sorted by time
+	const std::vector<Step>& getSteps() const;
+
+	/// @brief Get timeline length
+	/// @ingroup EffectGroup
+	/// @return Length in milliseconds
+	uint32_t getLength() const;
+
+	/// @brief Get script name from JSON document
+	/// @ingroup EffectGroup
+	/// @param jsonDoc JSON document
+	/// @return Name, empty if not set
+	static std::string getNameFromJsonDocument(const JsonDocument& jsonDoc);
+
+protected:
+	std::vector<Step> _steps;				///< Compiled steps, sorted by time
+	std::string _texts;						///< Text pool, 12 characters per text
+	std::vector<uint16_t> _segments;		///< Segment pool, 12 values per entry
+	uint32_t _length = 0;					///< Timeline length in milliseconds
+	size_t _pc = 0;							///< Next step to run
+	uint32_t _cycleStart = 0;				///< Animation time of current timeline start
+	uint32_t _audioEnd = 0;					///< Time when note or tone ends
+	bool _audioActive = false;				///< True while note or tone is playing
+	uint8_t _fadeActive = 0;				///< Bit mask of LEDs that are fading
+	uint32_t _fadeFrom[5] {};				///< Fade start color per LED
+	uint32_t _fadeTo[5] {};					///< Fade end color per LED
+	uint32_t _fadeStart[5] {};				///< Fade start time per LED
+	uint32_t _fadeEnd[5] {};				///< Fade end time per LED
+
+	const char* JSON_KEY_LENGTH = "length";						///< Length key name
+	const char* JSON_KEY_DISPLAY = "display";					///< Display track key name
+	const char* JSON_KEY_LEDS = "leds";							///< LED track key name
+	const char* JSON_KEY_AUDIO = "audio";						///< Audio track key name
+	const char* JSON_KEY_AT = "at";								///< Step time key name
+	const char* JSON_KEY_TEXT = "text";							///< Text key name
+	const char* JSON_KEY_ALIGN = "align";						///< Alignment key name
+	const char* JSON_KEY_SEGMENTS = "segments";					///< Segments key name
+	const char* JSON_KEY_LED = "led";							///< LED index key name
+	const char* JSON_KEY_COLOR = "color";						///< Color key name
+	const char* JSON_KEY_FADE = "fade";							///< Fade key name
+	const char* JSON_KEY_NOTE = "note";							///< Note key name
+	const char* JSON_KEY_OCTAVE = "octave";						///< Octave key name
+	const char* JSON_KEY_TONE = "tone";							///< Tone key name
+	const char* ALIGN_NAMES[3] { "left", "center", "right" };	///< Alignment names, in JBTextAlignment order
+	const char* NOTE_NAMES[12] { "C", "C#", "D", "Eb", "E", "F", "F#", "G", "G#", "A", "Bb", "B" };	///< Note names, in note_t order
+
+	/// @brief Run step
+	/// @param step Step
+	void _runStep(const Step& step);
+
+	/// @brief Run steps up to a time
+	/// @param time Time from start of timeline
+	void _runSteps(uint32_t time);
+
+	/// @brief Update fading LEDs
+	/// @param time Time from start of timeline
+	void _updateFades(uint32_t time);
+
+	/// @brief Get color from JSON value
+	/// @param value Number or "r,g,b" string
+	/// @return RGB color
+	uint32_t _getColor(JsonVariantConst value);
+};
+
+#endif //ARDUINO_WOPR_JBWOPRSCRIPTEFFECT_H
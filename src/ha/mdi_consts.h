@@ -16,6 +16,7 @@ const char* MDI_ICON_CALENDAR = "mdi:calendar";
 const char* MDI_ICON_CLOCK_DIGITAL = "mdi:clock-digital";
 const char* MID_ICON_FORMAT_TEXT = "mdi:format-text";
 const char* MDI_ICON_LIGHTBULB = "mdi:lightbulb";
+const char* MDI_ICON_MESSAGE_OFF_OUTLINE = "mdi:message-off-outline";
 const char* MDI_ICON_MEMORY = "mdi:memory";
 const char* MDI_ICON_NUMERIC_5_BOX_OUTLINE = "mdi:numeric-5-box-outline";
 const char* MDI_ICON_IP_NETWORK = "mdi:ip-network";
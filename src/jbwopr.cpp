@@ -19,8 +19,10 @@ JBWoprDevice::JBWoprDevice() :
 		"%Y-%m-%d",				// timeGmtOffset
 		50,					// displayBrightness
 		50,				// defconLedsBrightness
-		30					// effectsTimeout
+		30,					// effectsTimeout
+		100					// effectsSpeed
 	},
+   _playlist(this),
    _display { Adafruit_AlphaNum4(), Adafruit_AlphaNum4(), Adafruit_AlphaNum4() },
    _defconColors { 0xFFFFFF, 0xFF0000, 0xFFFF00, 0x00FF00, 0x0000FF }
 {
@@ -68,6 +70,11 @@ bool JBWoprDevice::begin(JBWoprBoardVariant variant, JBWoprBoardPins pins) {
 
 	_pins = pins;
 	JBTimeHelper::configure(_log);
+	if (!_effectsRandomSeeded) {
+		effectsSetRandomSeed(esp_random());
+	}
+	// Effects started during begin() must not skip ahead by the boot time
+	_effectsAnimationMillis = millis();
 
 	// Buttons
 	_log->trace("Button pins: %i, %i, %i, %i", pins.buttonFrontLeftPin, pins.buttonFrontRightPin, pins.buttonBackTopPin, pins.buttonBackBottomPin);
@@ -136,34 +143,29 @@ void JBWoprDevice::loop()
 		_buttonBackBottom->tick();
 	}
 
-	// Handle current effect
-	if (effectsCurrentEffectIsRunning()) {
-		_currentEffect->loop();
+	// Handle running effects
+	_effectsLoop();
+
+	if (_defaultEffect == nullptr || effectsDefaultEffectIsRunning()) {
 		return;
 	}
 
-	if (_defaultEffect == nullptr) {
+	// The default effect waits until the resources it uses are free
+	if (effectsGetResourcesInUse() & _defaultEffect->getResources()) {
+		_effectsCounter = 0;
 		return;
 	}
 
-	if (!effectsDefaultEffectIsRunning()) {
-
-		if (_effectsCounter == 0) {
-			// Effect just stopped running, start timer
-			_effectsCounter = millis() + _config.effectsTimeout * 1000;
-			return;
-		}
-
-		if (millis() > _effectsCounter) {
-			// Timer expired, start default effect
-			effectsStartEffect(_defaultEffect);
-			_effectsCounter = 0;
-			return;
-		}
+	if (_effectsCounter == 0) {
+		// Effect just stopped running, start timer
+		_effectsCounter = millis() + _config.effectsTimeout * 1000;
+		return;
 	}
 
-	if (_defaultEffect->isRunning()) {
-		_defaultEffect->loop();
+	if (millis() > _effectsCounter) {
+		// Timer expired, start default effect
+		effectsStartEffect(_defaultEffect);
+		_effectsCounter = 0;
 	}
 }
 
@@ -189,14 +191,39 @@ bool JBWoprDevice::effectsDefaultEffectIsRunning() {
 	return false;
 }
 
-void JBWoprDevice::effectsRegisterEffect(JBWoprEffectBase* effect) {
+uint32_t JBWoprDevice::effectsRegisterEffect(JBWoprEffectBase* effect) {
+	effect->_id = _effects.size();
 	_effects.push_back(effect);
+	if (effectsGetEffect(effect->_name.c_str()) != nullptr) {
+		_log->warning("Effect name %s is already registered, use ID %i", effect->_name.c_str(), effect->_id);
+		return effect->_id;
+	}
+	_effectsByName.emplace(JBStringHelper::hash(effect->_name.c_str()), effect);
+	return effect->_id;
 }
 
-std::vector<JBWoprEffectBase*> JBWoprDevice::effectsGetRegisteredEffects() {
+const std::vector<JBWoprEffectBase*>& JBWoprDevice::effectsGetRegisteredEffects() const {
 	return _effects;
 }
 
+JBWoprEffectBase* JBWoprDevice::effectsGetEffect(uint32_t id) const {
+	if (id >= _effects.size()) {
+		return nullptr;
+	}
+	return _effects[id];
+}
+
+JBWoprEffectBase* JBWoprDevice::effectsGetEffect(const char* name) const {
+	// Names with the same hash share a bucket, compare the stored name
+	auto range = _effectsByName.equal_range(JBStringHelper::hash(name));
+	for (auto item = range.first; item != range.second; ++item) {
+		if (item->second->_name == name) {
+			return item->second;
+		}
+	}
+	return nullptr;
+}
+
 JBWoprEffectBase* JBWoprDevice::effectsGetCurrentEffect() {
 	return _currentEffect;
 }
@@ -204,7 +231,7 @@ JBWoprEffectBase* JBWoprDevice::effectsGetCurrentEffect() {
 void JBWoprDevice::effectsStartCurrentEffect() {
 	_effectsCounter = 0;
 	if (_currentEffect != nullptr) {
-		_currentEffect->start();
+		effectsStartLayeredEffect(_currentEffect, JBWOPR_EFFECT_PRIORITY_NORMAL);
 	}
 }
 
@@ -222,23 +249,246 @@ bool JBWoprDevice::effectsCurrentEffectIsRunning() {
 }
 
 void JBWoprDevice::effectsStartEffect(JBWoprEffectBase* effect) {
+	_effectsStartEffect(effect);
+}
+
+void JBWoprDevice::effectsStartEffect(const std::string& name) {
+	effectsStartEffect(name.c_str());
+}
+
+void JBWoprDevice::effectsStartEffect(const char* name) {
+	JBWoprEffectBase* effect = effectsGetEffect(name);
+	if (effect == nullptr) {
+		_log->warning("Effect %s not found", name);
+		return;
+	}
+	effectsStartEffect(effect);
+}
+
+void JBWoprDevice::effectsStartEffectById(uint32_t id) {
+	JBWoprEffectBase* effect = effectsGetEffect(id);
+	if (effect == nullptr) {
+		_log->warning("Effect ID %i not found", id);
+		return;
+	}
+	effectsStartEffect(effect);
+}
+
+bool JBWoprDevice::effectsStartLayeredEffect(JBWoprEffectBase* effect, uint8_t priority) {
+	uint8_t resources = effect->getResources();
+	for (uint8_t i = 0; i < JBWOPR_EFFECT_LAYER_COUNT; i++) {
+		JBWoprEffectBase* owner = _effectsLayers[i];
+		if ((resources & (1 << i)) && owner != nullptr && owner != effect &&
+			owner->isRunning() && _effectsLayerPriorities[i] > priority) {
+			_log->debug("Effect %s blocked by %s", effect->getName().c_str(), owner->getName().c_str());
+			if (effect->getPool() != nullptr) {
+				effect->getPool()->release(effect);
+			}
+			return false;
+		}
+	}
+	for (uint8_t i = 0; i < JBWOPR_EFFECT_LAYER_COUNT; i++) {
+		JBWoprEffectBase* owner = _effectsLayers[i];
+		if (!(resources & (1 << i)) || owner == nullptr || owner == effect) {
+			continue;
+		}
+		if (owner->isRunning()) {
+			_log->trace("Effect %s preempted by %s", owner->getName().c_str(), effect->getName().c_str());
+			owner->stop();
+		}
+		_effectsReleaseLayers(owner);
+	}
+	for (uint8_t i = 0; i < JBWOPR_EFFECT_LAYER_COUNT; i++) {
+		if (resources & (1 << i)) {
+			_effectsLayers[i] = effect;
+			_effectsLayerPriorities[i] = priority;
+		}
+	}
+	effect->start();
+	return true;
+}
+
+bool JBWoprDevice::_effectsStartEffect(JBWoprEffectBase* effect) {
 	_log->trace("Starting effect %s", effect->getName().c_str());
 	_effectsCounter = 0;
+	if (!effectsStartLayeredEffect(effect, JBWOPR_EFFECT_PRIORITY_NORMAL)) {
+		return false;
+	}
 	_currentEffect = effect;
-	_currentEffect->start();
+	return true;
 }
 
-void JBWoprDevice::effectsStartEffect(const std::string& name) {
-	for (const auto& effect : _effects) {
+void JBWoprDevice::effectsStopAllEffects() {
+	for (uint8_t i = 0; i < JBWOPR_EFFECT_LAYER_COUNT; i++) {
+		JBWoprEffectBase* effect = _effectsLayers[i];
+		if (effect != nullptr) {
+			if (effect->isRunning()) {
+				effect->stop();
+			}
+			_effectsReleaseLayers(effect);
+		}
+	}
+}
+
+JBWoprEffectBase* JBWoprDevice::effectsGetLayerEffect(JBWoprEffectResource resource) {
+	for (uint8_t i = 0; i < JBWOPR_EFFECT_LAYER_COUNT; i++) {
+		if (resource & (1 << i)) {
+			return _effectsLayers[i];
+		}
+	}
+	return nullptr;
+}
+
+JBWoprPlaylistEffect* JBWoprDevice::effectsGetPlaylist() {
+	return &_playlist;
+}
+
+void JBWoprDevice::effectsSetRandomSeed(uint32_t seed) {
+	_log->trace("Effects random seed: %u", seed);
+	_effectsRandom.setSeed(seed);
+	_effectsRandomSeeded = true;
+}
+
+uint32_t JBWoprDevice::effectsGetRandomSeed() const {
+	return _effectsRandom.getSeed();
+}
+
+JBRandom& JBWoprDevice::effectsGetRandom() {
+	return _effectsRandom;
+}
+
+void JBWoprDevice::effectsSetSpeed(uint16_t speed) {
+	if (speed < JBWOPR_EFFECT_SPEED_MIN) {
+		speed = JBWOPR_EFFECT_SPEED_MIN;
+	} else if (speed > JBWOPR_EFFECT_SPEED_MAX) {
+		speed = JBWOPR_EFFECT_SPEED_MAX;
+	}
+	_config.effectsSpeed = speed;
+}
+
+uint16_t JBWoprDevice::effectsGetSpeed() const {
+	return _config.effectsSpeed;
+}
+
+uint32_t JBWoprDevice::effectsGetAnimationTime() const {
+	return _effectsAnimationTime;
+}
+
+void JBWoprDevice::_effectsAdvanceAnimationTime() {
+	uint32_t now = millis();
+	// Keep the remainder, so slow speeds do not lose time on fast frames
+	uint64_t scaled = (uint64_t)(now - _effectsAnimationMillis) * _config.effectsSpeed + _effectsAnimationRemainder;
+	_effectsAnimationMillis = now;
+	_effectsAnimationTime += (uint32_t)(scaled / 100);
+	_effectsAnimationRemainder = (uint32_t)(scaled % 100);
+}
+
+JBWoprScriptEffect* JBWoprDevice::effectsLoadScriptEffect(const JsonDocument& jsonDoc) {
+	std::string name = JBWoprScriptEffect::getNameFromJsonDocument(jsonDoc);
+	if (name.empty()) {
+		_log->error("Script effect has no name");
+		return nullptr;
+	}
+
+	for (JBWoprScriptEffect* effect : _scriptEffects) {
 		if (effect->getName() == name) {
-			effectsStartEffect(effect);
-			return;
+			return effect->setFromJsonDocument(jsonDoc) ? effect : nullptr;
+		}
+	}
+
+	// Script effects were checked above, so this is a built in or user effect
+	if (effectsGetEffect(name.c_str()) != nullptr) {
+		_log->error("Script effect name %s is used by another effect", name.c_str());
+		return nullptr;
+	}
+
+	auto effect = new JBWoprScriptEffect(this, name);
+	if (!effect->setFromJsonDocument(jsonDoc)) {
+		delete effect;
+		return nullptr;
+	}
+	_scriptEffects.push_back(effect);
+	effectsRegisterEffect(effect);
+	return effect;
+}
+
+uint8_t JBWoprDevice::effectsGetResourcesInUse() {
+	uint8_t result = RESOURCE_NONE;
+	for (uint8_t i = 0; i < JBWOPR_EFFECT_LAYER_COUNT; i++) {
+		if (_effectsLayers[i] != nullptr && _effectsLayers[i]->isRunning()) {
+			result |= 1 << i;
 		}
 	}
+	return result;
 }
 
-void JBWoprDevice::effectsStartEffect(const char* name) {
-	effectsStartEffect(std::string(name));
+bool JBWoprDevice::_effectsLoop() {
+	_effectsAdvanceAnimationTime();
+
+	// Effects render into the device buffers, output is written once per frame
+	_effectsBeginFrame();
+	for (uint8_t i = 0; i < JBWOPR_EFFECT_LAYER_COUNT; i++) {
+		JBWoprEffectBase* effect = _effectsLayers[i];
+		if (effect == nullptr) {
+			continue;
+		}
+		// Effects using several resources only run once per frame
+		bool seen = false;
+		for (uint8_t j = 0; j < i; j++) {
+			seen = seen || _effectsLayers[j] == effect;
+		}
+		if (!seen && effect->isRunning()) {
+			effect->loop();
+		}
+	}
+	bool running = false;
+	for (uint8_t i = 0; i < JBWOPR_EFFECT_LAYER_COUNT; i++) {
+		JBWoprEffectBase* effect = _effectsLayers[i];
+		if (effect == nullptr) {
+			continue;
+		}
+		if (effect->isRunning()) {
+			running = true;
+		} else {
+			_effectsReleaseLayers(effect);
+		}
+	}
+	_effectsEndFrame();
+	return running;
+}
+
+bool JBWoprDevice::_effectsBeginFrame() {
+	if (_effectsFrameActive) {
+		return false;
+	}
+	_effectsFrameActive = true;
+	return true;
+}
+
+void JBWoprDevice::_effectsEndFrame() {
+	_effectsFrameActive = false;
+	if (_displayDirty) {
+		_displayWrite();
+	}
+	if (_defconLedsDirty) {
+		defconLedsShow();
+	}
+}
+
+void JBWoprDevice::_effectsReleaseLayers(JBWoprEffectBase* effect) {
+	for (uint8_t i = 0; i < JBWOPR_EFFECT_LAYER_COUNT; i++) {
+		if (_effectsLayers[i] == effect) {
+			_effectsLayers[i] = nullptr;
+			_effectsLayerPriorities[i] = JBWOPR_EFFECT_PRIORITY_LOW;
+		}
+	}
+	// Transient effects are destroyed as soon as they are done
+	if (effect->getPool() != nullptr && !effect->isRunning()) {
+		if (_currentEffect == effect) {
+			_currentEffect = nullptr;
+		}
+		effect->getPool()->release(effect);
+	}
 }
 
 // ------------------------------------------------------------------
@@ -279,6 +529,16 @@ void JBWoprDevice::displayClear()
 
 void JBWoprDevice::displayShow()
 {
+	if (_effectsFrameActive) {
+		_displayDirty = true;
+		return;
+	}
+	_displayWrite();
+}
+
+void JBWoprDevice::_displayWrite()
+{
+	_displayDirty = false;
 	_display[0].writeDisplay();
 	_display[1].writeDisplay();
 	_display[2].writeDisplay();
@@ -291,6 +551,16 @@ void JBWoprDevice::displaySetChar(uint8_t index, char chr)
 	_display[displayIndex].writeDigitAscii(digitIndex, chr);
 }
 
+uint16_t JBWoprDevice::displayGetRaw(uint8_t index)
+{
+	return _display[index / 4].displaybuffer[index % 4];
+}
+
+void JBWoprDevice::displaySetRaw(uint8_t index, uint16_t value)
+{
+	_display[index / 4].writeDigitRaw(index % 4, value);
+}
+
 void JBWoprDevice::displayShowText(const char* text, JBTextAlignment alignment)
 {
 	uint8_t curDisplay = 0;
@@ -354,6 +624,15 @@ void JBWoprDevice::displayShowText(const String& text)
 	displayShowText(text.c_str(), JBTextAlignment::LEFT);
 }
 
+bool JBWoprDevice::displayStartScrollText(const std::string& text, uint16_t delay_ms, uint8_t priority) {
+	JBWoprScrollTextDisplayEffect* effect = _scrollTextPool.create(this, text, delay_ms, 0);
+	if (effect == nullptr) {
+		_log->warning("No free scroll text effect");
+		return false;
+	}
+	return effectsStartLayeredEffect(effect, priority);
+}
+
 void JBWoprDevice::displayScrollText(const char* text, uint16_t delay_ms) {
 	uint8_t curDisplay = 0;
 	uint8_t curDigit = 0;
@@ -425,7 +704,7 @@ void JBWoprDevice::defconLedsSetState(bool state) {
 	for (int i = 0; i < 5; i++) {
 		_defconLeds.setPixelColor(i, _defconPixels[i]);
 	}
-	_defconLeds.show();
+	defconLedsShow();
 }
 
 void JBWoprDevice::defconLedsSetDefconLevel(JBDefconLevel level) {
@@ -443,7 +722,7 @@ void JBWoprDevice::defconLedsSetDefconLevel(JBDefconLevel level) {
 			_defconLeds.setPixelColor(i, 0);
 		}
 	}
-	_defconLeds.show();
+	defconLedsShow();
 }
 
 void JBWoprDevice::defconLedsSetColor(uint32_t color)
@@ -455,7 +734,7 @@ void JBWoprDevice::defconLedsSetColor(uint32_t color)
 		_defconPixels[i] = color;
 		_defconLeds.setPixelColor(i, color);
 	}
-	_defconLeds.show();
+	defconLedsShow();
 }
 
 void JBWoprDevice::defconLedsSetBrightness(uint8_t brightness) {
@@ -466,13 +745,23 @@ void JBWoprDevice::defconLedsSetBrightness(uint8_t brightness) {
 	for (int i = 0; i < 5; i++) {
 		_defconLeds.setPixelColor(i, _defconPixels[i]);
 	}
-	_defconLeds.show();
+	defconLedsShow();
 }
 
 void JBWoprDevice::defconLedsClear()
 {
 	_log->trace("defconLedsClear");
 	_defconLeds.clear();
+	defconLedsShow();
+}
+
+void JBWoprDevice::defconLedsShow()
+{
+	if (_effectsFrameActive) {
+		_defconLedsDirty = true;
+		return;
+	}
+	_defconLedsDirty = false;
 	_defconLeds.show();
 }
 
@@ -483,7 +772,7 @@ void JBWoprDevice::defconLedSetColor(JBDefconLevel level, uint32_t color)
 		uint32_t pixel = _getDefconLedsPixel(level);
 		_defconPixels[(int) level] = color;
 		_defconLeds.setPixelColor(pixel, color);
-		_defconLeds.show();
+		defconLedsShow();
 	}
 }
 
@@ -12,6 +12,7 @@
 #include <Arduino.h>
 #include <map>
 #include <list>
+#include <unordered_map>
 //#include <driver/i2s.h>
 #include <jblogger.h>
 #include <Adafruit_GFX.h>                  	// https://github.com/adafruit/Adafruit-GFX-Library
@@ -20,10 +21,18 @@
 #include <OneButton.h>                     	// https://github.com/mathertel/OneButton
 #include <ArduinoJson.h>					// https://github.com/bblanchon/ArduinoJson
 #include "effects/jbwopreffects.h"
+#include "effects/jbwoprplaylisteffect.h"
+#include "effects/jbwoprscripteffect.h"
+#include "effects/jbwopreffectpool.h"
 #include "jbwoprhelpers.h"
 
 #define LIBRARY_VERSION "1.2.0";
 
+#define JBWOPR_EFFECT_LAYER_COUNT 3		///< Number of effect layers, one per JBWoprEffectResource
+#define JBWOPR_SCROLL_TEXT_POOL_SIZE 2	///< Number of pooled scroll text effects
+#define JBWOPR_EFFECT_SPEED_MIN 10		///< Minimum effects speed, percent
+#define JBWOPR_EFFECT_SPEED_MAX 1000	///< Maximum effects speed, percent
+
 /// @brief W.O.P.R. board version
 enum JBWoprBoardVariant {
 	ORIGINAL = 0,							///< Original W.O.P.R. board
@@ -57,6 +66,7 @@ struct JBWoprConfiguration {
 	uint8_t displayBrightness;              ///< Display brightness
 	uint8_t defconLedsBrightness;           ///< DEFCON LEDs brightness
 	uint8_t effectsTimeout;                 ///< Effects timeout, seconds
+	uint16_t effectsSpeed;                  ///< Effects animation speed, percent
 };
 
 /// @defgroup DisplayGroup Display related methods
@@ -153,13 +163,29 @@ public:
 
 	/// @brief Register effect
 	/// @ingroup EffectsGroup
+	/// @details The effect is assigned an ID equal to its registration index.
+	/// Effect names should be unique, if a name is already registered the
+	/// effect can only be started by its ID.
 	/// @param effect Effect to register
-	void effectsRegisterEffect(JBWoprEffectBase* effect);
+	/// @return ID of registered effect
+	uint32_t effectsRegisterEffect(JBWoprEffectBase* effect);
 
 	/// @brief Get a list of registered effects
 	/// @ingroup EffectsGroup
-	/// @return Default effects
-	std::vector<JBWoprEffectBase*> effectsGetRegisteredEffects();
+	/// @return Registered effects, indexed by effect ID
+	const std::vector<JBWoprEffectBase*>& effectsGetRegisteredEffects() const;
+
+	/// @brief Get registered effect by ID
+	/// @ingroup EffectsGroup
+	/// @param id ID of effect
+	/// @return Effect, or nullptr if not found
+	JBWoprEffectBase* effectsGetEffect(uint32_t id) const;
+
+	/// @brief Get registered effect by name
+	/// @ingroup EffectsGroup
+	/// @param name Name of effect
+	/// @return Effect, or nullptr if not found
+	JBWoprEffectBase* effectsGetEffect(const char* name) const;
 
 	/// @brief Get current effect
 	/// @ingroup EffectsGroup
@@ -195,6 +221,93 @@ public:
 	/// @param name Name of effect to start
 	virtual void effectsStartEffect(const char* name);
 
+	/// @brief Start effect by ID
+	/// @ingroup EffectsGroup
+	/// @param id ID of effect to start
+	virtual void effectsStartEffectById(uint32_t id);
+
+	/// @brief Start effect on the layers for the resources it uses
+	/// @ingroup EffectsGroup
+	/// @details Effects using other resources keep running. Running effects that
+	/// share a resource with the new effect are stopped, unless one of them has a
+	/// higher priority in which case the new effect is not started.
+	/// A pooled effect is owned by the device once passed to this method, it is
+	/// returned to its pool when it stops or if it could not be started.
+	/// @param effect Effect to start
+	/// @param priority Effect priority, JBWOPR_EFFECT_PRIORITY_NORMAL is used by effectsStartEffect()
+	/// @return True if effect was started
+	virtual bool effectsStartLayeredEffect(JBWoprEffectBase* effect, uint8_t priority);
+
+	/// @brief Stop all running effects, on all layers
+	/// @ingroup EffectsGroup
+	virtual void effectsStopAllEffects();
+
+	/// @brief Get effect running on a layer
+	/// @ingroup EffectsGroup
+	/// @param resource Resource for layer
+	/// @return Effect, or nullptr if no effect is running on the layer
+	JBWoprEffectBase* effectsGetLayerEffect(JBWoprEffectResource resource);
+
+	/// @brief Get playlist effect
+	/// @ingroup EffectsGroup
+	/// @details The playlist is not registered by default, start it with
+	/// effectsStartEffect() or register it as the default effect.
+	/// @return Playlist effect
+	JBWoprPlaylistEffect* effectsGetPlaylist();
+
+	/// @brief Load script effect from JSON document
+	/// @ingroup EffectsGroup
+	/// @details The script is compiled and registered under its name. If a
+	/// script effect with the same name is loaded, it is replaced, keeping its ID.
+	/// A script can not use the name of another effect.
+	/// @param jsonDoc Script JSON document, see JBWoprScriptEffect
+	/// @return Script effect, or nullptr if the script is invalid or the name is used
+	JBWoprScriptEffect* effectsLoadScriptEffect(const JsonDocument& jsonDoc);
+
+	/// @brief Get resources used by running effects
+	/// @ingroup EffectsGroup
+	/// @return Combination of JBWoprEffectResource values
+	uint8_t effectsGetResourcesInUse();
+
+	/// @brief Set seed of the effects random number generator
+	/// @ingroup EffectsGroup
+	/// @details The generator is seeded from esp_random() in begin(), unless a
+	/// seed has been set before. Setting a fixed seed makes effect runs repeatable.
+	/// @param seed Seed
+	void effectsSetRandomSeed(uint32_t seed);
+
+	/// @brief Get seed of the effects random number generator
+	/// @ingroup EffectsGroup
+	/// @return Seed
+	uint32_t effectsGetRandomSeed() const;
+
+	/// @brief Get the effects random number generator
+	/// @ingroup EffectsGroup
+	/// @details Effects should use this generator instead of random() or esp_random().
+	/// @return Random number generator
+	JBRandom& effectsGetRandom();
+
+	/// @brief Set effects animation speed
+	/// @ingroup EffectsGroup
+	/// @details Scales the animation clock, 100 is normal speed. Use a high value
+	/// for demo mode and a low value for ambient mode.
+	/// @param speed Speed in percent, 10 - 1000
+	void effectsSetSpeed(uint16_t speed);
+
+	/// @brief Get effects animation speed
+	/// @ingroup EffectsGroup
+	/// @return Speed in percent
+	uint16_t effectsGetSpeed() const;
+
+	/// @brief Get animation clock
+	/// @ingroup EffectsGroup
+	/// @details Milliseconds scaled by the effects speed. The clock advances once
+	/// per frame, so all effects in a frame see the same time. Effects should
+	/// derive their animation state from this clock, so they keep their speed
+	/// when frames are delayed.
+	/// @return Animation time in milliseconds
+	uint32_t effectsGetAnimationTime() const;
+
 	// ====================================================================
 	// Display
 	//
@@ -214,6 +327,8 @@ public:
 
 	/// @brief Force display to show current data
 	/// @ingroup DisplayGroup
+	/// @note When called from an effect loop the display is updated once,
+	/// after all running effects have rendered the frame.
 	virtual void displayShow();
 
 	/// @brief Set display brightness percentage
@@ -227,6 +342,18 @@ public:
 	/// @param chr Character to display
 	virtual void displaySetChar(uint8_t index, char chr);
 
+	/// @brief Get raw segment bits of a display character
+	/// @ingroup DisplayGroup
+	/// @param index Character index, 0 - 11
+	/// @return Segment bits
+	uint16_t displayGetRaw(uint8_t index);
+
+	/// @brief Set raw segment bits of a display character
+	/// @ingroup DisplayGroup
+	/// @param index Character index, 0 - 11
+	/// @param value Segment bits
+	void displaySetRaw(uint8_t index, uint16_t value);
+
 	/// @brief Set display text
 	/// @ingroup DisplayGroup
 	/// @param text Text to display
@@ -260,6 +387,18 @@ public:
 	/// @param text Text to display
 	virtual void displayShowText(const String& text);
 
+	/// @brief Scroll text once without blocking
+	/// @ingroup DisplayGroup
+	/// @details Uses a pooled JBWoprScrollTextDisplayEffect, which is released
+	/// when the text has finished scrolling.
+	/// @param text Text to scroll
+	/// @param delay_ms Delay between each scroll step
+	/// @param priority Effect priority
+	/// @return True if the effect was started
+	virtual bool displayStartScrollText(const std::string& text,
+										uint16_t delay_ms = 100,
+										uint8_t priority = JBWOPR_EFFECT_PRIORITY_HIGH);
+
 	/// @brief Set display scroll text
 	/// @ingroup DisplayGroup
 	/// @details This method will block until the text has finished scrolling.
@@ -339,6 +478,12 @@ public:
 	/// @ingroup DefconGroup
 	virtual void defconLedsClear();
 
+	/// @brief Force DEFCON LEDs to show current colors
+	/// @ingroup DefconGroup
+	/// @note When called from an effect loop the LEDs are updated once,
+	/// after all running effects have rendered the frame.
+	void defconLedsShow();
+
 	// Individual DEFCON LEDs
 	/// @brief Set individual DEFCON LED's color
 	/// @ingroup DefconGroup
@@ -457,9 +602,46 @@ protected:
 	// Effects
 	//
 	JBWoprEffectBase* _defaultEffect = nullptr;		///< Default effect
-	std::vector<JBWoprEffectBase*> _effects;		///< Effects
+	std::vector<JBWoprEffectBase*> _effects;		///< Effects, indexed by ID
+	std::unordered_multimap<uint32_t, JBWoprEffectBase*> _effectsByName;	///< Effects keyed by name hash, colliding names share a key
 	JBWoprEffectBase* _currentEffect = nullptr;		///< Current effect
 	uint32_t _effectsCounter = 0;					///< Effects counter
+	JBWoprEffectBase* _effectsLayers[JBWOPR_EFFECT_LAYER_COUNT] {};		///< Effect running on each resource layer
+	uint8_t _effectsLayerPriorities[JBWOPR_EFFECT_LAYER_COUNT] {};		///< Priority of effect on each layer
+	bool _effectsFrameActive = false;				///< True while effects render a frame, output is deferred
+	JBWoprPlaylistEffect _playlist;					///< Playlist effect
+	std::vector<JBWoprScriptEffect*> _scriptEffects;	///< Loaded script effects
+	JBRandom _effectsRandom;						///< Random number generator for effects
+	bool _effectsRandomSeeded = false;				///< True if seed has been set
+	uint32_t _effectsAnimationTime = 0;				///< Animation clock, scaled milliseconds
+	uint32_t _effectsAnimationMillis = 0;			///< millis() at last animation clock update
+	uint32_t _effectsAnimationRemainder = 0;		///< Fraction left from last animation clock update
+	JBWoprEffectPool<JBWoprScrollTextDisplayEffect, JBWOPR_SCROLL_TEXT_POOL_SIZE> _scrollTextPool;	///< Pool for transient scroll texts
+
+	/// @brief Advance animation clock by the time since last frame
+	void _effectsAdvanceAnimationTime();
+
+	/// @brief Run all layered effects and commit the composed frame
+	/// @return True if any effect is running
+	bool _effectsLoop();
+
+	/// @brief Begin frame
+	/// @details Display and DEFCON LED output is deferred until _effectsEndFrame().
+	/// @return False if a frame is already active
+	bool _effectsBeginFrame();
+
+	/// @brief End frame and write deferred display and DEFCON LED output
+	void _effectsEndFrame();
+
+	/// @brief Remove effect from all layers
+	/// @param effect Effect to remove
+	void _effectsReleaseLayers(JBWoprEffectBase* effect);
+
+	/// @brief Start effect and make it the current effect
+	/// @details Used by effectsStartEffect(), so overrides can tell if the effect was started.
+	/// @param effect Effect to start
+	/// @return False if blocked by a higher priority effect
+	bool _effectsStartEffect(JBWoprEffectBase* effect);
 
 	// ====================================================================
 	// Display
@@ -467,6 +649,10 @@ protected:
 	std::array<Adafruit_AlphaNum4, 3> _display;		///< Display
 	bool _displayState = true;						///< Display state
 	uint32_t _displayBrightness = 100;				///< Display brightness
+	bool _displayDirty = false;						///< True if display has deferred changes
+
+	/// @brief Write display buffers to the displays
+	void _displayWrite();
 
 	// ====================================================================
 	// Defcon LEDs
@@ -477,6 +663,7 @@ protected:
 	uint32_t _defconColors[5];										///< DEFCON colors
 	uint32_t _defconBrightness = 100;								///< DEFCON brightness
 	uint32_t _defconLedsColor = 0;									///< DEFCON LED's color
+	bool _defconLedsDirty = false;									///< True if DEFCON LEDs have deferred changes
 
 	// Note - due to how Adafruit_Neopixel handles brigthness, we buffer the LED colors into the
 	// _defconPixels variable together with the current brightness value.
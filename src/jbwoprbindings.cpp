@@ -0,0 +1,202 @@
+/// @file jbwoprbindings.cpp
+/// @author Jonny Bergdahl
+/// @brief Source file for the JBWoprBindings class.
+/// @details Contains implementation of MQTT data bindings.
+/// This code is distributed under the MIT License. See LICENSE for details.
+/// @date Created: 2026-10-18
+/// @copyright Copyright© 2026, Jonny Bergdahl
+///
+#include "jbwoprbindings.h"
+#include "jbwopr.h"
+#include <cmath>
+
+JBLogger JBWoprBindings::_log {"bindings" };
+
+bool JBWoprBindings::setFromJsonDocument(const JsonDocument& jsonDoc) {
+	JsonArrayConst items = jsonDoc[JSON_KEY_BINDINGS].as<JsonArrayConst>();
+	if (items.isNull()) {
+		_log.error("Bindings document has no bindings array");
+		return false;
+	}
+	if (items.size() > JBWOPR_BINDINGS_MAX) {
+		_log.error("Too many bindings, %u", items.size());
+		return false;
+	}
+
+	std::vector<Binding> bindings;
+	for (JsonVariantConst item : items) {
+		const char* topic = item[JSON_KEY_TOPIC].as<const char*>();
+		if (topic == nullptr || *topic == 0 || strpbrk(topic, "+#") != nullptr) {
+			_log.warning("Binding has no topic, or a wildcard topic");
+			continue;
+		}
+		Binding binding { topic, JBStringHelper::hash(topic), {}, "", "", -1, true, {}, 0 };
+
+		// "a.b.0.c", split once so a message only walks the document
+		const char* path = item[JSON_KEY_PATH].as<const char*>();
+		while (path != nullptr && *path != 0) {
+			const char* end = strchr(path, '.');
+			size_t length = end == nullptr ? strlen(path) : end - path;
+			binding.path.emplace_back(path, length);
+			path = end == nullptr ? nullptr : end + 1;
+		}
+
+		std::string format = item[JSON_KEY_FORMAT].isNull() ? FORMAT_PLACEHOLDER : item[JSON_KEY_FORMAT].as<std::string>();
+		size_t placeholder = format.find(FORMAT_PLACEHOLDER);
+		if (placeholder == std::string::npos) {
+			binding.prefix = format;
+		} else {
+			binding.prefix = format.substr(0, placeholder);
+			binding.suffix = format.substr(placeholder + 2);
+		}
+		if (!item[JSON_KEY_DECIMALS].isNull()) {
+			binding.decimals = item[JSON_KEY_DECIMALS].as<int8_t>();
+		}
+		if (!item[JSON_KEY_DISPLAY].isNull()) {
+			binding.display = item[JSON_KEY_DISPLAY].as<bool>();
+		}
+
+		for (JsonVariantConst entry : item[JSON_KEY_THRESHOLDS].as<JsonArrayConst>()) {
+			Threshold threshold { 0, 0, 0, JBWOPR_BINDING_LEVEL_NONE, false, false, false };
+			if (!entry[JSON_KEY_ABOVE].isNull()) {
+				threshold.above = entry[JSON_KEY_ABOVE].as<float>();
+				threshold.hasAbove = true;
+			}
+			const char* equals = entry[JSON_KEY_EQUALS].as<const char*>();
+			if (equals != nullptr) {
+				threshold.equalsHash = JBStringHelper::hash(equals, strlen(equals));
+				threshold.hasEquals = true;
+			}
+			if (!entry[JSON_KEY_DEFCON].isNull()) {
+				uint8_t level = entry[JSON_KEY_DEFCON].as<uint8_t>();
+				if (level >= 1 && level <= 5) {
+					threshold.level = level - 1;
+				} else {
+					_log.warning("Binding %s: invalid DEFCON level %u, level is not changed", topic, level);
+				}
+			}
+			JsonVariantConst color = entry[JSON_KEY_COLOR];
+			if (!color.isNull()) {
+				const char* text = color.as<const char*>();
+				threshold.color = text != nullptr ? JBStringHelper::stringToRgb(text) : color.as<uint32_t>();
+				threshold.hasColor = true;
+			}
+			binding.thresholds.push_back(threshold);
+		}
+		bindings.push_back(std::move(binding));
+	}
+
+	_bindings = std::move(bindings);
+	_log.debug("Bindings compiled, %u bindings", _bindings.size());
+	return true;
+}
+
+int8_t JBWoprBindings::find(const char* topic) const {
+	uint32_t topicHash = JBStringHelper::hash(topic, strlen(topic));
+	for (size_t i = 0; i < _bindings.size(); i++) {
+		if (_bindings[i].topicHash == topicHash && _bindings[i].topic == topic) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+bool JBWoprBindings::render(uint8_t index, const char* payload, size_t length, Render& render) {
+	if (index >= _bindings.size()) {
+		return false;
+	}
+	Binding& binding = _bindings[index];
+	std::string value;
+	float number = NAN;
+	if (!_getValue(binding, payload, length, value, number)) {
+		return false;
+	}
+
+	render.index = index;
+	render.level = JBWOPR_BINDING_LEVEL_NONE;
+	render.color = 0;
+	render.hasColor = false;
+	render.text.clear();
+	if (binding.display) {
+		render.text = binding.prefix + value + binding.suffix;
+		if (render.text.size() > JBWOPR_BINDING_TEXT_SIZE) {
+			render.text.resize(JBWOPR_BINDING_TEXT_SIZE);
+		}
+	}
+	uint32_t valueHash = JBStringHelper::hash(value.data(), value.size());
+	for (const auto& threshold : binding.thresholds) {
+		if ((threshold.hasAbove && !(number > threshold.above)) ||
+			(threshold.hasEquals && threshold.equalsHash != valueHash)) {
+			continue;
+		}
+		render.level = threshold.level;
+		render.color = threshold.color;
+		render.hasColor = threshold.hasColor;
+		break;
+	}
+
+	// Feeds often repeat the same value, so only changes are rendered
+	uint32_t hash = JBStringHelper::hash(render.text.data(), render.text.size());
+	hash = JBStringHelper::hash(reinterpret_cast<const char*>(&render.level), sizeof(render.level), hash);
+	hash = JBStringHelper::hash(reinterpret_cast<const char*>(&render.color), sizeof(render.color), hash);
+	if (hash == binding.lastHash) {
+		return false;
+	}
+	binding.lastHash = hash;
+	return true;
+}
+
+const std::vector<JBWoprBindings::Binding>& JBWoprBindings::getBindings() const {
+	return _bindings;
+}
+
+bool JBWoprBindings::_getValue(const Binding& binding, const char* payload, size_t length, std::string& text, float& number) {
+	if (binding.path.empty()) {
+		text.assign(payload, std::min<size_t>(length, JBWOPR_BINDING_TEXT_SIZE));
+	} else {
+		JsonDocument jsonDoc;
+		DeserializationError error = deserializeJson(jsonDoc, payload, length);
+		if (error) {
+			_log.warning("Invalid JSON on %s: %s", binding.topic.c_str(), error.c_str());
+			return false;
+		}
+		JsonVariantConst value = jsonDoc.as<JsonVariantConst>();
+		for (const auto& segment : binding.path) {
+			if (value.is<JsonArrayConst>() && isdigit(segment[0])) {
+				value = value[(size_t)atoi(segment.c_str())];
+			} else {
+				value = value[segment];
+			}
+		}
+		if (value.isNull()) {
+			_log.warning("No value at path on %s", binding.topic.c_str());
+			return false;
+		}
+		if (value.is<float>() && binding.decimals >= 0) {
+			char buffer[24];
+			snprintf(buffer, sizeof(buffer), "%.*f", binding.decimals, value.as<float>());
+			text = buffer;
+		} else if (value.is<const char*>()) {
+			text = value.as<const char*>();
+		} else {
+			text.clear();
+			serializeJson(value, text);
+		}
+		if (value.is<float>()) {
+			number = value.as<float>();
+			return true;
+		}
+	}
+
+	char* end = nullptr;
+	float parsed = strtof(text.c_str(), &end);
+	if (end != text.c_str() && *end == 0) {
+		number = parsed;
+		if (binding.decimals >= 0) {
+			char buffer[24];
+			snprintf(buffer, sizeof(buffer), "%.*f", binding.decimals, parsed);
+			text = buffer;
+		}
+	}
+	return true;
+}
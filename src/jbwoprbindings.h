@@ -0,0 +1,128 @@
+/// @file jbwoprbindings.h
+/// @author Jonny Bergdahl
+/// @brief Header file for the JBWoprBindings class.
+/// @details Contains declarations for MQTT data bindings.
+/// This code is distributed under the MIT License. See LICENSE for details.
+/// @date Created: 2026-10-18
+/// @copyright Copyright© 2026, Jonny Bergdahl
+///
+#ifndef ARDUINO_WOPR_JBWOPRBINDINGS_H
+#define ARDUINO_WOPR_JBWOPRBINDINGS_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <JBLogger.h>
+#include <string>
+#include <vector>
+
+#define JBWOPR_BINDINGS_MAX 8				///< Max number of bindings
+#define JBWOPR_BINDING_TEXT_SIZE 64			///< Max length of rendered text
+#define JBWOPR_BINDING_LEVEL_NONE 0xFF		///< DEFCON level is not changed
+
+/// @brief Data bindings for external MQTT topics
+/// @details A binding subscribes to a topic, extracts a value from the payload,
+/// formats it as display text and maps it to a DEFCON level and color. The
+/// payload is parsed once per message, and a result is only returned when it
+/// differs from the previous result of the same binding.
+///
+/// @code{.json}
+/// {
+///   "bindings": [
+///     { "topic": "home/power", "path": "meter.power", "format": "PWR {} KW", "decimals": 1,
+///       "thresholds": [ { "above": 5, "defcon": 1, "color": "255,0,0" },
+///                       { "above": 2, "defcon": 3, "color": "255,255,0" },
+///                       { "defcon": 5, "color": "0,255,0" } ] },
+///     { "topic": "ci/main/status", "format": "CI {}", "display": true,
+///       "thresholds": [ { "equals": "failed", "defcon": 1 } ] }
+///   ]
+/// }
+/// @endcode
+///
+/// The first threshold that matches is used, a threshold without `above` and
+/// `equals` always matches. Without `path` the raw payload is used.
+class JBWoprBindings {
+public:
+	/// @brief Threshold
+	struct Threshold {
+		float above;						///< Matches values above this, if hasAbove is set
+		uint32_t equalsHash;				///< Matches values with this hash, if hasEquals is set
+		uint32_t color;						///< DEFCON LEDs color, if hasColor is set
+		uint8_t level;						///< JBDefconLevel, JBWOPR_BINDING_LEVEL_NONE to keep level
+		bool hasAbove;						///< True if above is used
+		bool hasEquals;						///< True if equalsHash is used
+		bool hasColor;						///< True if color is used
+	};
+
+	/// @brief Binding
+	struct Binding {
+		std::string topic;					///< Subscribed topic
+		uint32_t topicHash;					///< Hash of topic
+		std::vector<std::string> path;		///< JSON path segments, empty for raw payload
+		std::string prefix;					///< Text before the value
+		std::string suffix;					///< Text after the value
+		int8_t decimals;					///< Decimals for numbers, -1 to keep as is
+		bool display;						///< Show text on display
+		std::vector<Threshold> thresholds;	///< Thresholds, in match order
+		uint32_t lastHash;					///< Hash of last result, 0 if none
+	};
+
+	/// @brief Rendered binding
+	struct Render {
+		uint8_t index;						///< Binding index
+		std::string text;					///< Display text, empty if not shown
+		uint8_t level;						///< JBDefconLevel, JBWOPR_BINDING_LEVEL_NONE to keep level
+		uint32_t color;						///< DEFCON LEDs color, if hasColor is set
+		bool hasColor;						///< True if color is set
+	};
+
+	/// @brief Compile bindings from JSON document
+	/// @details The previous bindings are kept if the document is invalid.
+	/// @param jsonDoc JSON document
+	/// @return True if successful
+	bool setFromJsonDocument(const JsonDocument& jsonDoc);
+
+	/// @brief Find binding for topic
+	/// @param topic Received topic
+	/// @return Binding index, -1 if not found
+	int8_t find(const char* topic) const;
+
+	/// @brief Render binding from payload
+	/// @param index Binding index
+	/// @param payload Payload, not null terminated
+	/// @param length Payload length
+	/// @param render Result, set if the result changed
+	/// @return True if the result differs from the previous result
+	bool render(uint8_t index, const char* payload, size_t length, Render& render);
+
+	/// @brief Get bindings
+	/// @return Bindings
+	const std::vector<Binding>& getBindings() const;
+
+protected:
+	static JBLogger _log;					///< Logger instance
+	std::vector<Binding> _bindings;			///< Bindings
+
+	const char* JSON_KEY_BINDINGS = "bindings";					///< Bindings key name
+	const char* JSON_KEY_TOPIC = "topic";						///< Topic key name
+	const char* JSON_KEY_PATH = "path";							///< JSON path key name
+	const char* JSON_KEY_FORMAT = "format";						///< Format key name
+	const char* JSON_KEY_DECIMALS = "decimals";					///< Decimals key name
+	const char* JSON_KEY_DISPLAY = "display";					///< Show on display key name
+	const char* JSON_KEY_THRESHOLDS = "thresholds";				///< Thresholds key name
+	const char* JSON_KEY_ABOVE = "above";						///< Threshold above key name
+	const char* JSON_KEY_EQUALS = "equals";						///< Threshold equals key name
+	const char* JSON_KEY_DEFCON = "defcon";						///< Threshold DEFCON level key name
+	const char* JSON_KEY_COLOR = "color";						///< Threshold color key name
+	const char* FORMAT_PLACEHOLDER = "{}";						///< Value placeholder in format
+
+	/// @brief Get value text
+	/// @param binding Binding
+	/// @param payload Payload, not null terminated
+	/// @param length Payload length
+	/// @param text Value text
+	/// @param number Value as number, NAN if not a number
+	/// @return True if the value was found
+	bool _getValue(const Binding& binding, const char* payload, size_t length, std::string& text, float& number);
+};
+
+#endif //ARDUINO_WOPR_JBWOPRBINDINGS_H
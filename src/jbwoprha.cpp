@@ -42,7 +42,27 @@ bool JBWoprHADevice::begin(JBWoprBoardVariant variant, JBWoprBoardPins pins) {
 void JBWoprHADevice::loop() {
 	JBWoprMqttDevice::loop();
 
-	// Nothing to do here
+	if (!_haConfig.useHomeAssistant) {
+		return;
+	}
+	// Script effects can be added at run time, the network task gets a copy of the names
+	const auto& effects = effectsGetRegisteredEffects();
+	if (effects.size() != _homeAssistantEffectCount) {
+		std::vector<std::string> names;
+		names.reserve(effects.size());
+		for (auto effect : effects) {
+			names.push_back(effect->getName());
+		}
+		if (_homeAssistantEffectQueue.push(names)) {
+			_homeAssistantEffectCount = effects.size();
+		}
+	}
+	// Set by _onMqttConnect(), the state is owned by loop()
+	if (_homeAssistantPublishPending.exchange(false)) {
+		_homeAssistantPublishDiagnostics();
+		_homeAssistantPublishConfig();
+		_homeAssistantPublishState();
+	}
 }
 
 // ====================================================================
@@ -100,13 +120,12 @@ void JBWoprHADevice::_setupWiFiManager() {
 	wifiManager->addParameter(_useHomeAssistantParam);
 	wifiManager->addParameter(_break3Param);
 	wifiManager->addParameter(_homeAssistantDiscoveryPrefixParam);
-
-	wifiManager->setSaveParamsCallback(std::bind(&JBWoprHADevice::_saveParamsCallback, this));
 }
-void JBWoprHADevice::_saveParamsCallback() {
-	JBWoprMqttDevice::_saveParamsCallback();
-	_haConfig.useHomeAssistant = strncmp(_useHomeAssistantParam->getValue(), "T", 1) == 0;
-	_haConfig.homeAssistantDiscoveryPrefix = std::string(_homeAssistantDiscoveryPrefixParam->getValue());
+
+void JBWoprHADevice::_setJsonDocumentFromParams(JsonDocument &jsonDoc) {
+	JBWoprMqttDevice::_setJsonDocumentFromParams(jsonDoc);
+	jsonDoc[JSON_KEY_HA_USE_HOME_ASSISTANT] = strncmp(_useHomeAssistantParam->getValue(), "T", 1) == 0;
+	jsonDoc[JSON_KEY_HA_DISCOVERY_PREFIX] = _homeAssistantDiscoveryPrefixParam->getValue();
 }
 
 // ====================================================================
@@ -118,19 +137,35 @@ bool JBWoprHADevice::_onMqttConnect() {
 	}
 
 	if (_haConfig.useHomeAssistant) {
-		if (!_homeAssistantSendDiscovery()) {
+		// Discovery is retained, and only the effect list changes while running
+		if (!_mqttSessionResumed && !_homeAssistantSendDiscovery()) {
 			_log->error("Failed to send Home Assistant discovery");
 			return false;
 		}
-		_homeAssistantPublishDiagnostics();
-		_homeAssistantPublishConfig();
-		_homeAssistantPublishState();
-		mqttPublishMessage(_getAvailabilityTopic().c_str(), "online");
+		if (_homeAssistantEffectsChanged) {
+			_homeAssistantSendEffectDiscovery();
+		}
+		// Published by loop(), only changed values are sent if the session was resumed
+		_homeAssistantPublishPending = true;
 	}
 
 	return true;
 }
 
+void JBWoprHADevice::_networkLoop() {
+	std::vector<std::string> names;
+	while (_homeAssistantEffectQueue.pop(names)) {
+		_homeAssistantEffectNames = std::move(names);
+		_homeAssistantEffectsChanged = true;
+	}
+
+	JBWoprMqttDevice::_networkLoop();
+
+	if (_homeAssistantEffectsChanged && _haConfig.useHomeAssistant && mqttIsConnected()) {
+		_homeAssistantSendEffectDiscovery();
+	}
+}
+
 // ====================================================================
 // Home Assistant
 //
@@ -182,6 +217,19 @@ bool JBWoprHADevice::_homeAssistantSendDiscovery() {
 		mqttPublishMessage(topic, jsonDoc, true);
 	}
 
+	{
+		JsonDocument jsonDoc;
+		topic = _getDiscoveryTopic(HA_COMPONENT_SENSOR, HA_DIAG_PREFIX, HA_DIAG_ENTITY_MQTT_SUPPRESSED);
+		_addDiscoveryPayload(jsonDoc,
+							 HA_COMPONENT_SENSOR,
+							 "MQTT suppressed messages",
+							 HA_DIAG_PREFIX,
+							 HA_DIAG_ENTITY_MQTT_SUPPRESSED,
+							 JSON_KEY_HA_DIAG_ENTITY_MQTT_SUPPRESSED,
+							 MDI_ICON_MESSAGE_OFF_OUTLINE);
+		mqttPublishMessage(topic, jsonDoc, true);
+	}
+
 	// Config
 	{
 		JsonDocument jsonDoc;
@@ -201,7 +249,7 @@ bool JBWoprHADevice::_homeAssistantSendDiscovery() {
 		timeOptions.add("%I %M %S %p");
 		timeOptions.add("%I.%M.%S %p");
 		timeOptions.add("%I:%M:%S %p");
-		jsonDoc["command_topic"] = "wopr/" + _getDeviceName() + "/config/time_format/set";
+		jsonDoc["command_topic"] = _getTopic(ENTITY_NAME_CONFIG, SUBENTITY_NAME_TIME_FORMAT, COMMAND_SET);
 		mqttPublishMessage(topic, jsonDoc, true);
 	}
 
@@ -221,7 +269,7 @@ bool JBWoprHADevice::_homeAssistantSendDiscovery() {
 		dateOptions.add("%d/%m/%Y");
 		dateOptions.add("%d-%m-%Y");
 		dateOptions.add("%d.%m.%Y");
-		jsonDoc["command_topic"] = "wopr/" + _getDeviceName() + "/config/date_format/set";
+		jsonDoc["command_topic"] = _getTopic(ENTITY_NAME_CONFIG, SUBENTITY_NAME_DATE_FORMAT, COMMAND_SET);
 		mqttPublishMessage(topic, jsonDoc, true);
 	}
 
@@ -239,7 +287,7 @@ bool JBWoprHADevice::_homeAssistantSendDiscovery() {
 		jsonDoc["min"] = 0;
 		jsonDoc["max"] = 100;
 		jsonDoc["mode"] = "box";
-		jsonDoc["command_topic"] = "wopr/" + _getDeviceName() + "/config/display_brightness/set";
+		jsonDoc["command_topic"] = _getTopic(ENTITY_NAME_CONFIG, SUBENTITY_NAME_DISPLAY_BRIGHTNESS, COMMAND_SET);
 		mqttPublishMessage(topic, jsonDoc, true);
 	}
 
@@ -257,7 +305,7 @@ bool JBWoprHADevice::_homeAssistantSendDiscovery() {
 		jsonDoc["min"] = 0;
 		jsonDoc["max"] = 100;
 		jsonDoc["mode"] = "box";
-		jsonDoc["command_topic"] = "wopr/" + _getDeviceName() + "/config/defcon_brightness/set";
+		jsonDoc["command_topic"] = _getTopic(ENTITY_NAME_CONFIG, SUBENTITY_NAME_DEFCON_BRIGHTNESS, COMMAND_SET);
 		mqttPublishMessage(topic, jsonDoc, true);
 	}
 
@@ -273,7 +321,25 @@ bool JBWoprHADevice::_homeAssistantSendDiscovery() {
 							 MDI_ICON_TIMER_OUTLINE,
 							 "s");
 		jsonDoc["mode"] = "box";
-		jsonDoc["command_topic"] = "wopr/" + _getDeviceName() + "/config/effects_timeout/set";
+		jsonDoc["command_topic"] = _getTopic(ENTITY_NAME_CONFIG, SUBENTITY_NAME_EFFECTS_TIMEOUT, COMMAND_SET);
+		mqttPublishMessage(topic, jsonDoc, true);
+	}
+
+	{
+		JsonDocument jsonDoc;
+		topic = _getDiscoveryTopic(HA_COMPONENT_NUMBER, HA_CONFIG_PREFIX, HA_CONF_ENTITY_EFFECTS_SPEED);
+		_addDiscoveryPayload(jsonDoc,
+							 HA_COMPONENT_NUMBER,
+							 "Effects speed",
+							 HA_CONFIG_PREFIX,
+							 HA_CONF_ENTITY_EFFECTS_SPEED,
+							 JSON_KEY_EFFECTS_SPEED,
+							 MDI_ICON_TIMER_OUTLINE,
+							 "%");
+		jsonDoc["min"] = JBWOPR_EFFECT_SPEED_MIN;
+		jsonDoc["max"] = JBWOPR_EFFECT_SPEED_MAX;
+		jsonDoc["mode"] = "box";
+		jsonDoc["command_topic"] = _getTopic(ENTITY_NAME_CONFIG, SUBENTITY_NAME_EFFECTS_SPEED, COMMAND_SET);
 		mqttPublishMessage(topic, jsonDoc, true);
 	}
 
@@ -289,7 +355,7 @@ bool JBWoprHADevice::_homeAssistantSendDiscovery() {
 							 MDI_ICON_WEB);
 		jsonDoc["payload_on"] = "True";
 		jsonDoc["payload_off"] = "False";
-		jsonDoc["command_topic"] = "wopr/" + _getDeviceName() + "/config/use_web_portal/set";
+		jsonDoc["command_topic"] = _getTopic(ENTITY_NAME_CONFIG, SUBENTITY_NAME_WIFI_USE_WEB_PORTAL, COMMAND_SET);
 		mqttPublishMessage(topic, jsonDoc, true);
 	}
 
@@ -307,7 +373,7 @@ bool JBWoprHADevice::_homeAssistantSendDiscovery() {
 		// Remove default state/value template added by helper; button uses command only
 		jsonDoc.remove(HA_NAMES_STATE_TOPIC);
 		jsonDoc.remove(HA_NAMES_VALUE_TEMPLATE);
-		jsonDoc["command_topic"] = "wopr/" + _getDeviceName() + "/device/state/set";
+		jsonDoc["command_topic"] = _getTopic(ENTITY_NAME_DEVICE, SUBENTITY_NAME_STATE, COMMAND_SET);
 		jsonDoc["payload_press"] = "restart";
 		mqttPublishMessage(topic, jsonDoc, true);
 	}
@@ -327,33 +393,12 @@ bool JBWoprHADevice::_homeAssistantSendDiscovery() {
 		// Override topics for this entity
 		jsonDoc.remove(HA_NAMES_STATE_TOPIC);
 		jsonDoc.remove(HA_NAMES_VALUE_TEMPLATE);
-		jsonDoc[HA_NAMES_STATE_TOPIC] = "wopr/" + _getDeviceName() + "/effect/state";
-		jsonDoc["command_topic"] = "wopr/" + _getDeviceName() + "/effect/state/set";
+		_setDiscoveryState(jsonDoc, HA_NAMES_STATE_TOPIC, HA_NAMES_VALUE_TEMPLATE, MQTT_TOPIC_EFFECT_STATE, JSON_KEY_STATE_EFFECT);
+		jsonDoc["command_topic"] = _getTopic(ENTITY_NAME_EFFECT, SUBENTITY_NAME_STATE, COMMAND_SET);
 		mqttPublishMessage(topic, jsonDoc, true);
 	}
 
-	{
-		JsonDocument jsonDoc;
-		topic = _getDiscoveryTopic(HA_COMPONENT_SELECT, "", "effect_name");
-		_addDiscoveryPayload(jsonDoc,
-						   HA_COMPONENT_SELECT,
-						   "Effect",
-						   "",
-						   "effect_name",
-						   "name",
-						   MDI_ICON_SCRIPT_OUTLINE);
-		jsonDoc.remove(HA_NAMES_STATE_TOPIC);
-		jsonDoc.remove(HA_NAMES_VALUE_TEMPLATE);
-		jsonDoc[HA_NAMES_STATE_TOPIC] = "wopr/" + _getDeviceName() + "/effect/name";
-		jsonDoc["command_topic"] = "wopr/" + _getDeviceName() + "/effect/name/set";
-		auto effects = effectsGetRegisteredEffects();
-		auto options = jsonDoc["options"].to<JsonArray>();
-		options.add("");
-		for (auto& effect : effects) {
-			options.add(effect->getName());
-		}
-		mqttPublishMessage(topic, jsonDoc, true);
-	}
+	_homeAssistantSendEffectDiscovery();
 
 	// Display
 	{
@@ -368,10 +413,10 @@ bool JBWoprHADevice::_homeAssistantSendDiscovery() {
 						   MDI_ICON_ALPHABETICAL_VARIANT);
 		jsonDoc.remove(HA_NAMES_STATE_TOPIC);
 		jsonDoc.remove(HA_NAMES_VALUE_TEMPLATE);
-		jsonDoc[HA_NAMES_STATE_TOPIC] = "wopr/" + _getDeviceName() + "/display/state";
-		jsonDoc["command_topic"] = "wopr/" + _getDeviceName() + "/display/state/set";
-		jsonDoc["brightness_state_topic"] = "wopr/" + _getDeviceName() + "/display/brightness";
-		jsonDoc["brightness_command_topic"] = "wopr/" + _getDeviceName() + "/display/brightness/set";
+		_setDiscoveryState(jsonDoc, HA_NAMES_STATE_TOPIC, "state_value_template", MQTT_TOPIC_DISPLAY_STATE, JSON_KEY_STATE_DISPLAY);
+		jsonDoc["command_topic"] = _getTopic(ENTITY_NAME_DISPLAY, SUBENTITY_NAME_STATE, COMMAND_SET);
+		_setDiscoveryState(jsonDoc, "brightness_state_topic", "brightness_value_template", MQTT_TOPIC_DISPLAY_BRIGHTNESS, JSON_KEY_STATE_DISPLAY_BRIGHTNESS);
+		jsonDoc["brightness_command_topic"] = _getTopic(ENTITY_NAME_DISPLAY, SUBENTITY_NAME_BRIGHTNESS, COMMAND_SET);
 		jsonDoc["brightness_scale"] = 100;
 		mqttPublishMessage(topic, jsonDoc, true);
 	}
@@ -388,12 +433,12 @@ bool JBWoprHADevice::_homeAssistantSendDiscovery() {
 						   MDI_ICON_NUMERIC_5_BOX_OUTLINE);
 		jsonDoc.remove(HA_NAMES_STATE_TOPIC);
 		jsonDoc.remove(HA_NAMES_VALUE_TEMPLATE);
-		jsonDoc[HA_NAMES_STATE_TOPIC] = "wopr/" + _getDeviceName() + "/defcon/state";
-		jsonDoc["command_topic"] = "wopr/" + _getDeviceName() + "/defcon/state/set";
-		jsonDoc["brightness_state_topic"] = "wopr/" + _getDeviceName() + "/defcon/brightness";
-		jsonDoc["brightness_command_topic"] = "wopr/" + _getDeviceName() + "/defcon/brightness/set";
-		jsonDoc["rgb_state_topic"] = "wopr/" + _getDeviceName() + "/defcon/color";
-		jsonDoc["rgb_command_topic"] = "wopr/" + _getDeviceName() + "/defcon/color/set";
+		_setDiscoveryState(jsonDoc, HA_NAMES_STATE_TOPIC, "state_value_template", MQTT_TOPIC_DEFCON_STATE, JSON_KEY_STATE_DEFCON);
+		jsonDoc["command_topic"] = _getTopic(ENTITY_NAME_DEFCON, SUBENTITY_NAME_STATE, COMMAND_SET);
+		_setDiscoveryState(jsonDoc, "brightness_state_topic", "brightness_value_template", MQTT_TOPIC_DEFCON_BRIGHTNESS, JSON_KEY_STATE_DEFCON_BRIGHTNESS);
+		jsonDoc["brightness_command_topic"] = _getTopic(ENTITY_NAME_DEFCON, SUBENTITY_NAME_BRIGHTNESS, COMMAND_SET);
+		_setDiscoveryState(jsonDoc, "rgb_state_topic", "rgb_value_template", MQTT_TOPIC_DEFCON_COLOR, JSON_KEY_STATE_DEFCON_COLOR);
+		jsonDoc["rgb_command_topic"] = _getTopic(ENTITY_NAME_DEFCON, SUBENTITY_NAME_COLOR, COMMAND_SET);
 		jsonDoc["brightness_scale"] = 100;
 		mqttPublishMessage(topic, jsonDoc, true);
 	}
@@ -410,8 +455,8 @@ bool JBWoprHADevice::_homeAssistantSendDiscovery() {
 						   MDI_ICON_NUMERIC_5_BOX_OUTLINE);
 		jsonDoc.remove(HA_NAMES_STATE_TOPIC);
 		jsonDoc.remove(HA_NAMES_VALUE_TEMPLATE);
-		jsonDoc[HA_NAMES_STATE_TOPIC] = "wopr/" + _getDeviceName() + "/defcon/level";
-		jsonDoc["command_topic"] = "wopr/" + _getDeviceName() + "/defcon/level/set";
+		_setDiscoveryState(jsonDoc, HA_NAMES_STATE_TOPIC, HA_NAMES_VALUE_TEMPLATE, MQTT_TOPIC_DEFCON_LEVEL, JSON_KEY_STATE_DEFCON_LEVEL);
+		jsonDoc["command_topic"] = _getTopic(ENTITY_NAME_DEFCON, SUBENTITY_NAME_LEVEL, COMMAND_SET);
 		auto options = jsonDoc["options"].to<JsonArray>();
 		for (auto& level : _defconNames) {
 			options.add(level);
@@ -431,8 +476,8 @@ bool JBWoprHADevice::_homeAssistantSendDiscovery() {
 						   MID_ICON_FORMAT_TEXT);
 		jsonDoc.remove(HA_NAMES_STATE_TOPIC);
 		jsonDoc.remove(HA_NAMES_VALUE_TEMPLATE);
-		jsonDoc[HA_NAMES_STATE_TOPIC] = "wopr/" + _getDeviceName() + "/display/text";
-		jsonDoc["command_topic"] = "wopr/" + _getDeviceName() + "/display/text/set";
+		_setDiscoveryState(jsonDoc, HA_NAMES_STATE_TOPIC, HA_NAMES_VALUE_TEMPLATE, MQTT_TOPIC_DISPLAY_TEXT, JSON_KEY_STATE_DISPLAY_TEXT);
+		jsonDoc["command_topic"] = _getTopic(ENTITY_NAME_DISPLAY, SUBENTITY_NAME_TEXT, COMMAND_SET);
 		mqttPublishMessage(topic, jsonDoc, true);
 	}
 
@@ -448,30 +493,55 @@ bool JBWoprHADevice::_homeAssistantSendDiscovery() {
 						   MDI_ICON_TEXT_SHADOW);
 		jsonDoc.remove(HA_NAMES_STATE_TOPIC);
 		jsonDoc.remove(HA_NAMES_VALUE_TEMPLATE);
-		jsonDoc[HA_NAMES_STATE_TOPIC] = "wopr/" + _getDeviceName() + "/display/scrolltext";
-		jsonDoc["command_topic"] = "wopr/" + _getDeviceName() + "/display/scrolltext/set";
+		_setDiscoveryState(jsonDoc, HA_NAMES_STATE_TOPIC, HA_NAMES_VALUE_TEMPLATE, MQTT_TOPIC_DISPLAY_SCROLLTEXT, JSON_KEY_STATE_DISPLAY_SCROLLTEXT);
+		jsonDoc["command_topic"] = _getTopic(ENTITY_NAME_DISPLAY, SUBENTITY_NAME_SCROLLTEXT, COMMAND_SET);
 		mqttPublishMessage(topic, jsonDoc, true);
 	}
 
 	return true;
 }
 
+void JBWoprHADevice::_homeAssistantSendEffectDiscovery() {
+	JsonDocument jsonDoc;
+	std::string topic = _getDiscoveryTopic(HA_COMPONENT_SELECT, "", "effect_name");
+	_addDiscoveryPayload(jsonDoc,
+					   HA_COMPONENT_SELECT,
+					   "Effect",
+					   "",
+					   "effect_name",
+					   "name",
+					   MDI_ICON_SCRIPT_OUTLINE);
+	jsonDoc.remove(HA_NAMES_STATE_TOPIC);
+	jsonDoc.remove(HA_NAMES_VALUE_TEMPLATE);
+	_setDiscoveryState(jsonDoc, HA_NAMES_STATE_TOPIC, HA_NAMES_VALUE_TEMPLATE, MQTT_TOPIC_EFFECT_NAME, JSON_KEY_STATE_EFFECT_NAME);
+	jsonDoc["command_topic"] = _getTopic(ENTITY_NAME_EFFECT, SUBENTITY_NAME_NAME, COMMAND_SET);
+	auto options = jsonDoc["options"].to<JsonArray>();
+	options.add("");
+	for (const auto& name : _homeAssistantEffectNames) {
+		options.add(name);
+	}
+	mqttPublishMessage(topic, jsonDoc, true);
+	_homeAssistantEffectsChanged = false;
+}
+
 bool JBWoprHADevice::_homeAssistantPublishDiagnostics() {
 	_log->trace("Publishing Home Assistant diagnostics message");
 
-	std::string diagnosticsTopic = _getTopic(ENTITY_NAME_DIAGNOSTIC, SUBENTITY_NAME_STATE);
+	std::string diagnosticsTopic = _getTopic(MQTT_TOPIC_DIAGNOSTIC_STATE);
 
 	JsonDocument jsonDoc;
 	jsonDoc[JSON_KEY_HA_DIAG_ENTITY_IP] = WiFi.localIP().toString();
 	jsonDoc[JSON_KEY_HA_DIAG_ENTITY_RSSI] = WiFi.RSSI();
 	jsonDoc[JSON_KEY_HA_DIAG_ENTITY_RAM] = ESP.getFreeHeap();
 	jsonDoc[JSON_KEY_HA_DIAG_ENTITY_VERSION] = LIBRARY_VERSION;
+	jsonDoc[JSON_KEY_HA_DIAG_ENTITY_MQTT_PUBLISHED] = mqttGetPublishedCount();
+	jsonDoc[JSON_KEY_HA_DIAG_ENTITY_MQTT_SUPPRESSED] = mqttGetSuppressedCount();
+	jsonDoc[JSON_KEY_HA_DIAG_ENTITY_MQTT_QUEUED] = mqttGetQueueLength();
+	jsonDoc[JSON_KEY_HA_DIAG_ENTITY_MQTT_DROPPED] = mqttGetDroppedCount();
+	jsonDoc[JSON_KEY_HA_DIAG_ENTITY_MQTT_COALESCED] = mqttGetCoalescedCount();
+	jsonDoc[JSON_KEY_HA_DIAG_ENTITY_MQTT_LATENCY] = mqttGetMaxLatency();
 
-	std::ostringstream oss;
-	serializeJson(jsonDoc, oss);
-	std::string payload = oss.str();
-
-	mqttPublishMessage(diagnosticsTopic, payload);
+	mqttPublishMessage(diagnosticsTopic, jsonDoc);
 
 	return true;
 }
@@ -481,7 +551,7 @@ bool JBWoprHADevice::_homeAssistantPublishConfig() {
 
 	_log->trace("Publishing Home Assistant configuration");
 
-	auto topic = _getTopic(HA_CONFIG_PREFIX, SUBENTITY_NAME_STATE);
+	auto topic = _getTopic(MQTT_TOPIC_CONFIG_STATE);
 	_setJsonDocumentFromConfig(jsonDoc);
 	return mqttPublishMessage(topic, jsonDoc);
 }
@@ -489,19 +559,24 @@ bool JBWoprHADevice::_homeAssistantPublishConfig() {
 bool JBWoprHADevice::_homeAssistantPublishState() {
 	_log->trace("Publishing Home Assistant state messages");
 
+	if (_mqttConfig.useStateDocument) {
+		// The full state document is sent after connect
+		return true;
+	}
+
 	// Effect
-	mqttPublishMessage(_getTopic(ENTITY_NAME_EFFECT, SUBENTITY_NAME_STATE), effectsCurrentEffectIsRunning() ? "ON" : "OFF");
-	mqttPublishMessage(_getTopic(ENTITY_NAME_EFFECT, SUBENTITY_NAME_NAME), "");
+	mqttPublishMessage(_getTopic(MQTT_TOPIC_EFFECT_STATE), effectsCurrentEffectIsRunning() ? "ON" : "OFF");
+	mqttPublishMessage(_getTopic(MQTT_TOPIC_EFFECT_NAME), "");
 	// Display
-	mqttPublishMessage(_getTopic(ENTITY_NAME_DISPLAY, SUBENTITY_NAME_STATE), _displayState ? "ON" : "OFF" );
-	mqttPublishMessage(_getTopic(ENTITY_NAME_DISPLAY, SUBENTITY_NAME_TEXT), "");
-	mqttPublishMessage(_getTopic(ENTITY_NAME_DISPLAY, SUBENTITY_NAME_BRIGHTNESS), std::to_string(_displayBrightness));
-	mqttPublishMessage(_getTopic(ENTITY_NAME_DISPLAY, SUBENTITY_NAME_SCROLLTEXT), "");
+	mqttPublishMessage(_getTopic(MQTT_TOPIC_DISPLAY_STATE), _displayState ? "ON" : "OFF" );
+	mqttPublishMessage(_getTopic(MQTT_TOPIC_DISPLAY_TEXT), "");
+	mqttPublishMessage(_getTopic(MQTT_TOPIC_DISPLAY_BRIGHTNESS), std::to_string(_displayBrightness));
+	mqttPublishMessage(_getTopic(MQTT_TOPIC_DISPLAY_SCROLLTEXT), "");
 	// DEFCON
-	mqttPublishMessage(_getTopic(ENTITY_NAME_DEFCON, SUBENTITY_NAME_STATE), _defconState ? "ON" : "OFF");
-	mqttPublishMessage(_getTopic(ENTITY_NAME_DEFCON, SUBENTITY_NAME_LEVEL), _defconNames.at((uint32_t)_defconLevel));
-	mqttPublishMessage(_getTopic(ENTITY_NAME_DEFCON, SUBENTITY_NAME_BRIGHTNESS), std::to_string(_defconBrightness));
-	mqttPublishMessage(_getTopic(ENTITY_NAME_DEFCON, SUBENTITY_NAME_COLOR), JBStringHelper::rgbToString(_defconLedsColor));
+	mqttPublishMessage(_getTopic(MQTT_TOPIC_DEFCON_STATE), _defconState ? "ON" : "OFF");
+	mqttPublishMessage(_getTopic(MQTT_TOPIC_DEFCON_LEVEL), _defconNames.at((uint32_t)_defconLevel));
+	mqttPublishMessage(_getTopic(MQTT_TOPIC_DEFCON_BRIGHTNESS), std::to_string(_defconBrightness));
+	mqttPublishMessage(_getTopic(MQTT_TOPIC_DEFCON_COLOR), JBStringHelper::rgbToString(_defconLedsColor));
 
 	return true;
 }
@@ -531,7 +606,7 @@ void JBWoprHADevice::_addDiscoveryPayload(JsonDocument &jsonDoc,
 	jsonDoc[HA_NAMES_UNIQUE_ID] = _getDeviceName() + "_" + prefix + "_" + entity;
 	jsonDoc[HA_NAMES_DEFAULT_ENTITY_ID] = platform + "." + _getDeviceName() + "_" +prefix + "_" + entity;
 
-	jsonDoc[HA_NAMES_STATE_TOPIC] = _getTopic(prefix, SUBENTITY_NAME_STATE);
+	jsonDoc[HA_NAMES_STATE_TOPIC] = _getTopic(prefix.c_str(), SUBENTITY_NAME_STATE);
 	jsonDoc[HA_NAMES_VALUE_TEMPLATE] = "{{ value_json." + templateValue + "}}";
 	if (!icon.empty()) {
 		jsonDoc[HA_NAMES_ICON] = icon;
@@ -541,6 +616,19 @@ void JBWoprHADevice::_addDiscoveryPayload(JsonDocument &jsonDoc,
 	}
 }
 
+void JBWoprHADevice::_setDiscoveryState(JsonDocument &jsonDoc,
+										const char* topicKey,
+										const char* templateKey,
+										JBWoprMqttTopic topic,
+										const char* field) {
+	if (!_mqttConfig.useStateDocument) {
+		jsonDoc[topicKey] = _getTopic(topic);
+		return;
+	}
+	jsonDoc[topicKey] = _getTopic(MQTT_TOPIC_STATE);
+	jsonDoc[templateKey] = std::string("{{ value_json.") + field + " }}";
+}
+
 void JBWoprHADevice::_addDeviceData(JsonDocument &jsonDoc) {
 	JsonObject device = jsonDoc["device"].to<JsonObject>();
 	device["name"] = _getDeviceName();
@@ -13,6 +13,8 @@
 #include "WiFiManager.h"
 #include <jblogger.h>
 
+#define JBWOPR_HA_EFFECT_QUEUE_SIZE 2		///< Max number of effect name lists waiting for the network task
+
 // ====================================================================
 //
 // W.O.P.R. with WiFiManager, MQTT and Home Assistant support
@@ -101,19 +103,22 @@ protected:
 	WiFiManagerParameter* _break3Param;										///< Break
 
 	void _setupWiFiManager() override;
-	void _saveParamsCallback() override;
+	void _setJsonDocumentFromParams(JsonDocument &jsonDoc) override;
 
 	// ====================================================================
 	// MQTT
 	//
-	const char* ENTITY_NAME_DIAGNOSTIC = "diagnostic";						///< Diagnostics entity name
-	const char* ENTITY_NAME_CONFIG = "config";								///< Config entity name
 
 	/// @brief Called when MQTT client get connected
 	/// @ingroup MQTTGroup
 	/// @details This method will be called when the MQTT client is connected.
 	bool _onMqttConnect() override;
 
+	/// @brief Network loop
+	/// @details Receives the effect names from loop(), and updates the effect discovery message
+	/// when they change.
+	void _networkLoop() override;
+
 	// ====================================================================
 	// Home Assistant
 	//
@@ -130,11 +135,13 @@ protected:
 	const char* HA_DIAG_ENTITY_IP = "ip";										///< IP entity name
 	const char* HA_DIAG_ENTITY_RSSI = "rssi";									///< RSSI entity name
 	const char* HA_DIAG_ENTITY_RAM = "ram";										///< RAM entity name
+	const char* HA_DIAG_ENTITY_MQTT_SUPPRESSED = "mqtt_suppressed";				///< MQTT suppressed messages entity name
 	const char* HA_CONF_ENTITY_DATE_FORMAT = "date_format";						///< Date format entity name
 	const char* HA_CONF_ENTITY_TIME_FORMAT = "time_format";						///< Time format entity name
 	const char* HA_CONF_ENTITY_DISPLAY_BRIGHTNESS = "display_brightness";		///< Display brightness entity name
 	const char* HA_CONF_ENTITY_DEFCON_BRIGHTNESS = "defcon_brightness";			///< DEFCON brightness entity name
 	const char* HA_CONF_ENTITY_EFFECTS_TIMEOUT = "effects_timeout";				///< Effects timeout entity name
+	const char* HA_CONF_ENTITY_EFFECTS_SPEED = "effects_speed";					///< Effects speed entity name
 	const char* HA_CONF_ENTITY_WIFI_USE_WEB_PORTAL = "use_web_portal";			///< Use web portal entity name
 	const char* HA_CONF_ENTITY_RESTART = "restart";								///< Restart entity name
 
@@ -142,12 +149,28 @@ protected:
 	const char* JSON_KEY_HA_DIAG_ENTITY_RSSI = "rssi";							///< RSSI entity key name
 	const char* JSON_KEY_HA_DIAG_ENTITY_RAM = "ram";							///< RAM entity key name
 	const char* JSON_KEY_HA_DIAG_ENTITY_VERSION = "version";					///< Version entity key name
+	const char* JSON_KEY_HA_DIAG_ENTITY_MQTT_PUBLISHED = "mqttPublished";		///< MQTT published messages key name
+	const char* JSON_KEY_HA_DIAG_ENTITY_MQTT_SUPPRESSED = "mqttSuppressed";	///< MQTT suppressed messages key name
+	const char* JSON_KEY_HA_DIAG_ENTITY_MQTT_QUEUED = "mqttQueued";			///< MQTT queued messages key name
+	const char* JSON_KEY_HA_DIAG_ENTITY_MQTT_DROPPED = "mqttDropped";			///< MQTT dropped messages key name
+	const char* JSON_KEY_HA_DIAG_ENTITY_MQTT_COALESCED = "mqttCoalesced";		///< MQTT coalesced messages key name
+	const char* JSON_KEY_HA_DIAG_ENTITY_MQTT_LATENCY = "mqttLatency";			///< MQTT max queue latency key name
 
 	const std::vector<std::string> _defconNames { "None", "DEFCON 5", "DEFCON 4", "DEFCON 3", "DEFCON 2", "DEFCON 1" };	///< DEFCON names
 
+	JBSpscQueue<std::vector<std::string>, JBWOPR_HA_EFFECT_QUEUE_SIZE> _homeAssistantEffectQueue;	///< Effect names from loop() to the network task
+	std::vector<std::string> _homeAssistantEffectNames;					///< Effect names for discovery, used by network task
+	bool _homeAssistantEffectsChanged = false;							///< True if effect discovery must be sent, used by network task
+	size_t _homeAssistantEffectCount = 0;								///< Number of effects sent to the network task, used by loop()
+	std::atomic<bool> _homeAssistantPublishPending { false };			///< True if loop() must publish state after connect
+
 	/// @brief Send Home Assistant discovery
 	bool _homeAssistantSendDiscovery();
 
+	/// @brief Send Home Assistant effect select discovery
+	/// @details Uses the effect names received from loop(), called from the network task.
+	void _homeAssistantSendEffectDiscovery();
+
 	/// @brief Publish Home Assistant diagnostics
 	bool _homeAssistantPublishDiagnostics();
 
@@ -184,6 +207,19 @@ protected:
 							  const std::string& icon,
 							  const std::string& unitOfMeasurement = "");
 
+	/// @brief Set state topic of Home Assistant discovery message
+	/// @details Points at the state document, with a value template, if it is used.
+	/// @param jsonDoc JSON document
+	/// @param topicKey State topic key name
+	/// @param templateKey Value template key name
+	/// @param topic State topic
+	/// @param field State document key name
+	void _setDiscoveryState(JsonDocument &jsonDoc,
+							const char* topicKey,
+							const char* templateKey,
+							JBWoprMqttTopic topic,
+							const char* field);
+
 	/// @brief Add device data to Home Assistant discovery message
 	/// @param jsonDoc JSON document
 	void _addDeviceData(JsonDocument &jsonDoc);
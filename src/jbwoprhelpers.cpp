@@ -9,6 +9,7 @@
 #include "tz_data.h"
 #include <WiFi.h>
 #include <HTTPClient.h>
+#include <algorithm>
 
 bool JBTimeHelper::_isInitialized = false;
 std::string JBTimeHelper::_ntpServer = "";
@@ -146,3 +147,39 @@ uint32_t JBStringHelper::stringToRgb(std::string rgbString) {
 	return 0;
 }
 
+uint32_t JBStringHelper::hash(const char* data, size_t length, uint32_t value) {
+	for (size_t i = 0; i < length; i++) {
+		value = (value ^ (uint8_t)data[i]) * FNV_PRIME;
+	}
+	return value;
+}
+
+JBChunkPrint::JBChunkPrint(Print& target) : _target(target) {
+}
+
+size_t JBChunkPrint::write(uint8_t c) {
+	return write(&c, 1);
+}
+
+size_t JBChunkPrint::write(const uint8_t* buffer, size_t size) {
+	size_t written = 0;
+	while (written < size) {
+		if (_length == sizeof(_buffer) && !writeChunk()) {
+			break;
+		}
+		size_t length = std::min(size - written, sizeof(_buffer) - _length);
+		memcpy(_buffer + _length, buffer + written, length);
+		_length += length;
+		written += length;
+	}
+	return written;
+}
+
+bool JBChunkPrint::writeChunk() {
+	if (_length == 0) {
+		return true;
+	}
+	size_t length = _length;
+	_length = 0;
+	return _target.write(_buffer, length) == length;
+}
@@ -9,10 +9,13 @@
 #ifndef ARDUINO_WOPR_JBWOPRHELPERS_H
 #define ARDUINO_WOPR_JBWOPRHELPERS_H
 
+#include <Arduino.h>
 #include <string>
+#include <cstring>
 #include <sstream>
 #include <time.h>
 #include <jblogger.h>
+#include "jbwoprstringview.h"
 
 /// @brief This enum contains text alignment options
 enum JBTextAlignment {
@@ -85,6 +88,202 @@ public:
 	/// @return RGB value
 	static uint32_t stringToRgb(std::string rgbString);
 
+	/// @brief Get FNV-1a hash of a null terminated string
+	/// @details Evaluated at compile time when used with a string literal.
+	/// @param str String to hash
+	/// @return 32 bit hash value
+	static constexpr uint32_t hash(const char* str) {
+		return _hash(str, FNV_OFFSET_BASIS);
+	}
+
+	/// @brief Get FNV-1a hash of a character buffer
+	/// @param data Buffer to hash, does not need to be null terminated
+	/// @param length Length of buffer
+	/// @param value (optional) Hash of preceding data, to hash data in parts
+	/// @return 32 bit hash value, same as hash(const char*) for the same characters
+	static uint32_t hash(const char* data, size_t length, uint32_t value = FNV_OFFSET_BASIS);
+
+private:
+	static constexpr uint32_t FNV_OFFSET_BASIS = 2166136261u;	///< FNV-1a 32 bit offset basis
+	static constexpr uint32_t FNV_PRIME = 16777619u;			///< FNV-1a 32 bit prime
+
+	/// @brief Recursive FNV-1a helper, C++11 constexpr compatible
+	static constexpr uint32_t _hash(const char* str, uint32_t value) {
+		return *str == 0 ? value : _hash(str + 1, (value ^ (uint8_t)*str) * FNV_PRIME);
+	}
+};
+
+/// @brief Print target that hashes and counts the written characters
+/// @details Used to get the length and hash of a JSON document without
+/// serializing it to a buffer.
+class JBHashPrint : public Print {
+public:
+	/// @brief Write character
+	/// @param c Character
+	/// @return 1
+	size_t write(uint8_t c) override {
+		return write(&c, 1);
+	}
+
+	/// @brief Write characters
+	/// @param buffer Characters
+	/// @param size Number of characters
+	/// @return Number of characters
+	size_t write(const uint8_t* buffer, size_t size) override {
+		_hash = JBStringHelper::hash(reinterpret_cast<const char*>(buffer), size, _hash);
+		_length += size;
+		return size;
+	}
+
+	/// @brief Get hash
+	/// @return FNV-1a hash of written characters
+	uint32_t getHash() const {
+		return _hash;
+	}
+
+	/// @brief Get length
+	/// @return Number of written characters
+	size_t getLength() const {
+		return _length;
+	}
+
+private:
+	uint32_t _hash = JBStringHelper::hash("");	///< Hash of written characters
+	size_t _length = 0;							///< Number of written characters
+};
+
+/// @brief Print target that forwards the written characters in chunks
+/// @details ArduinoJson writes mostly one character at a time. Written directly
+/// to a network client, every character becomes a write call, and over TLS a
+/// record of its own.
+class JBChunkPrint : public Print {
+public:
+	/// @brief Constructor
+	/// @param target Print target the chunks are written to
+	explicit JBChunkPrint(Print& target);
+
+	/// @brief Write character
+	/// @param c Character
+	/// @return 1, or 0 if a full chunk could not be written
+	size_t write(uint8_t c) override;
+
+	/// @brief Write characters
+	/// @param buffer Characters
+	/// @param size Number of characters
+	/// @return Number of characters accepted
+	size_t write(const uint8_t* buffer, size_t size) override;
+
+	/// @brief Write buffered characters to the target
+	/// @return True if all characters were written
+	bool writeChunk();
+
+private:
+	Print& _target;								///< Print target
+	uint8_t _buffer[128];						///< Buffered characters
+	size_t _length = 0;							///< Number of buffered characters
+};
+
+/// @brief Small and fast pseudo random number generator
+/// @details Uses xorshift32, so the same seed always gives the same sequence.
+/// Ranges are mapped with a multiply and shift instead of a division.
+class JBRandom {
+public:
+	/// @brief Constructor
+	/// @param seed Seed, 0 is replaced with a fixed non zero value
+	explicit JBRandom(uint32_t seed = DEFAULT_SEED) {
+		setSeed(seed);
+	}
+
+	/// @brief Restart sequence from seed
+	/// @param seed Seed, 0 is replaced with a fixed non zero value
+	void setSeed(uint32_t seed) {
+		_seed = seed == 0 ? DEFAULT_SEED : seed;
+		_state = _seed;
+	}
+
+	/// @brief Get seed used for current sequence
+	/// @return Seed
+	uint32_t getSeed() const {
+		return _seed;
+	}
+
+	/// @brief Get next 32 bit value
+	/// @return Random value
+	uint32_t next() {
+		_state ^= _state << 13;
+		_state ^= _state >> 17;
+		_state ^= _state << 5;
+		return _state;
+	}
+
+	/// @brief Get random value in range
+	/// @param max Upper bound, exclusive
+	/// @return Random value from 0 to max - 1, 0 if max is 0
+	uint32_t next(uint32_t max) {
+		return (uint32_t)(((uint64_t)next() * max) >> 32);
+	}
+
+	/// @brief Get random value in range
+	/// @param min Lower bound, inclusive
+	/// @param max Upper bound, exclusive
+	/// @return Random value from min to max - 1, min if max <= min
+	uint32_t next(uint32_t min, uint32_t max) {
+		return max <= min ? min : min + next(max - min);
+	}
+
+private:
+	static constexpr uint32_t DEFAULT_SEED = 2463534242u;	///< Seed used instead of 0
+	uint32_t _seed;											///< Seed of current sequence
+	uint32_t _state;										///< Generator state
+};
+
+/// @brief Histogram with power of two buckets
+/// @details Bucket 0 counts values 0 and 1, bucket i counts values from 2^i to
+/// 2^(i+1) - 1, and the last bucket counts all larger values.
+class JBHistogram {
+public:
+	static constexpr uint8_t BUCKET_COUNT = 16;	///< Number of buckets
+
+	/// @brief Add value
+	/// @param value Value
+	void add(uint32_t value) {
+		uint8_t bucket = value == 0 ? 0 : 31 - __builtin_clz(value);
+		_buckets[bucket < BUCKET_COUNT ? bucket : BUCKET_COUNT - 1]++;
+		_count++;
+		_sum += value;
+		_max = value > _max ? value : _max;
+	}
+
+	/// @brief Get number of values
+	/// @return Count
+	uint32_t getCount() const {
+		return _count;
+	}
+
+	/// @brief Get average value
+	/// @return Average, 0 if empty
+	uint32_t getAverage() const {
+		return _count == 0 ? 0 : (uint32_t)(_sum / _count);
+	}
+
+	/// @brief Get largest value
+	/// @return Max, 0 if empty
+	uint32_t getMax() const {
+		return _max;
+	}
+
+	/// @brief Get bucket count
+	/// @param bucket Bucket index, less than BUCKET_COUNT
+	/// @return Number of values in bucket
+	uint32_t getBucket(uint8_t bucket) const {
+		return _buckets[bucket];
+	}
+
+private:
+	uint32_t _buckets[BUCKET_COUNT] {};		///< Values per bucket
+	uint32_t _count = 0;					///< Number of values
+	uint64_t _sum = 0;						///< Sum of values
+	uint32_t _max = 0;						///< Largest value
 };
 
 #endif //ARDUINO_WOPR_JBWOPRHELPERS_H
@@ -7,6 +7,9 @@
 /// @copyright Copyright© 2023, Jonny Bergdahl
 ///
 #include "jbwoprmqtt.h"
+#include <LittleFS.h>
+#include <algorithm>
+#include <sys/time.h>
 
 // ====================================================================
 // General
@@ -19,10 +22,25 @@ JBWoprMqttDevice::JBWoprMqttDevice() :
 			DEFAULT_MQTT_PORT,	// mqttServerPort
 			"",					// mqttUserName
 			"",					// mqttPassword
-			DEFAULT_MQTT_PREFIX		// mqttPrefix
+			DEFAULT_MQTT_PREFIX,	// mqttPrefix
+			false,				// useStateDocument
+			false,				// useBinary
+			JBWOPR_MQTT_METRICS_INTERVAL,	// metricsInterval
+			false,				// persistentSession
+			false,				// useBroadcast
+			"",					// mqttGroups
+			false				// useTls
 	},
+	_rules { this },
 	_log {new JBLogger("woprmqtt", LogLevel::LOG_LEVEL_TRACE) }
-{}
+{
+	// Effects can change these many times per second
+	_mqttPublishIntervals[MQTT_TOPIC_DISPLAY_TEXT] = JBWOPR_MQTT_STATE_INTERVAL;
+	_mqttPublishIntervals[MQTT_TOPIC_DISPLAY_BRIGHTNESS] = JBWOPR_MQTT_STATE_INTERVAL;
+	_mqttPublishIntervals[MQTT_TOPIC_DEFCON_LEVEL] = JBWOPR_MQTT_STATE_INTERVAL;
+	_mqttPublishIntervals[MQTT_TOPIC_DEFCON_COLOR] = JBWOPR_MQTT_STATE_INTERVAL;
+	_mqttPublishIntervals[MQTT_TOPIC_DEFCON_BRIGHTNESS] = JBWOPR_MQTT_STATE_INTERVAL;
+}
 
 bool JBWoprMqttDevice::begin(JBWoprBoardVariant variant) {
 	return JBWoprWiFiDevice::begin(variant);
@@ -33,6 +51,8 @@ bool JBWoprMqttDevice::begin(JBWoprBoardVariant variant, JBWoprBoardPins pins)
 	if (!JBWoprWiFiDevice::begin(variant, pins)) {
 		return false;
 	}
+	_loadRules();
+	_loadBindings();
 
 	// MQTT
 	if (!_mqttConfig.useMqtt) {
@@ -53,20 +73,87 @@ bool JBWoprMqttDevice::begin(JBWoprBoardVariant variant, JBWoprBoardPins pins)
 }
 
 void JBWoprMqttDevice::loop() {
-	if (!effectsCurrentEffectIsRunning() && _effectsCounter == 0) {
-		mqttPublishMessage(_getTopic(ENTITY_NAME_EFFECT, SUBENTITY_NAME_STATE), STATE_OFF);
+	bool effectRunning = effectsCurrentEffectIsRunning() || _effectsCounter != 0;
+	if (!effectRunning && _mqttEffectRunning) {
+		_mqttPublishState(MQTT_STATE_EFFECT, MQTT_TOPIC_EFFECT_STATE, STATE_OFF);
+	}
+	_mqttEffectRunning = effectRunning;
+	_rulesLoop();
+
+	// Changes are collected, so effects that update every frame send one document per interval
+	if (_mqttConfig.useStateDocument && _mqttStateChanges != 0 &&
+		(uint32_t)millis() - _mqttStateTime >= JBWOPR_MQTT_STATE_DOCUMENT_INTERVAL) {
+		_mqttStateTime = millis();
+		_mqttPublishStateDocument(_mqttStateChanges.exchange(0));
+	}
+	if (_mqttConfig.useBinary && _mqttBinaryChanges != 0 &&
+		(uint32_t)millis() - _mqttBinaryTime >= JBWOPR_MQTT_BINARY_STATE_INTERVAL) {
+		_mqttBinaryTime = millis();
+		_mqttPublishBinaryState(_mqttBinaryChanges.exchange(0));
 	}
 
 	JBWoprWiFiDevice::loop();
 
-	if (_mqttActive) {
-		_mqttReconnect();
-		if (_mqttClient->connected()) {
-			_mqttClient->loop();
+	if (_mqttScheduledTime != 0 && _getUnixTimeMs() >= _mqttScheduledTime) {
+		_mqttScheduledTime = 0;
+		_applyBatch(_mqttScheduledBatch[JSON_KEY_BATCH_COMMANDS].as<JsonArrayConst>());
+		_mqttScheduledBatch.clear();
+	}
+
+	// Commands received by the network task are run here, with the display and LEDs
+	MqttCommandMessage message;
+	while (_mqttCommandQueue.pop(message)) {
+		_handleCommand(message.command, JBStringView { message.payload.data(), message.payload.size() });
+		_mqttCommandHistogram.add(micros() - message.receiveTime);
+	}
+
+	// A busy feed can queue several values of a binding, only the latest is shown
+	uint8_t bindings = 0;
+	JBWoprBindings::Render render;
+	while (_mqttBindingQueue.pop(render)) {
+		bindings |= 1 << render.index;
+		_mqttBindingRenders[render.index] = std::move(render);
+	}
+	for (uint8_t i = 0; bindings != 0 && i < JBWOPR_BINDINGS_MAX; i++) {
+		if (bindings & (1 << i)) {
+			_renderBinding(_mqttBindingRenders[i]);
 		}
 	}
 }
 
+void JBWoprMqttDevice::_networkLoop() {
+	JBWoprWiFiDevice::_networkLoop();
+
+	if (!_mqttActive) {
+		return;
+	}
+	if (_mqttReconnect()) {
+		_mqttClient->loop();
+	}
+	_mqttFlushQueue();
+
+	if (_mqttConnected && _mqttBindingsChanged.exchange(false)) {
+		_mqttSubscribeBindings();
+	}
+	if (_mqttReconnectMeasuring && _mqttQueue.empty()) {
+		_mqttReconnectMeasuring = false;
+		_mqttReconnectBytesHistogram.add(_mqttGetPublishedBytes() - _mqttReconnectBytes);
+	}
+	if (_mqttSessionProbe && _mqttConnected && (uint32_t)millis() - _mqttSessionProbeTime >= JBWOPR_MQTT_SESSION_PROBE_TIMEOUT) {
+		// The broker did not keep the session, so subscribe and publish everything
+		_log->warning("MQTT session not resumed, publishing all state");
+		_mqttSessionProbe = false;
+		_mqttSessionResumed = false;
+		_mqttStartSession();
+	}
+
+	if (_mqttConnected && _mqttConfig.metricsInterval != 0 &&
+		(uint32_t)millis() - _mqttMetricsTime >= _mqttConfig.metricsInterval * 1000UL) {
+		_mqttMetricsTime = millis();
+		_mqttPublishMetrics();
+	}
+}
+
 // ====================================================================
 // Logger
 //
@@ -83,10 +170,26 @@ LogLevel JBWoprMqttDevice::getLogLevel() {
 // MQTT
 //
 bool JBWoprMqttDevice::mqttPublishMessage(const std::string& topic, JsonDocument &jsonDoc, bool retain) {
-	char payload[1024];
+	return mqttPublishMessage(topic.c_str(), jsonDoc, retain);
+}
+
+bool JBWoprMqttDevice::mqttPublishMessage(const char* topic, JsonDocument &jsonDoc, bool retain) {
+	if (!_mqttActive) {
+		_log->trace("MQTT not active, skipping publish");
+		return false;
+	}
+	if (_mqttIsDirectPublish()) {
+		return _mqttSendMessage(topic, jsonDoc, retain);
+	}
+
+	std::string payload;
+	payload.reserve(measureJson(jsonDoc));
 	serializeJson(jsonDoc, payload);
+	return _mqttQueueMessage(topic, std::move(payload), retain, true);
+}
 
-	return mqttPublishMessage(topic.c_str(), payload, retain);
+bool JBWoprMqttDevice::mqttPublishMessage(const char* topic, const std::string& payload, bool retain) {
+	return mqttPublishMessage(topic, payload.c_str(), retain);
 }
 
 bool JBWoprMqttDevice::mqttPublishMessage(const std::string& topic, const std::string& payload, bool retain) {
@@ -95,56 +198,435 @@ bool JBWoprMqttDevice::mqttPublishMessage(const std::string& topic, const std::s
 }
 
 bool JBWoprMqttDevice::mqttPublishMessage(const char* configTopic, const char* value, bool retain) {
+	return _mqttQueueMessage(configTopic, value, retain, true);
+}
+
+bool JBWoprMqttDevice::mqttPublishEvent(const char* topic, const char* value) {
+	return _mqttQueueMessage(topic, value, false, false);
+}
+
+bool JBWoprMqttDevice::_mqttIsDirectPublish() const {
+	// The network task, and _onMqttConnect() without a network task, owns the client
+	return _networkTask != nullptr ? _isNetworkTask() : _mqttDirectPublish;
+}
+
+bool JBWoprMqttDevice::_mqttQueueMessage(const char* topic, std::string value, bool retain, bool coalesce) {
 	if (!_mqttActive) {
 		_log->trace("MQTT not active, skipping publish");
 		return false;
 	}
+	if (_mqttIsDirectPublish()) {
+		return _mqttSendMessage(topic, value.data(), value.size(), retain, coalesce);
+	}
 
+	MqttQueueEntry entry { topic, std::move(value), JBStringHelper::hash(topic), (uint32_t)millis(), retain, coalesce, _getTopicIndex(topic) };
+	if (!_mqttOutbox.push(entry)) {
+		_log->warning("MQTT outbox full, dropping message to %s", topic);
+		_mqttDroppedCount++;
+		return false;
+	}
+	return true;
+}
+
+void JBWoprMqttDevice::_mqttFlushQueue() {
+	MqttQueueEntry message;
+	while (_mqttOutbox.pop(message)) {
+		bool coalesced = false;
+		if (message.coalesce) {
+			for (auto& entry : _mqttQueue) {
+				if (entry.coalesce && entry.topicHash == message.topicHash && entry.topic == message.topic) {
+					entry.payload = std::move(message.payload);
+					entry.retain = message.retain;
+					_mqttCoalescedCount++;
+					coalesced = true;
+					break;
+				}
+			}
+		}
+		if (coalesced) {
+			continue;
+		}
+		if (_mqttQueue.size() >= JBWOPR_MQTT_QUEUE_SIZE) {
+			_log->warning("MQTT queue full, dropping message to %s", _mqttQueue.front().topic.c_str());
+			_mqttQueue.pop_front();
+			_mqttDroppedCount++;
+		}
+		_mqttQueue.push_back(std::move(message));
+	}
+
+	uint32_t now = millis();
+	uint8_t sent = 0;
+	auto entry = _mqttQueue.begin();
+	while (entry != _mqttQueue.end() && sent < JBWOPR_MQTT_BATCH_SIZE && _mqttConnected) {
+		// Rate limited messages wait in the queue, where newer messages replace them
+		uint8_t index = entry->topicIndex;
+		if (index < MQTT_TOPIC_COUNT && _mqttPublishIntervals[index] != 0 &&
+			now - _mqttPublishTimes[index] < _mqttPublishIntervals[index]) {
+			++entry;
+			continue;
+		}
+		if (!_mqttSendMessage(entry->topic.c_str(), entry->payload.data(), entry->payload.size(), entry->retain, entry->coalesce)) {
+			// Keep the message, it is sent again after reconnect
+			break;
+		}
+		if (index < MQTT_TOPIC_COUNT) {
+			_mqttPublishTimes[index] = now;
+		}
+		_mqttMaxLatency = std::max<uint32_t>(_mqttMaxLatency, now - entry->queueTime);
+		entry = _mqttQueue.erase(entry);
+		sent++;
+	}
+	_mqttQueueLength = _mqttQueue.size();
+}
+
+bool JBWoprMqttDevice::_mqttSendMessage(const char* configTopic, const char* value, size_t length, bool retain, bool useCache) {
 	if (!_mqttClient->connected()) {
 		_log->trace("MQTT not connected, skipping publish");
 		return false;
 	}
-	if (!_mqttClient->publish(configTopic, value, retain))
-	{
+
+	// Only hashes are kept, so the cache size only depends on the number of topics
+	uint32_t topicHash = JBStringHelper::hash(configTopic);
+	uint32_t valueHash = JBStringHelper::hash(value, length);
+	if (useCache && _mqttIsPublished(topicHash, valueHash)) {
+		return true;
+	}
+
+	// Streamed, so the payload is not limited by the client buffer size
+	if (!_mqttClient->beginPublish(configTopic, length, retain) ||
+		_mqttClient->write(reinterpret_cast<const uint8_t*>(value), length) != length ||
+		!_mqttClient->endPublish()) {
 		_log->error("Failed to publish to MQTT topic");
+		_mqttFailedCount++;
 		return false;
 	}
+	if (useCache) {
+		_mqttPublishCache[topicHash] = valueHash;
+	}
+	_mqttCountPublish(configTopic, length);
 
 	_log->trace("MQTT > %s %s:", configTopic, retain ? "(retain)" : "");
-	_log->traceAsciiDump(value, strlen(value));
+	_log->traceAsciiDump(value, length);
 
 	return true;
 }
 
+bool JBWoprMqttDevice::_mqttSendMessage(const char* topic, JsonDocument &jsonDoc, bool retain) {
+	if (!_mqttClient->connected()) {
+		_log->trace("MQTT not connected, skipping publish");
+		return false;
+	}
+
+	// First pass gets length and hash, second pass writes to the client
+	JBHashPrint hashPrint;
+	serializeJson(jsonDoc, hashPrint);
+	uint32_t topicHash = JBStringHelper::hash(topic);
+	if (_mqttIsPublished(topicHash, hashPrint.getHash())) {
+		return true;
+	}
+
+	JBChunkPrint chunkPrint(*_mqttClient);
+	if (!_mqttClient->beginPublish(topic, hashPrint.getLength(), retain) ||
+		serializeJson(jsonDoc, chunkPrint) != hashPrint.getLength() ||
+		!chunkPrint.writeChunk() ||
+		!_mqttClient->endPublish()) {
+		_log->error("Failed to publish to MQTT topic");
+		_mqttFailedCount++;
+		return false;
+	}
+	_mqttPublishCache[topicHash] = hashPrint.getHash();
+	_mqttCountPublish(topic, hashPrint.getLength());
+
+	_log->trace("MQTT > %s %s: %u bytes", topic, retain ? "(retain)" : "", hashPrint.getLength());
+
+	return true;
+}
+
+bool JBWoprMqttDevice::_mqttIsPublished(uint32_t topicHash, uint32_t valueHash) {
+	auto item = _mqttPublishCache.find(topicHash);
+	if (item != _mqttPublishCache.end() && item->second == valueHash) {
+		_mqttSuppressedCount++;
+		return true;
+	}
+	return false;
+}
+
+bool JBWoprMqttDevice::_mqttDeferState(uint16_t fields) {
+	if (_mqttConfig.useBinary) {
+		// In addition to the text topics
+		_mqttBinaryChanges |= fields;
+	}
+	if (_mqttConfig.useStateDocument) {
+		_mqttStateChanges |= fields;
+		return true;
+	}
+	if (_mqttBatchActive) {
+		_mqttBatchChanges |= fields;
+		return true;
+	}
+	return false;
+}
+
+void JBWoprMqttDevice::_mqttPublishState(JBWoprMqttStateField field, JBWoprMqttTopic topic, const char* value) {
+	if (!_mqttDeferState(field)) {
+		mqttPublishMessage(_getTopic(topic), value);
+	}
+}
+
+bool JBWoprMqttDevice::_mqttPublishStateDocument(uint16_t changes) {
+	JBWoprEffectBase* effect = effectsGetCurrentEffect();
+	bool effectRunning = effectsCurrentEffectIsRunning() && effect != nullptr;
+
+	JsonDocument jsonDoc;
+	jsonDoc[JSON_KEY_STATE_EFFECT] = effectRunning ? STATE_ON : STATE_OFF;
+	jsonDoc[JSON_KEY_STATE_EFFECT_NAME] = effectRunning ? effect->getName() : "";
+	if (effectRunning && effect->getId() != JBWOPR_EFFECT_ID_NONE) {
+		jsonDoc[JSON_KEY_STATE_EFFECT_ID] = effect->getId();
+	}
+	jsonDoc[JSON_KEY_STATE_DISPLAY] = _displayState ? STATE_ON : STATE_OFF;
+	jsonDoc[JSON_KEY_STATE_DISPLAY_TEXT] = _mqttStateText;
+	jsonDoc[JSON_KEY_STATE_DISPLAY_SCROLLTEXT] = _mqttStateScrollText;
+	jsonDoc[JSON_KEY_STATE_DISPLAY_BRIGHTNESS] = _mqttStateDisplayBrightness;
+	jsonDoc[JSON_KEY_STATE_DEFCON] = _defconState ? STATE_ON : STATE_OFF;
+	jsonDoc[JSON_KEY_STATE_DEFCON_LEVEL] = DEFCON_STRINGS[_defconLevel];
+	jsonDoc[JSON_KEY_STATE_DEFCON_COLOR] = JBStringHelper::rgbToString(_defconLedsColor);
+	jsonDoc[JSON_KEY_STATE_DEFCON_BRIGHTNESS] = _mqttStateDefconBrightness;
+	jsonDoc[JSON_KEY_STATE_CHANGED] = changes;
+	return mqttPublishMessage(_getTopic(MQTT_TOPIC_STATE), jsonDoc, true);
+}
+
+bool JBWoprMqttDevice::_mqttPublishBinaryState(uint16_t changes) {
+	JBWoprEffectBase* effect = effectsGetCurrentEffect();
+	bool effectRunning = effectsCurrentEffectIsRunning() && effect != nullptr;
+	const std::string& effectName = effectRunning ? effect->getName() : "";
+
+	// Fixed size fields take at most 5 bytes each, strings 5 bytes plus their length
+	std::string payload(64 + effectName.size() + _mqttStateText.size() + _mqttStateScrollText.size(), '\0');
+	JBMsgPackWriter writer(reinterpret_cast<uint8_t*>(&payload[0]), payload.size());
+	writer.writeArray(12);
+	writer.writeUInt(changes);
+	writer.writeBool(effectRunning);
+	writer.writeString(effectName);
+	if (effectRunning && effect->getId() != JBWOPR_EFFECT_ID_NONE) {
+		writer.writeUInt(effect->getId());
+	} else {
+		writer.writeNil();
+	}
+	writer.writeBool(_displayState);
+	writer.writeString(_mqttStateText);
+	writer.writeString(_mqttStateScrollText);
+	writer.writeUInt(_mqttStateDisplayBrightness);
+	writer.writeBool(_defconState);
+	writer.writeUInt(_defconLevel);
+	writer.writeUInt(_defconLedsColor);
+	writer.writeUInt(_mqttStateDefconBrightness);
+	if (writer.hasOverflow()) {
+		_log->error("MessagePack state buffer overflow");
+		return false;
+	}
+	payload.resize(writer.getLength());
+	return _mqttQueueMessage(_getTopic(MQTT_TOPIC_BINARY_STATE), std::move(payload), true, true);
+}
+
+void JBWoprMqttDevice::_mqttPublishStateFields(uint16_t fields) {
+	JBWoprEffectBase* effect = effectsGetCurrentEffect();
+	bool effectRunning = effectsCurrentEffectIsRunning() && effect != nullptr;
+
+	if ((fields & MQTT_STATE_EFFECT_NAME) && effectRunning) {
+		mqttPublishMessage(_getTopic(MQTT_TOPIC_EFFECT_NAME), effect->getName());
+	}
+	if ((fields & MQTT_STATE_EFFECT_ID) && effectRunning && effect->getId() != JBWOPR_EFFECT_ID_NONE) {
+		mqttPublishMessage(_getTopic(MQTT_TOPIC_EFFECT_ID), std::to_string(effect->getId()));
+	}
+	if (fields & MQTT_STATE_EFFECT) {
+		mqttPublishMessage(_getTopic(MQTT_TOPIC_EFFECT_STATE), effectRunning ? STATE_ON : STATE_OFF);
+	}
+	if (fields & MQTT_STATE_DISPLAY) {
+		mqttPublishMessage(_getTopic(MQTT_TOPIC_DISPLAY_STATE), _displayState ? STATE_ON : STATE_OFF);
+	}
+	if (fields & MQTT_STATE_DISPLAY_TEXT) {
+		mqttPublishMessage(_getTopic(MQTT_TOPIC_DISPLAY_TEXT), _mqttStateText);
+	}
+	if (fields & MQTT_STATE_DISPLAY_SCROLLTEXT) {
+		mqttPublishMessage(_getTopic(MQTT_TOPIC_DISPLAY_SCROLLTEXT), _mqttStateScrollText);
+	}
+	if (fields & MQTT_STATE_DISPLAY_BRIGHTNESS) {
+		mqttPublishMessage(_getTopic(MQTT_TOPIC_DISPLAY_BRIGHTNESS), std::to_string(_mqttStateDisplayBrightness));
+	}
+	if (fields & MQTT_STATE_DEFCON) {
+		mqttPublishMessage(_getTopic(MQTT_TOPIC_DEFCON_STATE), _defconState ? STATE_ON : STATE_OFF);
+	}
+	if (fields & MQTT_STATE_DEFCON_LEVEL) {
+		mqttPublishMessage(_getTopic(MQTT_TOPIC_DEFCON_LEVEL), DEFCON_STRINGS[_defconLevel]);
+	}
+	if (fields & MQTT_STATE_DEFCON_COLOR) {
+		mqttPublishMessage(_getTopic(MQTT_TOPIC_DEFCON_COLOR), JBStringHelper::rgbToString(_defconLedsColor));
+	}
+	if (fields & MQTT_STATE_DEFCON_BRIGHTNESS) {
+		mqttPublishMessage(_getTopic(MQTT_TOPIC_DEFCON_BRIGHTNESS), std::to_string(_mqttStateDefconBrightness));
+	}
+}
+
+bool JBWoprMqttDevice::mqttIsConnected() {
+	return _mqttActive && _mqttConnected;
+}
+
+void JBWoprMqttDevice::mqttClearPublishCache() {
+	_mqttPublishCache.clear();
+}
+
+uint32_t JBWoprMqttDevice::mqttGetPublishedCount() const {
+	return _mqttPublishedCount;
+}
+
+uint32_t JBWoprMqttDevice::mqttGetSuppressedCount() const {
+	return _mqttSuppressedCount;
+}
+
+size_t JBWoprMqttDevice::mqttGetQueueLength() const {
+	return _mqttOutbox.size() + _mqttQueueLength;
+}
+
+uint32_t JBWoprMqttDevice::mqttGetDroppedCount() const {
+	return _mqttDroppedCount;
+}
+
+uint32_t JBWoprMqttDevice::mqttGetCoalescedCount() const {
+	return _mqttCoalescedCount;
+}
+
+uint32_t JBWoprMqttDevice::mqttGetMaxLatency() const {
+	return _mqttMaxLatency;
+}
+
+void JBWoprMqttDevice::mqttGetMetrics(JsonDocument& jsonDoc) {
+	jsonDoc["uptime"] = millis() / 1000;
+	jsonDoc["connected"] = (bool)_mqttConnected;
+	jsonDoc["connects"] = _mqttConnectCount;
+	jsonDoc["connectFailures"] = _mqttConnectFailedCount;
+	jsonDoc["disconnects"] = _mqttDisconnectCount;
+	jsonDoc["sessionsResumed"] = _mqttResumedCount;
+	jsonDoc["tls"] = _mqttConfig.useTls;
+	_setHistogramJson(jsonDoc["handshakeTime"].to<JsonObject>(), _mqttHandshakeHistogram);
+	_setHistogramJson(jsonDoc["reconnectTime"].to<JsonObject>(), _mqttReconnectHistogram);
+	_setHistogramJson(jsonDoc["reconnectBytes"].to<JsonObject>(), _mqttReconnectBytesHistogram);
+
+	JsonObject published = jsonDoc["published"].to<JsonObject>();
+	for (uint8_t i = 0; i < MQTT_CLASS_COUNT; i++) {
+		JsonObject topicClass = published[CLASS_NAMES[i]].to<JsonObject>();
+		topicClass["count"] = _mqttClassCounts[i];
+		topicClass["bytes"] = _mqttClassBytes[i];
+	}
+	jsonDoc["failed"] = _mqttFailedCount;
+	jsonDoc["suppressed"] = _mqttSuppressedCount;
+	jsonDoc["dropped"] = mqttGetDroppedCount();
+	jsonDoc["coalesced"] = _mqttCoalescedCount;
+	jsonDoc["queued"] = mqttGetQueueLength();
+	jsonDoc["queueLatency"] = _mqttMaxLatency;
+	_setHistogramJson(jsonDoc["commandLatency"].to<JsonObject>(), _mqttCommandHistogram);
+	_setHistogramJson(jsonDoc["roundTrip"].to<JsonObject>(), _mqttRoundTripHistogram);
+}
+
+JBWoprMqttTopicClass JBWoprMqttDevice::_getTopicClass(uint8_t topicIndex) const {
+	switch (topicIndex) {
+		case MQTT_TOPIC_AVAILABILITY:
+		case MQTT_TOPIC_CONFIG_STATE:
+		case MQTT_TOPIC_DIAGNOSTIC_STATE:
+		case MQTT_TOPIC_METRICS:
+			return MQTT_CLASS_DIAGNOSTIC;
+		case MQTT_TOPIC_BUTTON_FRONT_LEFT_EVENT:
+		case MQTT_TOPIC_BUTTON_FRONT_RIGHT_EVENT:
+		case MQTT_TOPIC_BUTTON_BACK_TOP_EVENT:
+		case MQTT_TOPIC_BUTTON_BACK_BOTTOM_EVENT:
+			return MQTT_CLASS_EVENT;
+		case MQTT_TOPIC_SUBSCRIPTION:
+		case MQTT_TOPIC_COUNT:
+			return MQTT_CLASS_OTHER;
+		default:
+			return MQTT_CLASS_STATE;
+	}
+}
+
+void JBWoprMqttDevice::_mqttCountPublish(const char* topic, size_t length) {
+	JBWoprMqttTopicClass topicClass = _getTopicClass(_getTopicIndex(topic));
+	_mqttClassCounts[topicClass]++;
+	_mqttClassBytes[topicClass] += length;
+	_mqttPublishedCount++;
+}
+
+void JBWoprMqttDevice::_mqttPublishMetrics() {
+	char sendTime[11];
+	snprintf(sendTime, sizeof(sendTime), "%u", (uint32_t)millis());
+	mqttPublishEvent(_mqttEchoTopic.c_str(), sendTime);
+
+	JsonDocument jsonDoc;
+	mqttGetMetrics(jsonDoc);
+	mqttPublishMessage(_getTopic(MQTT_TOPIC_METRICS), jsonDoc);
+}
+
+void JBWoprMqttDevice::_mqttHandleEcho(const JBStringView& payload) {
+	if (_mqttSessionProbe) {
+		_log->debug("MQTT session resumed");
+		_mqttSessionProbe = false;
+		_mqttResumedCount++;
+	}
+	uint32_t roundTrip = millis() - payload.toUInt();
+	_mqttRoundTripHistogram.add(roundTrip);
+	_log->trace("MQTT round trip: %u ms", roundTrip);
+}
+
+void JBWoprMqttDevice::_setHistogramJson(JsonObject jsonObject, const JBHistogram& histogram) {
+	jsonObject["count"] = histogram.getCount();
+	jsonObject["avg"] = histogram.getAverage();
+	jsonObject["max"] = histogram.getMax();
+
+	// Trailing empty buckets are left out
+	uint8_t used = JBHistogram::BUCKET_COUNT;
+	while (used > 0 && histogram.getBucket(used - 1) == 0) {
+		used--;
+	}
+	JsonArray buckets = jsonObject["buckets"].to<JsonArray>();
+	for (uint8_t i = 0; i < used; i++) {
+		buckets.add(histogram.getBucket(i));
+	}
+}
+
+void JBWoprMqttDevice::mqttSetPublishInterval(JBWoprMqttTopic topic, uint16_t interval) {
+	if (topic < MQTT_TOPIC_COUNT) {
+		_mqttPublishIntervals[topic] = interval;
+	}
+}
+
+uint16_t JBWoprMqttDevice::mqttGetPublishInterval(JBWoprMqttTopic topic) const {
+	return topic < MQTT_TOPIC_COUNT ? _mqttPublishIntervals[topic] : 0;
+}
+
 // ====================================================================
 // Effects
 //
 void JBWoprMqttDevice::effectsStartCurrentEffect() {
 	JBWoprWiFiDevice::effectsStartCurrentEffect();
-	mqttPublishMessage(_getTopic(ENTITY_NAME_EFFECT, SUBENTITY_NAME_STATE), STATE_ON);
+	_mqttPublishState(MQTT_STATE_EFFECT, MQTT_TOPIC_EFFECT_STATE, STATE_ON);
 }
 
 void JBWoprMqttDevice::effectsStopCurrentEffect() {
 	JBWoprWiFiDevice::effectsStopCurrentEffect();
-	mqttPublishMessage(_getTopic(ENTITY_NAME_EFFECT, SUBENTITY_NAME_STATE), STATE_OFF);
+	_mqttPublishState(MQTT_STATE_EFFECT, MQTT_TOPIC_EFFECT_STATE, STATE_OFF);
 }
 
 void JBWoprMqttDevice::effectsStartEffect(JBWoprEffectBase *effect) {
-	JBWoprWiFiDevice::effectsStartEffect(effect);
-	mqttPublishMessage(_getTopic(ENTITY_NAME_EFFECT, SUBENTITY_NAME_NAME), effect->getName());
-	mqttPublishMessage(_getTopic(ENTITY_NAME_EFFECT, SUBENTITY_NAME_STATE), STATE_ON);
-}
-
-void JBWoprMqttDevice::effectsStartEffect(const std::string& effect) {
-	JBWoprWiFiDevice::effectsStartEffect(effect);
-	mqttPublishMessage(_getTopic(ENTITY_NAME_EFFECT, SUBENTITY_NAME_NAME), effect);
-	mqttPublishMessage(_getTopic(ENTITY_NAME_EFFECT, SUBENTITY_NAME_STATE), STATE_ON);
-}
-
-void JBWoprMqttDevice::effectsStartEffect(const char* effect) {
-	JBWoprWiFiDevice::effectsStartEffect(effect);
-	mqttPublishMessage(_getTopic(ENTITY_NAME_EFFECT, SUBENTITY_NAME_NAME), effect);
-	mqttPublishMessage(_getTopic(ENTITY_NAME_EFFECT, SUBENTITY_NAME_STATE), STATE_ON);
+	if (!_effectsStartEffect(effect)) {
+		// Blocked by a higher priority effect
+		return;
+	}
+	if (_mqttDeferState(MQTT_STATE_EFFECT | MQTT_STATE_EFFECT_NAME | MQTT_STATE_EFFECT_ID)) {
+		return;
+	}
+	mqttPublishMessage(_getTopic(MQTT_TOPIC_EFFECT_NAME), effect->getName());
+	if (effect->getId() != JBWOPR_EFFECT_ID_NONE) {
+		mqttPublishMessage(_getTopic(MQTT_TOPIC_EFFECT_ID), std::to_string(effect->getId()));
+	}
+	mqttPublishMessage(_getTopic(MQTT_TOPIC_EFFECT_STATE), STATE_ON);
 }
 
 // ====================================================================
@@ -152,22 +634,25 @@ void JBWoprMqttDevice::effectsStartEffect(const char* effect) {
 //
 void JBWoprMqttDevice::displaySetState(bool state) {
 	JBWoprWiFiDevice::displaySetState(state);
-	mqttPublishMessage(_getTopic(ENTITY_NAME_DISPLAY, SUBENTITY_NAME_STATE), state ? STATE_ON : STATE_OFF);
+	_mqttPublishState(MQTT_STATE_DISPLAY, MQTT_TOPIC_DISPLAY_STATE, state ? STATE_ON : STATE_OFF);
 }
 
 void JBWoprMqttDevice::displayClear() {
 	JBWoprWiFiDevice::displayClear();
-	mqttPublishMessage(_getTopic(ENTITY_NAME_DISPLAY, SUBENTITY_NAME_TEXT), "");
+	_mqttStateText.clear();
+	_mqttPublishState(MQTT_STATE_DISPLAY_TEXT, MQTT_TOPIC_DISPLAY_TEXT, "");
 }
 
 void JBWoprMqttDevice::displaySetBrightness(uint8_t val) {
 	JBWoprWiFiDevice::displaySetBrightness(val);
-	mqttPublishMessage(_getTopic(ENTITY_NAME_DISPLAY, SUBENTITY_NAME_BRIGHTNESS), std::to_string(val));
+	_mqttStateDisplayBrightness = val;
+	_mqttPublishState(MQTT_STATE_DISPLAY_BRIGHTNESS, MQTT_TOPIC_DISPLAY_BRIGHTNESS, std::to_string(val).c_str());
 }
 
 void JBWoprMqttDevice::displayShowText(const char* text, JBTextAlignment alignment) {
 	JBWoprDevice::displayShowText(text, alignment);
-	mqttPublishMessage(_getTopic(ENTITY_NAME_DISPLAY, SUBENTITY_NAME_TEXT), text);
+	_mqttStateText = text;
+	_mqttPublishState(MQTT_STATE_DISPLAY_TEXT, MQTT_TOPIC_DISPLAY_TEXT, text);
 }
 
 void JBWoprMqttDevice::displayShowText(const std::string& text, JBTextAlignment alignment) {
@@ -192,7 +677,8 @@ void JBWoprMqttDevice::displayShowText(const String& text) {
 
 void JBWoprMqttDevice::displayScrollText(const char* text, uint16_t delay_ms) {
 	JBWoprDevice::displayScrollText(text, delay_ms);
-	mqttPublishMessage(_getTopic(ENTITY_NAME_DISPLAY, SUBENTITY_NAME_SCROLLTEXT), text);
+	_mqttStateScrollText = text;
+	_mqttPublishState(MQTT_STATE_DISPLAY_SCROLLTEXT, MQTT_TOPIC_DISPLAY_SCROLLTEXT, text);
 }
 
 void JBWoprMqttDevice::displayScrollText(const std::string& text, uint16_t delay_ms) {
@@ -220,21 +706,22 @@ void JBWoprMqttDevice::displayScrollText(const String& text) {
 //
 void JBWoprMqttDevice::defconLedsSetState(bool state) {
 	JBWoprWiFiDevice::defconLedsSetState(state);
-	mqttPublishMessage(_getTopic(ENTITY_NAME_DEFCON, SUBENTITY_NAME_STATE), state ? STATE_ON : STATE_OFF);
+	_mqttPublishState(MQTT_STATE_DEFCON, MQTT_TOPIC_DEFCON_STATE, state ? STATE_ON : STATE_OFF);
 }
 
 void JBWoprMqttDevice::defconLedsSetDefconLevel(JBDefconLevel level) {
 	JBWoprWiFiDevice::defconLedsSetDefconLevel(level);
-	mqttPublishMessage(_getTopic(ENTITY_NAME_DEFCON, SUBENTITY_NAME_LEVEL), DEFCON_STRINGS[level]);
+	_mqttPublishState(MQTT_STATE_DEFCON_LEVEL, MQTT_TOPIC_DEFCON_LEVEL, DEFCON_STRINGS[level]);
 }
 void JBWoprMqttDevice::defconLedsSetColor(uint32_t color) {
 	JBWoprWiFiDevice::defconLedsSetColor(color);
-	mqttPublishMessage(_getTopic(ENTITY_NAME_DEFCON, SUBENTITY_NAME_COLOR), JBStringHelper::rgbToString(color));
+	_mqttPublishState(MQTT_STATE_DEFCON_COLOR, MQTT_TOPIC_DEFCON_COLOR, JBStringHelper::rgbToString(color).c_str());
 }
 
 void JBWoprMqttDevice::defconLedsSetBrightness(uint8_t brightness) {
 	JBWoprWiFiDevice::defconLedsSetBrightness(brightness);
-	mqttPublishMessage(_getTopic(ENTITY_NAME_DEFCON, SUBENTITY_NAME_BRIGHTNESS), std::to_string(brightness));
+	_mqttStateDefconBrightness = brightness;
+	_mqttPublishState(MQTT_STATE_DEFCON_BRIGHTNESS, MQTT_TOPIC_DEFCON_BRIGHTNESS, std::to_string(brightness).c_str());
 }
 
 void JBWoprMqttDevice::defconLedSetColor(JBDefconLevel level, uint32_t color) {
@@ -264,6 +751,27 @@ void JBWoprMqttDevice::_setConfigFromJsonDocument(const JsonDocument &jsonDoc) {
 	if (!jsonDoc[JSON_KEY_CONF_MQTT_PREFIX].isNull()) {
 		_mqttConfig.mqttPrefix = jsonDoc[JSON_KEY_CONF_MQTT_PREFIX].as<std::string>();
 	}
+	if (!jsonDoc[JSON_KEY_MQTT_STATE_DOCUMENT].isNull()) {
+		_mqttConfig.useStateDocument = jsonDoc[JSON_KEY_MQTT_STATE_DOCUMENT].as<bool>();
+	}
+	if (!jsonDoc[JSON_KEY_MQTT_BINARY].isNull()) {
+		_mqttConfig.useBinary = jsonDoc[JSON_KEY_MQTT_BINARY].as<bool>();
+	}
+	if (!jsonDoc[JSON_KEY_MQTT_METRICS_INTERVAL].isNull()) {
+		_mqttConfig.metricsInterval = jsonDoc[JSON_KEY_MQTT_METRICS_INTERVAL].as<uint16_t>();
+	}
+	if (!jsonDoc[JSON_KEY_MQTT_PERSISTENT_SESSION].isNull()) {
+		_mqttConfig.persistentSession = jsonDoc[JSON_KEY_MQTT_PERSISTENT_SESSION].as<bool>();
+	}
+	if (!jsonDoc[JSON_KEY_MQTT_BROADCAST].isNull()) {
+		_mqttConfig.useBroadcast = jsonDoc[JSON_KEY_MQTT_BROADCAST].as<bool>();
+	}
+	if (!jsonDoc[JSON_KEY_MQTT_GROUPS].isNull()) {
+		_mqttConfig.mqttGroups = jsonDoc[JSON_KEY_MQTT_GROUPS].as<std::string>();
+	}
+	if (!jsonDoc[JSON_KEY_MQTT_TLS].isNull()) {
+		_mqttConfig.useTls = jsonDoc[JSON_KEY_MQTT_TLS].as<bool>();
+	}
 }
 
 void JBWoprMqttDevice::_setJsonDocumentFromConfig(JsonDocument &jsonDoc) {
@@ -274,6 +782,13 @@ void JBWoprMqttDevice::_setJsonDocumentFromConfig(JsonDocument &jsonDoc) {
 	jsonDoc[JSON_KEY_MQTT_USER_NAME] = _mqttConfig.mqttUserName;
 	jsonDoc[JSON_KEY_MQTT_PASSWORD] = _mqttConfig.mqttPassword;
 	jsonDoc[JSON_KEY_CONF_MQTT_PREFIX] = _mqttConfig.mqttPrefix;
+	jsonDoc[JSON_KEY_MQTT_STATE_DOCUMENT] = _mqttConfig.useStateDocument;
+	jsonDoc[JSON_KEY_MQTT_BINARY] = _mqttConfig.useBinary;
+	jsonDoc[JSON_KEY_MQTT_METRICS_INTERVAL] = _mqttConfig.metricsInterval;
+	jsonDoc[JSON_KEY_MQTT_PERSISTENT_SESSION] = _mqttConfig.persistentSession;
+	jsonDoc[JSON_KEY_MQTT_BROADCAST] = _mqttConfig.useBroadcast;
+	jsonDoc[JSON_KEY_MQTT_GROUPS] = _mqttConfig.mqttGroups;
+	jsonDoc[JSON_KEY_MQTT_TLS] = _mqttConfig.useTls;
 }
 
 void JBWoprMqttDevice::_dumpConfig() {
@@ -285,6 +800,13 @@ void JBWoprMqttDevice::_dumpConfig() {
 	_log->trace("  MQTT user name: %s", _mqttConfig.mqttUserName.c_str());
 	_log->trace("  MQTT password: ----------");
 	_log->trace("  MQTT prefix: %s", _mqttConfig.mqttPrefix.c_str());
+	_log->trace("  MQTT state document: %s", _mqttConfig.useStateDocument ? "True" : "False");
+	_log->trace("  MQTT binary topics: %s", _mqttConfig.useBinary ? "True" : "False");
+	_log->trace("  MQTT metrics interval: %u", _mqttConfig.metricsInterval);
+	_log->trace("  MQTT persistent session: %s", _mqttConfig.persistentSession ? "True" : "False");
+	_log->trace("  MQTT broadcast: %s", _mqttConfig.useBroadcast ? "True" : "False");
+	_log->trace("  MQTT groups: %s", _mqttConfig.mqttGroups.c_str());
+	_log->trace("  MQTT TLS: %s", _mqttConfig.useTls ? "True" : "False");
 }
 
 // ====================================================================
@@ -295,6 +817,7 @@ void JBWoprMqttDevice::_setupWiFiManager(){
 
 	auto wifiManager = _getWiFiManager();
 	snprintf(_mqttServerPortValue, sizeof(_mqttServerPortValue), "%u", _mqttConfig.mqttServerPort);
+	snprintf(_mqttMetricsIntervalValue, sizeof(_mqttMetricsIntervalValue), "%u", _mqttConfig.metricsInterval);
 
 	_mqttTitleParam = new WiFiManagerParameter(HTML_MQTT_TITLE);
 	_break2Param = new WiFiManagerParameter("<br/>");
@@ -304,6 +827,13 @@ void JBWoprMqttDevice::_setupWiFiManager(){
 	_mqttUserNameParam = new WiFiManagerParameter(JSON_KEY_MQTT_USER_NAME, "MQTT user name", _mqttConfig.mqttUserName.c_str(), 40);
 	_mqttPasswordParam = new WiFiManagerParameter(JSON_KEY_MQTT_PASSWORD, "MQTT password", _mqttConfig.mqttPassword.c_str(), 40);
 	_mqttPrefixParam = new WiFiManagerParameter(JSON_KEY_CONF_MQTT_PREFIX, "MQTT prefix", _mqttConfig.mqttPrefix.c_str(), 40);
+	_mqttTlsParam = new WiFiManagerParameter(JSON_KEY_MQTT_TLS, "Use TLS", "T", 2, _mqttConfig.useTls ? HTML_CHECKBOX_TRUE : HTML_CHECKBOX_FALSE, WFM_LABEL_AFTER);
+	_mqttStateDocumentParam = new WiFiManagerParameter(JSON_KEY_MQTT_STATE_DOCUMENT, "Publish state as one JSON document", "T", 2, _mqttConfig.useStateDocument ? HTML_CHECKBOX_TRUE : HTML_CHECKBOX_FALSE, WFM_LABEL_AFTER);
+	_mqttBinaryParam = new WiFiManagerParameter(JSON_KEY_MQTT_BINARY, "Use MessagePack topics", "T", 2, _mqttConfig.useBinary ? HTML_CHECKBOX_TRUE : HTML_CHECKBOX_FALSE, WFM_LABEL_AFTER);
+	_mqttPersistentSessionParam = new WiFiManagerParameter(JSON_KEY_MQTT_PERSISTENT_SESSION, "Use persistent MQTT session", "T", 2, _mqttConfig.persistentSession ? HTML_CHECKBOX_TRUE : HTML_CHECKBOX_FALSE, WFM_LABEL_AFTER);
+	_mqttBroadcastParam = new WiFiManagerParameter(JSON_KEY_MQTT_BROADCAST, "Accept broadcast commands", "T", 2, _mqttConfig.useBroadcast ? HTML_CHECKBOX_TRUE : HTML_CHECKBOX_FALSE, WFM_LABEL_AFTER);
+	_mqttGroupsParam = new WiFiManagerParameter(JSON_KEY_MQTT_GROUPS, "MQTT groups (comma separated)", _mqttConfig.mqttGroups.c_str(), 64);
+	_mqttMetricsIntervalParam = new WiFiManagerParameter(JSON_KEY_MQTT_METRICS_INTERVAL, "MQTT metrics interval (seconds, 0 = off)", _mqttMetricsIntervalValue, 5);
 
 	wifiManager->addParameter(_mqttTitleParam);
 	wifiManager->addParameter(_useMqttParam);
@@ -313,22 +843,32 @@ void JBWoprMqttDevice::_setupWiFiManager(){
 	wifiManager->addParameter(_mqttUserNameParam);
 	wifiManager->addParameter(_mqttPasswordParam);
 	wifiManager->addParameter(_mqttPrefixParam);
-
-	wifiManager->setSaveParamsCallback(std::bind(&JBWoprMqttDevice::_saveParamsCallback, this));
+	wifiManager->addParameter(_mqttTlsParam);
+	wifiManager->addParameter(_mqttStateDocumentParam);
+	wifiManager->addParameter(_mqttBinaryParam);
+	wifiManager->addParameter(_mqttPersistentSessionParam);
+	wifiManager->addParameter(_mqttBroadcastParam);
+	wifiManager->addParameter(_mqttGroupsParam);
+	wifiManager->addParameter(_mqttMetricsIntervalParam);
 }
 
-void JBWoprMqttDevice::_saveParamsCallback() {
-	JBWoprWiFiDevice::_saveParamsCallback();
-
-	_mqttConfig.useMqtt = strncmp(_useMqttParam->getValue(), "T", 1) == 0;
-	_mqttConfig.mqttServerName = std::string(_mqttServerNameParam->getValue());
-	if (_mqttConfig.mqttServerName.length() == 0) {
-		_mqttConfig.useMqtt = false;
-	}
-	_mqttConfig.mqttServerPort = atoi(_mqttServerPortParam->getValue());
-	_mqttConfig.mqttUserName = std::string(_mqttUserNameParam->getValue());
-	_mqttConfig.mqttPassword = std::string(_mqttPasswordParam->getValue());
-	_mqttConfig.mqttPrefix = std::string(_mqttPrefixParam->getValue());
+void JBWoprMqttDevice::_setJsonDocumentFromParams(JsonDocument &jsonDoc) {
+	JBWoprWiFiDevice::_setJsonDocumentFromParams(jsonDoc);
+
+	const char* serverName = _mqttServerNameParam->getValue();
+	jsonDoc[JSON_KEY_MQTT_USE_MQTT] = strncmp(_useMqttParam->getValue(), "T", 1) == 0 && *serverName != 0;
+	jsonDoc[JSON_KEY_MQTT_SERVER_NAME] = serverName;
+	jsonDoc[JSON_KEY_MQTT_SERVER_PORT] = atoi(_mqttServerPortParam->getValue());
+	jsonDoc[JSON_KEY_MQTT_USER_NAME] = _mqttUserNameParam->getValue();
+	jsonDoc[JSON_KEY_MQTT_PASSWORD] = _mqttPasswordParam->getValue();
+	jsonDoc[JSON_KEY_CONF_MQTT_PREFIX] = _mqttPrefixParam->getValue();
+	jsonDoc[JSON_KEY_MQTT_STATE_DOCUMENT] = strncmp(_mqttStateDocumentParam->getValue(), "T", 1) == 0;
+	jsonDoc[JSON_KEY_MQTT_BINARY] = strncmp(_mqttBinaryParam->getValue(), "T", 1) == 0;
+	jsonDoc[JSON_KEY_MQTT_METRICS_INTERVAL] = atoi(_mqttMetricsIntervalParam->getValue());
+	jsonDoc[JSON_KEY_MQTT_PERSISTENT_SESSION] = strncmp(_mqttPersistentSessionParam->getValue(), "T", 1) == 0;
+	jsonDoc[JSON_KEY_MQTT_BROADCAST] = strncmp(_mqttBroadcastParam->getValue(), "T", 1) == 0;
+	jsonDoc[JSON_KEY_MQTT_GROUPS] = _mqttGroupsParam->getValue();
+	jsonDoc[JSON_KEY_MQTT_TLS] = strncmp(_mqttTlsParam->getValue(), "T", 1) == 0;
 }
 
 // ====================================================================
@@ -345,10 +885,10 @@ bool JBWoprMqttDevice::_mqttStart() {
 		return false;
 	}
 
+	_mqttBuildTopics();
 	_mqttClient = new PubSubClient(_mqttConfig.mqttServerName.c_str(),
 								   _mqttConfig.mqttServerPort,
-								   _wifiClient);
-	_mqttActive = true;
+								   _mqttConfig.useTls ? _wifiClientSecure : _wifiClient);
 
 	_log->trace("Starting MQTT, %s:%i", _mqttConfig.mqttServerName.c_str(), _mqttConfig.mqttServerPort);
 	if (!_mqttClient->setBufferSize(1024))
@@ -356,63 +896,336 @@ bool JBWoprMqttDevice::_mqttStart() {
 		_log->error("Failed to set MQTT buffer size");
 		return false;
 	}
-	_mqttClient->setSocketTimeout(30);
+	_mqttClient->setSocketTimeout(JBWOPR_MQTT_SOCKET_TIMEOUT);
 	_mqttClient->setCallback(std::bind(&JBWoprMqttDevice::_mqttCallback, this, std::placeholders::_1, std::placeholders::_2, std::placeholders::_3));
 
-	if (!_mqttReconnect()) {
-		return false;
+	// Failed attempts are retried from _networkLoop()
+	_mqttRandom.setSeed(effectsGetRandom().next());
+	_mqttRetryDelay = 0;
+	_mqttRetryTime = millis();
+	_mqttActive = true;
+	if (_networkTask == nullptr) {
+		_mqttReconnect();
 	}
 
 	return true;
 }
 
+void JBWoprMqttDevice::_mqttBuildTopics() {
+	// In JBWoprMqttTopic order
+	const char* topics[MQTT_TOPIC_COUNT][2] = {
+		{ ENTITY_NAME_AVAILABILITY, nullptr },
+		{ ENTITY_NAME_SUBSCRIPTION, nullptr },
+		{ ENTITY_NAME_CONFIG, SUBENTITY_NAME_STATE },
+		{ ENTITY_NAME_DIAGNOSTIC, SUBENTITY_NAME_STATE },
+		{ ENTITY_NAME_EFFECT, SUBENTITY_NAME_STATE },
+		{ ENTITY_NAME_EFFECT, SUBENTITY_NAME_NAME },
+		{ ENTITY_NAME_EFFECT, SUBENTITY_NAME_ID },
+		{ ENTITY_NAME_PLAYLIST, SUBENTITY_NAME_STATE },
+		{ ENTITY_NAME_PLAYLIST, SUBENTITY_NAME_CONFIG },
+		{ ENTITY_NAME_DISPLAY, SUBENTITY_NAME_STATE },
+		{ ENTITY_NAME_DISPLAY, SUBENTITY_NAME_TEXT },
+		{ ENTITY_NAME_DISPLAY, SUBENTITY_NAME_SCROLLTEXT },
+		{ ENTITY_NAME_DISPLAY, SUBENTITY_NAME_BRIGHTNESS },
+		{ ENTITY_NAME_DEFCON, SUBENTITY_NAME_STATE },
+		{ ENTITY_NAME_DEFCON, SUBENTITY_NAME_LEVEL },
+		{ ENTITY_NAME_DEFCON, SUBENTITY_NAME_COLOR },
+		{ ENTITY_NAME_DEFCON, SUBENTITY_NAME_BRIGHTNESS },
+		{ ENTITY_NAME_BUTTON_FRONT_LEFT, SUBENTITY_NAME_EVENT },
+		{ ENTITY_NAME_BUTTON_FRONT_RIGHT, SUBENTITY_NAME_EVENT },
+		{ ENTITY_NAME_BUTTON_BACK_TOP, SUBENTITY_NAME_EVENT },
+		{ ENTITY_NAME_BUTTON_BACK_BOTTOM, SUBENTITY_NAME_EVENT },
+		{ ENTITY_NAME_STATE, nullptr },
+		{ ENTITY_NAME_BINARY, SUBENTITY_NAME_STATE },
+		{ ENTITY_NAME_DIAGNOSTIC, SUBENTITY_NAME_METRICS },
+		{ ENTITY_NAME_RULES, SUBENTITY_NAME_CONFIG },
+		{ ENTITY_NAME_BINDINGS, SUBENTITY_NAME_CONFIG }
+	};
+
+	_mqttTopicBase = _mqttConfig.mqttPrefix + "/" + _getDeviceName() + "/";
+	_mqttTopics.clear();
+	for (uint8_t i = 0; i < MQTT_TOPIC_COUNT; i++) {
+		_mqttTopicOffsets[i] = _mqttTopics.size();
+		_mqttTopics += _mqttTopicBase;
+		_mqttTopics += topics[i][0];
+		if (topics[i][1] != nullptr) {
+			_mqttTopics += "/";
+			_mqttTopics += topics[i][1];
+		}
+		_mqttTopics += '\0';
+	}
+	_mqttEchoTopic = _getTopic(ENTITY_NAME_DIAGNOSTIC, SUBENTITY_NAME_ECHO, COMMAND_SET);
+
+	_mqttGroupTopicBases.clear();
+	if (_mqttConfig.useBroadcast) {
+		_mqttGroupTopicBases.push_back(_mqttConfig.mqttPrefix + "/" + GROUP_NAME_ALL + "/");
+	}
+	size_t start = 0;
+	while (start <= _mqttConfig.mqttGroups.size()) {
+		size_t end = _mqttConfig.mqttGroups.find(',', start);
+		if (end == std::string::npos) {
+			end = _mqttConfig.mqttGroups.size();
+		}
+		std::string name = _mqttConfig.mqttGroups.substr(start, end - start);
+		name.erase(0, name.find_first_not_of(' '));
+		name.erase(name.find_last_not_of(' ') + 1);
+		if (name.find_first_of("/+#") != std::string::npos) {
+			_log->error("Invalid MQTT group name: %s", name.c_str());
+		} else if (!name.empty()) {
+			_mqttGroupTopicBases.push_back(_mqttConfig.mqttPrefix + "/" + GROUP_NAME_GROUP + "/" + name + "/");
+		}
+		start = end + 1;
+	}
+	_log->trace("MQTT topic table built, %u bytes", _mqttTopics.size());
+
+	// In JBWoprMqttCommand order
+	const char* commands[MQTT_COMMAND_COUNT][2] = {
+		{ ENTITY_NAME_DEVICE, SUBENTITY_NAME_STATE },
+		{ ENTITY_NAME_CONFIG, SUBENTITY_NAME_TIME_FORMAT },
+		{ ENTITY_NAME_CONFIG, SUBENTITY_NAME_DATE_FORMAT },
+		{ ENTITY_NAME_CONFIG, SUBENTITY_NAME_DISPLAY_BRIGHTNESS },
+		{ ENTITY_NAME_CONFIG, SUBENTITY_NAME_DEFCON_BRIGHTNESS },
+		{ ENTITY_NAME_CONFIG, SUBENTITY_NAME_EFFECTS_TIMEOUT },
+		{ ENTITY_NAME_CONFIG, SUBENTITY_NAME_EFFECTS_SPEED },
+		{ ENTITY_NAME_CONFIG, SUBENTITY_NAME_WIFI_USE_WEB_PORTAL },
+		{ ENTITY_NAME_EFFECT, SUBENTITY_NAME_STATE },
+		{ ENTITY_NAME_EFFECT, SUBENTITY_NAME_NAME },
+		{ ENTITY_NAME_EFFECT, SUBENTITY_NAME_ID },
+		{ ENTITY_NAME_EFFECT, SUBENTITY_NAME_SCRIPT },
+		{ ENTITY_NAME_PLAYLIST, SUBENTITY_NAME_STATE },
+		{ ENTITY_NAME_PLAYLIST, SUBENTITY_NAME_CONFIG },
+		{ ENTITY_NAME_DISPLAY, SUBENTITY_NAME_STATE },
+		{ ENTITY_NAME_DISPLAY, SUBENTITY_NAME_TEXT },
+		{ ENTITY_NAME_DISPLAY, SUBENTITY_NAME_SCROLLTEXT },
+		{ ENTITY_NAME_DISPLAY, SUBENTITY_NAME_BRIGHTNESS },
+		{ ENTITY_NAME_DEFCON, SUBENTITY_NAME_STATE },
+		{ ENTITY_NAME_DEFCON, SUBENTITY_NAME_LEVEL },
+		{ ENTITY_NAME_DEFCON, SUBENTITY_NAME_COLOR },
+		{ ENTITY_NAME_DEFCON, SUBENTITY_NAME_BRIGHTNESS },
+		{ ENTITY_NAME_COMMAND, SUBENTITY_NAME_BATCH },
+		{ ENTITY_NAME_BINARY, SUBENTITY_NAME_COMMAND },
+		{ ENTITY_NAME_DIAGNOSTIC, SUBENTITY_NAME_ECHO },
+		{ ENTITY_NAME_RULES, SUBENTITY_NAME_CONFIG },
+		{ ENTITY_NAME_BINDINGS, SUBENTITY_NAME_CONFIG }
+	};
+
+	for (uint8_t i = 0; i < MQTT_COMMAND_COUNT; i++) {
+		std::string topic = std::string(commands[i][0]) + "/" + commands[i][1] + "/" + COMMAND_SET;
+		_mqttCommands[i] = { JBStringHelper::hash(topic.c_str()), commands[i][0], commands[i][1], (JBWoprMqttCommand)i };
+		_mqttCommandHashes[i] = _mqttCommands[i].hash;
+	}
+	std::sort(_mqttCommands, _mqttCommands + MQTT_COMMAND_COUNT, [](const MqttCommandEntry& a, const MqttCommandEntry& b) {
+		return a.hash < b.hash;
+	});
+	for (uint8_t i = 1; i < MQTT_COMMAND_COUNT; i++) {
+		if (_mqttCommands[i].hash == _mqttCommands[i - 1].hash) {
+			_log->error("MQTT command hash collision: %s/%s", _mqttCommands[i].entity, _mqttCommands[i].subEntity);
+		}
+	}
+}
+
+bool JBWoprMqttDevice::_mqttLoadTlsCredentials() {
+	// No CA means no server verification, so TLS is not used without one
+	if (!_readFile(TLS_CA_FILE_NAME, _tlsCaCert)) {
+		_log->error("TLS CA certificate not found: %s", TLS_CA_FILE_NAME);
+		return false;
+	}
+	_wifiClientSecure.setCACert(_tlsCaCert.c_str());
+	if (_readFile(TLS_CERT_FILE_NAME, _tlsClientCert) && _readFile(TLS_KEY_FILE_NAME, _tlsClientKey)) {
+		_log->debug("Using TLS client certificate");
+		_wifiClientSecure.setCertificate(_tlsClientCert.c_str());
+		_wifiClientSecure.setPrivateKey(_tlsClientKey.c_str());
+	}
+	_wifiClientSecure.setHandshakeTimeout(JBWOPR_MQTT_HANDSHAKE_TIMEOUT);
+	return true;
+}
+
+bool JBWoprMqttDevice::_readFile(const char* fileName, std::string& content) {
+	File file = LittleFS.open(fileName, "r");
+	if (!file) {
+		return false;
+	}
+	content.resize(file.size());
+	size_t length = file.readBytes(&content[0], content.size());
+	file.close();
+	content.resize(length);
+	return length > 0;
+}
+
 void JBWoprMqttDevice::_mqttStop() {
 	if (_mqttClient->connected()) {
 		_mqttClient->disconnect();
 	}
+	_mqttHasSession = false;
 	_log->debug("Disconnected from MQTT server");
 }
 
 bool JBWoprMqttDevice::_mqttReconnect() {
-	const int maxRetries = 3;
-
 	if (_mqttClient->connected()) {
 		return true;
 	}
+	if (_mqttConnected) {
+		_mqttConnected = false;
+		_mqttDisconnectCount++;
+		_mqttDisconnectTime = millis();
+		_mqttSessionProbe = false;
+		_log->warning("Lost connection to MQTT server, error %i", _mqttClient->state());
+		_mqttRetryDelay = 0;
+		_mqttScheduleReconnect();
+		return false;
+	}
+	if ((int32_t)(millis() - _mqttRetryTime) < 0 || WiFi.status() != WL_CONNECTED) {
+		return false;
+	}
 
-	_log->debug("Connecting to MQTT server: %s:%i", _mqttConfig.mqttServerName.c_str(), _mqttConfig.mqttServerPort);
+	if (!_mqttConnect()) {
+		_mqttConnectFailedCount++;
+		_mqttScheduleReconnect();
+		return false;
+	}
+	if (_mqttDisconnectCount > 0) {
+		_mqttReconnectHistogram.add(millis() - _mqttDisconnectTime);
+	}
+	_mqttConnectCount++;
+	_mqttRetryDelay = 0;
+	_mqttFailedAttempts = 0;
+	_mqttConnected = true;
+	// The client ID is the host name, so the broker finds the session from the previous connection
+	_mqttSessionResumed = _mqttConfig.persistentSession && _mqttHasSession;
+	_log->debug("Connected to MQTT server");
+	_mqttStartSession();
+	return true;
+}
 
-	for (int retry = 0; retry < maxRetries; ++retry) {
-		if (!_mqttClient->connect(_getDeviceName().c_str(),
-								  _mqttConfig.mqttUserName.c_str(),
-								  _mqttConfig.mqttPassword.c_str(),
-								  _getAvailabilityTopic().c_str(),
-								  1,
-								  true,
-								  "offline")) {
-			_log->error("Failed to connect to MQTT server, error %i", _mqttClient->state());
-			delay(500);
-		} else {
-			if (!_onMqttConnect()) {
-				return false;
-			}
-			break;
+void JBWoprMqttDevice::_mqttStartSession() {
+	_mqttReconnectBytes = _mqttGetPublishedBytes();
+	_mqttReconnectMeasuring = true;
+	_mqttDirectPublish = true;
+	if (!_onMqttConnect()) {
+		_log->error("Failed to initialize MQTT connection");
+	}
+	_mqttDirectPublish = false;
+}
+
+uint32_t JBWoprMqttDevice::_mqttGetPublishedBytes() const {
+	uint32_t bytes = 0;
+	for (uint8_t i = 0; i < MQTT_CLASS_COUNT; i++) {
+		bytes += _mqttClassBytes[i];
+	}
+	return bytes;
+}
+
+bool JBWoprMqttDevice::_mqttConnect() {
+	// Resolve once and keep the address, a failing DNS lookup can take seconds.
+	// TLS connects by name instead, see below.
+	if (!_mqttConfig.useTls && (!_mqttServerResolved || _mqttFailedAttempts >= JBWOPR_MQTT_RESOLVE_ATTEMPTS)) {
+		_mqttFailedAttempts = 0;
+		if (!WiFi.hostByName(_mqttConfig.mqttServerName.c_str(), _mqttServerAddress)) {
+			_log->error("Failed to resolve MQTT server: %s", _mqttConfig.mqttServerName.c_str());
+			_mqttServerResolved = false;
+			return false;
 		}
+		_mqttServerResolved = true;
+		_mqttClient->setServer(_mqttServerAddress, _mqttConfig.mqttServerPort);
 	}
 
-	_mqttActive = true;
-	_log->debug("Connected to MQTT server");
+	_log->debug("Connecting to MQTT server: %s:%i", _mqttConfig.mqttServerName.c_str(), _mqttConfig.mqttServerPort);
+
+	// Loaded once, TLS can also be turned on in the web portal after start
+	if (_mqttConfig.useTls && _tlsCaCert.empty() && !_mqttLoadTlsCredentials()) {
+		return false;
+	}
+
+	// Connect the socket with a short timeout, PubSubClient uses an open socket as is
+	WiFiClient& netClient = _mqttConfig.useTls ? _wifiClientSecure : _wifiClient;
+	_mqttClient->setClient(netClient);
+	uint32_t connectStart = millis();
+	bool connected;
+	if (_mqttConfig.useTls) {
+		// By name, so SNI is sent and the certificate is checked against the server name
+		_mqttClient->setServer(_mqttConfig.mqttServerName.c_str(), _mqttConfig.mqttServerPort);
+		connected = _wifiClientSecure.connect(_mqttConfig.mqttServerName.c_str(), _mqttConfig.mqttServerPort, JBWOPR_MQTT_CONNECT_TIMEOUT);
+	} else {
+		connected = _wifiClient.connect(_mqttServerAddress, _mqttConfig.mqttServerPort, JBWOPR_MQTT_CONNECT_TIMEOUT);
+	}
+	if (!connected) {
+		_log->error("Failed to connect to MQTT server");
+		_mqttFailedAttempts++;
+		return false;
+	}
+	uint32_t handshakeTime = millis() - connectStart;
+	_mqttHandshakeHistogram.add(handshakeTime);
+	_log->debug("Connected to %s:%i in %u ms%s", _mqttConfig.mqttServerName.c_str(), _mqttConfig.mqttServerPort,
+				handshakeTime, _mqttConfig.useTls ? ", TLS" : "");
+	if (!_mqttClient->connect(_getDeviceName().c_str(),
+							  _mqttConfig.mqttUserName.c_str(),
+							  _mqttConfig.mqttPassword.c_str(),
+							  _getAvailabilityTopic(),
+							  1,
+							  true,
+							  "offline",
+							  !_mqttConfig.persistentSession)) {
+		_log->error("Failed to connect to MQTT server, error %i", _mqttClient->state());
+		netClient.stop();
+		_mqttFailedAttempts++;
+		return false;
+	}
 	return true;
 }
 
+void JBWoprMqttDevice::_mqttScheduleReconnect() {
+	if (_mqttRetryDelay == 0) {
+		_mqttRetryDelay = JBWOPR_MQTT_RETRY_MIN;
+	} else {
+		_mqttRetryDelay = std::min<uint32_t>(_mqttRetryDelay * 2, JBWOPR_MQTT_RETRY_MAX);
+	}
+	// 75% to 125% of the delay
+	uint32_t wait = _mqttRetryDelay - _mqttRetryDelay / 4 + _mqttRandom.next(_mqttRetryDelay / 2);
+	_mqttRetryTime = millis() + wait;
+	_log->debug("Next MQTT connection attempt in %u ms", wait);
+}
+
 bool JBWoprMqttDevice::_onMqttConnect() {
-	std::string subscribeTopic = _getSubscriptionTopic();
-	_log->debug("Subscribing to MQTT topic: %s", subscribeTopic.c_str());
-	if (!_mqttClient->subscribe(subscribeTopic.c_str())) {
-		_log->error("Failed to subscribe to MQTT topic, error: %i", _mqttClient->state());
-		return false;
+	if (_mqttSessionResumed) {
+		// Subscription and retained state are kept, the publish cache then only lets
+		// changed state through. The echo confirms that the broker kept the session.
+		_mqttSessionProbe = true;
+		_mqttSessionProbeTime = millis();
+		mqttPublishEvent(_mqttEchoTopic.c_str(), std::to_string(millis()).c_str());
+	} else {
+		// The broker may have lost state while disconnected, so publish everything again
+		mqttClearPublishCache();
+
+		std::string subscribeTopic = _getSubscriptionTopic();
+		_log->debug("Subscribing to MQTT topic: %s", subscribeTopic.c_str());
+		// QoS 1, so a persistent session keeps commands sent while offline
+		if (!_mqttClient->subscribe(subscribeTopic.c_str(), _mqttConfig.persistentSession ? 1 : 0)) {
+			_log->error("Failed to subscribe to MQTT topic, error: %i", _mqttClient->state());
+			return false;
+		}
+		for (const auto& base : _mqttGroupTopicBases) {
+			subscribeTopic = base + ENTITY_NAME_SUBSCRIPTION;
+			_log->debug("Subscribing to MQTT topic: %s", subscribeTopic.c_str());
+			if (!_mqttClient->subscribe(subscribeTopic.c_str(), _mqttConfig.persistentSession ? 1 : 0)) {
+				_log->error("Failed to subscribe to MQTT topic, error: %i", _mqttClient->state());
+				return false;
+			}
+		}
+		// A new session has no subscriptions
+		_mqttBindingTopics.clear();
+		_mqttSubscribeBindings();
+		_mqttHasSession = _mqttConfig.persistentSession;
+		if (_mqttConfig.useStateDocument) {
+			// Sent from loop(), which owns the state
+			_mqttStateChanges |= MQTT_STATE_ALL;
+		}
+		if (_mqttConfig.useBinary) {
+			_mqttBinaryChanges |= MQTT_STATE_ALL;
+		}
 	}
-	mqttPublishMessage(_getAvailabilityTopic().c_str(), "online");
+	// The broker has published the last will, so this is never in the cache
+	_mqttPublishCache.erase(JBStringHelper::hash(_getAvailabilityTopic()));
+	mqttPublishMessage(_getAvailabilityTopic(), "online");
 	return true;
 }
 
@@ -420,229 +1233,751 @@ void JBWoprMqttDevice::_mqttCallback(const char* topic, const byte* payload, uns
 	_log->trace("MQTT < Topic: %s", topic);
 	_log->traceAsciiDump(payload, length);
 
-	std::string entity;
-	std::string subEntity;
-	std::string command;
-	std::string payloadStr(reinterpret_cast<const char*>(payload), length);
+	// <mqttprefix>/<deviceid>/<entity>/<subentity>/<command>, matched in place
+	bool isGroup = false;
+	const char* commandTopic = _getCommandTopic(topic, isGroup);
+	if (commandTopic == nullptr) {
+		int8_t binding = _bindings.find(topic);
+		if (binding >= 0) {
+			_mqttHandleBinding(binding, payload, length);
+			return;
+		}
+		_log->error("Unsupported topic: %s", topic);
+		return;
+	}
+	JBWoprMqttCommand command = _findCommand(commandTopic);
+	if (command == MQTT_COMMAND_COUNT || (isGroup && command == MQTT_COMMAND_DIAGNOSTIC_ECHO)) {
+		_log->error("Unsupported command: %s", topic);
+		return;
+	}
+	JBStringView view { reinterpret_cast<const char*>(payload), length };
+	if (command == MQTT_COMMAND_DIAGNOSTIC_ECHO) {
+		// Measured here, so the time loop() takes is not included
+		_mqttHandleEcho(view);
+		return;
+	}
+	if (command == MQTT_COMMAND_BINDINGS_CONFIG) {
+		_handleBindingsCommand(view);
+		return;
+	}
+	uint32_t receiveTime = micros();
+	if (_isNetworkTask()) {
+		// The payload is only valid during the callback, so it is copied for loop()
+		MqttCommandMessage message { command, view.toString(), receiveTime };
+		if (!_mqttCommandQueue.push(message)) {
+			_log->warning("MQTT command queue full, dropping %s", topic);
+		}
+		return;
+	}
+	_handleCommand(command, view);
+	_mqttCommandHistogram.add(micros() - receiveTime);
+}
 
-	std::stringstream ss(topic);
-	std::string part;
+JBWoprMqttCommand JBWoprMqttDevice::_findCommand(const char* topic) const {
+	uint32_t hash = JBStringHelper::hash(topic);
+	const MqttCommandEntry* end = _mqttCommands + MQTT_COMMAND_COUNT;
+	const MqttCommandEntry* entry = std::lower_bound(_mqttCommands, end, hash,
+		[](const MqttCommandEntry& item, uint32_t value) {
+			return item.hash < value;
+		});
+	if (entry == end || entry->hash != hash) {
+		return MQTT_COMMAND_COUNT;
+	}
 
-	int i = 0;
-	while (std::getline(ss, part, '/'))
-	{
-		switch (i) {
-			case 2:
-				entity = part;
-				break;
-			case 3:
-				subEntity = part;
-				break;
-			case 4:
-				command = part;
-				break;
-		}
-		i++;
+	// Check the name as well, so an unknown topic with the same hash is not accepted
+	size_t entityLength = strlen(entry->entity);
+	size_t subEntityLength = strlen(entry->subEntity);
+	const char* part = topic;
+	if (strncmp(part, entry->entity, entityLength) != 0 || part[entityLength] != '/') {
+		return MQTT_COMMAND_COUNT;
+	}
+	part += entityLength + 1;
+	if (strncmp(part, entry->subEntity, subEntityLength) != 0 || part[subEntityLength] != '/') {
+		return MQTT_COMMAND_COUNT;
 	}
-	_handleCommand(entity, subEntity, command, payloadStr);
+	part += subEntityLength + 1;
+	if (strcmp(part, COMMAND_SET) != 0) {
+		return MQTT_COMMAND_COUNT;
+	}
+	return entry->command;
 }
 
-void JBWoprMqttDevice::_handleCommand(const std::string& entity, const std::string& subEntity, const std::string& command, const std::string& payload)
+void JBWoprMqttDevice::_handleCommand(JBWoprMqttCommand command, const JBStringView& payload)
 {
-	if (entity == ENTITY_NAME_DEVICE) {
-		_handleDeviceCommand(subEntity, command, payload);
-	} else if (entity == ENTITY_NAME_EFFECT) {
-		_handleEffectCommand(subEntity, command, payload);
-	} else if (entity == ENTITY_NAME_DISPLAY) {
-		_handleDisplayCommand(subEntity, command, payload);
-	} else if (entity == ENTITY_NAME_DEFCON) {
-		_handleDefconCommand(subEntity, command, payload);
-	} else if (entity == ENTITY_NAME_CONFIG) {
-		_handleConfigCommand(subEntity, command, payload);
-	} else {
-		_log->error("Unsupported entity: %s, %s, %s", entity.c_str(), subEntity.c_str(), command.c_str());
+	switch (command) {
+		case MQTT_COMMAND_DEVICE_STATE:
+			_handleDeviceCommand(command, payload);
+			break;
+		case MQTT_COMMAND_CONFIG_TIME_FORMAT:
+		case MQTT_COMMAND_CONFIG_DATE_FORMAT:
+		case MQTT_COMMAND_CONFIG_DISPLAY_BRIGHTNESS:
+		case MQTT_COMMAND_CONFIG_DEFCON_BRIGHTNESS:
+		case MQTT_COMMAND_CONFIG_EFFECTS_TIMEOUT:
+		case MQTT_COMMAND_CONFIG_EFFECTS_SPEED:
+		case MQTT_COMMAND_CONFIG_USE_WEB_PORTAL:
+			_handleConfigCommand(command, payload);
+			break;
+		case MQTT_COMMAND_EFFECT_STATE:
+		case MQTT_COMMAND_EFFECT_NAME:
+		case MQTT_COMMAND_EFFECT_ID:
+		case MQTT_COMMAND_EFFECT_SCRIPT:
+			_handleEffectCommand(command, payload);
+			break;
+		case MQTT_COMMAND_PLAYLIST_STATE:
+		case MQTT_COMMAND_PLAYLIST_CONFIG:
+			_handlePlaylistCommand(command, payload);
+			break;
+		case MQTT_COMMAND_DISPLAY_STATE:
+		case MQTT_COMMAND_DISPLAY_TEXT:
+		case MQTT_COMMAND_DISPLAY_SCROLLTEXT:
+		case MQTT_COMMAND_DISPLAY_BRIGHTNESS:
+			_handleDisplayCommand(command, payload);
+			break;
+		case MQTT_COMMAND_DEFCON_STATE:
+		case MQTT_COMMAND_DEFCON_LEVEL:
+		case MQTT_COMMAND_DEFCON_COLOR:
+		case MQTT_COMMAND_DEFCON_BRIGHTNESS:
+			_handleDefconCommand(command, payload);
+			break;
+		case MQTT_COMMAND_BATCH:
+			_handleBatchCommand(payload);
+			break;
+		case MQTT_COMMAND_BINARY:
+			_handleBinaryCommand(payload);
+			break;
+		case MQTT_COMMAND_DIAGNOSTIC_ECHO:
+			// Handled in _mqttCallback()
+			break;
+		case MQTT_COMMAND_RULES_CONFIG:
+			_handleRulesCommand(payload);
+			break;
+		case MQTT_COMMAND_BINDINGS_CONFIG:
+			// Handled in _mqttCallback(), bindings are owned by the network task
+			_log->error("Data bindings can only be set on their own topic");
+			break;
+		default:
+			_log->error("Unsupported command: %i", command);
+			break;
+	}
+	// Run after the command, so rule actions are not overwritten by it
+	if (_rules.hasTrigger(RULE_TRIGGER_COMMAND)) {
+		_rules.run(RULE_TRIGGER_COMMAND, _mqttCommandHashes[command], JBStringHelper::hash(payload.data, payload.length));
 	}
 }
 
-void JBWoprMqttDevice::_handleDeviceCommand(const std::string &subEntity,
-											const std::string &command,
-											const std::string &payload) {
-	if (subEntity == SUBENTITY_NAME_STATE) {
-		if (command == COMMAND_SET) {
-			if (payload == "restart") {
-				_log->info("Restarting device");
-				displayShowText("Restarting");
-				defconLedsSetColor(0x0000FF);
-				delay(1000);
-				ESP.restart();
-			} else {
-				_log->error("Unsupported payload: %s, %s: %s", subEntity.c_str(), command.c_str(), payload.c_str());
-			}
+void JBWoprMqttDevice::_handleDeviceCommand(JBWoprMqttCommand command, const JBStringView& payload) {
+	if (command == MQTT_COMMAND_DEVICE_STATE) {
+		if (payload == "restart") {
+			_log->info("Restarting device");
+			displayShowText("Restarting");
+			defconLedsSetColor(0x0000FF);
+			delay(1000);
+			ESP.restart();
 		} else {
-			_log->error("Unsupported command: %s %s", subEntity.c_str(), command.c_str());
+			_log->error("Unsupported payload: %i: %.*s", command, (int)payload.length, payload.data);
 		}
 	} else {
-		_log->error("Unsupported command: %s %s", subEntity.c_str(), command.c_str());
-	}
-
-}
-
-void JBWoprMqttDevice::_handleConfigCommand(const std::string &subEntity,
-											const std::string &command,
-											const std::string &payload) {
-	if (command == COMMAND_SET) {
-		if (subEntity == SUBENTITY_NAME_TIME_FORMAT) {
-			_config.timeFormat = payload;
-			_saveConfiguration();
-		} else if (subEntity == SUBENTITY_NAME_DATE_FORMAT) {
-			_config.dateFormat = payload;
-			_saveConfiguration();
-		} else if (subEntity == SUBENTITY_NAME_DISPLAY_BRIGHTNESS) {
-			_config.displayBrightness = atoi(payload.c_str());
-			_saveConfiguration();
-		} else if (subEntity == SUBENTITY_NAME_DEFCON_BRIGHTNESS) {
-			_config.defconLedsBrightness = atoi(payload.c_str());
-			_saveConfiguration();
-		} else if (subEntity == SUBENTITY_NAME_EFFECTS_TIMEOUT) {
-			_config.effectsTimeout = atoi(payload.c_str());
-			_saveConfiguration();
-		} else if (subEntity == SUBENTITY_NAME_WIFI_USE_WEB_PORTAL) {
+		_log->error("Unsupported command: %i", command);
+	}
+}
+
+void JBWoprMqttDevice::_handleConfigCommand(JBWoprMqttCommand command, const JBStringView& payload) {
+	switch (command) {
+		case MQTT_COMMAND_CONFIG_TIME_FORMAT:
+			_config.timeFormat = payload.toString();
+			break;
+		case MQTT_COMMAND_CONFIG_DATE_FORMAT:
+			_config.dateFormat = payload.toString();
+			break;
+		case MQTT_COMMAND_CONFIG_DISPLAY_BRIGHTNESS:
+			_config.displayBrightness = payload.toInt();
+			break;
+		case MQTT_COMMAND_CONFIG_DEFCON_BRIGHTNESS:
+			_config.defconLedsBrightness = payload.toInt();
+			break;
+		case MQTT_COMMAND_CONFIG_EFFECTS_TIMEOUT:
+			_config.effectsTimeout = payload.toInt();
+			break;
+		case MQTT_COMMAND_CONFIG_EFFECTS_SPEED:
+			effectsSetSpeed(payload.toInt());
+			break;
+		case MQTT_COMMAND_CONFIG_USE_WEB_PORTAL:
 			_wifiConfig.useWebPortal = payload == "True";
-			_saveConfiguration();
+			// Passed to the network task, which runs the web portal
 			if (_wifiConfig.useWebPortal) {
 				webPortalStart();
 			} else {
 				webPortalStop();
 			}
-		} else {
-			_log->error("Unsupported sub entity: %s", subEntity.c_str());
-		}
-	} else {
-		_log->error("Unsupported command: %s %s", subEntity.c_str(), command.c_str());
+			break;
+		default:
+			_log->error("Unsupported command: %i", command);
+			return;
 	}
+	_saveConfiguration();
 }
 
-void JBWoprMqttDevice::_handleEffectCommand(const std::string& subEntity,
-											const std::string& command,
-											const std::string& payload) {
-	if (subEntity == SUBENTITY_NAME_STATE) {
-		if (command == COMMAND_SET) {
+void JBWoprMqttDevice::_handleEffectCommand(JBWoprMqttCommand command, const JBStringView& payload) {
+	switch (command) {
+		case MQTT_COMMAND_EFFECT_STATE:
 			if (!payload.empty()) {
-				effectsStartEffect(payload);
+				effectsStartEffect(payload.toString());
 			} else {
 				effectsStopCurrentEffect();
 			}
-		} else {
-			_log->error("Unsupported command: %s %s", subEntity.c_str(), command.c_str());
+			break;
+		case MQTT_COMMAND_EFFECT_NAME:
+			effectsStartEffect(payload.toString());
+			break;
+		case MQTT_COMMAND_EFFECT_ID:
+			if (!payload.isUInt()) {
+				_log->error("Invalid effect ID: %.*s", (int)payload.length, payload.data);
+				break;
+			}
+			effectsStartEffectById(payload.toUInt());
+			break;
+		case MQTT_COMMAND_EFFECT_SCRIPT: {
+			JsonDocument jsonDoc;
+			DeserializationError error = deserializeJson(jsonDoc, payload.data, payload.length);
+			if (error) {
+				_log->error("Invalid script JSON: %s", error.c_str());
+				return;
+			}
+			if (effectsLoadScriptEffect(jsonDoc) != nullptr) {
+				_saveScriptEffect(jsonDoc);
+			}
+			break;
 		}
-	} else if (subEntity == SUBENTITY_NAME_NAME) {
-		if (command == COMMAND_SET) {
-			effectsStartEffect(payload.c_str());
-		} else {
-			_log->error("Unsupported command: %s %s", subEntity.c_str(), command.c_str());
+		default:
+			_log->error("Unsupported command: %i", command);
+			break;
+	}
+}
+
+void JBWoprMqttDevice::_handlePlaylistCommand(JBWoprMqttCommand command, const JBStringView& payload) {
+	if (command == MQTT_COMMAND_PLAYLIST_STATE) {
+		if (payload == STATE_ON) {
+			effectsStartEffect(&_playlist);
+		} else if (effectsGetCurrentEffect() == &_playlist) {
+			effectsStopCurrentEffect();
+		}
+		mqttPublishMessage(_getTopic(MQTT_TOPIC_PLAYLIST_STATE),
+						   _playlist.isRunning() ? STATE_ON : STATE_OFF);
+	} else if (command == MQTT_COMMAND_PLAYLIST_CONFIG) {
+		JsonDocument jsonDoc;
+		DeserializationError error = deserializeJson(jsonDoc, payload.data, payload.length);
+		if (error) {
+			_log->error("Invalid playlist JSON: %s", error.c_str());
+			return;
+		}
+		if (_playlist.setFromJsonDocument(jsonDoc)) {
+			_savePlaylist();
+			JsonDocument stateDoc;
+			_playlist.setJsonDocument(stateDoc);
+			mqttPublishMessage(_getTopic(MQTT_TOPIC_PLAYLIST_CONFIG), stateDoc, true);
 		}
 	} else {
-		_log->error("Unsupported sub entity: %s", subEntity.c_str());
+		_log->error("Unsupported command: %i", command);
+	}
+}
+
+void JBWoprMqttDevice::_handleRulesCommand(const JBStringView& payload) {
+	JsonDocument jsonDoc;
+	DeserializationError error = deserializeJson(jsonDoc, payload.data, payload.length);
+	if (error) {
+		_log->error("Invalid rules JSON: %s", error.c_str());
+		return;
+	}
+	if (!_rules.setFromJsonDocument(jsonDoc)) {
+		return;
+	}
+	File rulesFile = LittleFS.open(RULES_FILE_NAME, "w");
+	if (!rulesFile) {
+		_log->error("Failed to open rules file for writing!");
+	} else {
+		serializeJson(jsonDoc, rulesFile);
+		rulesFile.close();
+	}
+	mqttPublishMessage(_getTopic(MQTT_TOPIC_RULES_CONFIG), jsonDoc, true);
+}
+
+void JBWoprMqttDevice::_loadRules() {
+	File rulesFile = LittleFS.open(RULES_FILE_NAME, "r");
+	if (!rulesFile) {
+		_log->debug("No rules file");
+		return;
+	}
+	JsonDocument jsonDoc;
+	DeserializationError error = deserializeJson(jsonDoc, rulesFile);
+	rulesFile.close();
+	if (error) {
+		_log->error("Error parsing rules JSON file!");
+		return;
+	}
+	_rules.setFromJsonDocument(jsonDoc);
+}
+
+void JBWoprMqttDevice::_handleBindingsCommand(const JBStringView& payload) {
+	JsonDocument jsonDoc;
+	DeserializationError error = deserializeJson(jsonDoc, payload.data, payload.length);
+	if (error) {
+		_log->error("Invalid bindings JSON: %s", error.c_str());
+		return;
+	}
+	if (!_bindings.setFromJsonDocument(jsonDoc)) {
+		return;
+	}
+	File bindingsFile = LittleFS.open(BINDINGS_FILE_NAME, "w");
+	if (!bindingsFile) {
+		_log->error("Failed to open bindings file for writing!");
+	} else {
+		serializeJson(jsonDoc, bindingsFile);
+		bindingsFile.close();
+	}
+	// The client buffer holds the payload until the callback returns
+	_mqttBindingsChanged = true;
+	mqttPublishMessage(_getTopic(MQTT_TOPIC_BINDINGS_CONFIG), jsonDoc, true);
+}
+
+void JBWoprMqttDevice::_loadBindings() {
+	File bindingsFile = LittleFS.open(BINDINGS_FILE_NAME, "r");
+	if (!bindingsFile) {
+		_log->debug("No bindings file");
+		return;
+	}
+	JsonDocument jsonDoc;
+	DeserializationError error = deserializeJson(jsonDoc, bindingsFile);
+	bindingsFile.close();
+	if (error) {
+		_log->error("Error parsing bindings JSON file!");
+		return;
+	}
+	_bindings.setFromJsonDocument(jsonDoc);
+}
+
+void JBWoprMqttDevice::_mqttSubscribeBindings() {
+	const auto& bindings = _bindings.getBindings();
+	for (const auto& topic : _mqttBindingTopics) {
+		bool bound = std::any_of(bindings.begin(), bindings.end(), [&topic](const JBWoprBindings::Binding& binding) {
+			return binding.topic == topic;
+		});
+		if (!bound) {
+			_log->debug("Unsubscribing from MQTT topic: %s", topic.c_str());
+			_mqttClient->unsubscribe(topic.c_str());
+		}
+	}
+	_mqttBindingTopics.clear();
+	for (const auto& binding : bindings) {
+		_log->debug("Subscribing to MQTT topic: %s", binding.topic.c_str());
+		if (!_mqttClient->subscribe(binding.topic.c_str())) {
+			_log->error("Failed to subscribe to MQTT topic, error: %i", _mqttClient->state());
+			continue;
+		}
+		_mqttBindingTopics.push_back(binding.topic);
+	}
+}
+
+void JBWoprMqttDevice::_mqttHandleBinding(uint8_t index, const byte* payload, unsigned int length) {
+	JBWoprBindings::Render render;
+	if (!_bindings.render(index, reinterpret_cast<const char*>(payload), length, render)) {
+		return;
+	}
+	if (!_isNetworkTask()) {
+		_renderBinding(render);
+	} else if (!_mqttBindingQueue.push(render)) {
+		_log->warning("MQTT binding queue full, dropping value");
+	}
+}
+
+void JBWoprMqttDevice::_renderBinding(const JBWoprBindings::Render& render) {
+	if (!render.text.empty()) {
+		displayShowText(render.text);
+	}
+	if (render.level != JBWOPR_BINDING_LEVEL_NONE) {
+		defconLedsSetDefconLevel((JBDefconLevel)render.level);
+	}
+	if (render.hasColor) {
+		defconLedsSetColor(render.color);
 	}
 }
 
-void JBWoprMqttDevice::_handleDisplayCommand(const std::string& subEntity,
-											 const std::string& command,
-											 const std::string& payload) {
-	if (subEntity == SUBENTITY_NAME_STATE) {
-		if (command == COMMAND_SET) {
+void JBWoprMqttDevice::_rulesLoop() {
+	if (_rules.hasTrigger(RULE_TRIGGER_EFFECT)) {
+		// Only an effect that stops without being replaced counts as finished
+		JBWoprEffectBase* effect = effectsCurrentEffectIsRunning() ? effectsGetCurrentEffect() : nullptr;
+		if (effect == nullptr && _rulesEffect != nullptr) {
+			_rulesEffect = nullptr;
+			_rules.run(RULE_TRIGGER_EFFECT, _rulesEffectHash);
+			_rules.run(RULE_TRIGGER_EFFECT, 0);
+		} else if (effect != _rulesEffect) {
+			_rulesEffect = effect;
+			_rulesEffectHash = JBStringHelper::hash(effect->getName().c_str());
+		}
+	}
+
+	if (_rules.hasTrigger(RULE_TRIGGER_TIME) && (uint32_t)millis() - _rulesTime >= 1000) {
+		_rulesTime = millis();
+		time_t now = time(nullptr);
+		if (now < JBWOPR_MQTT_VALID_TIME) {
+			return;
+		}
+		tm info;
+		localtime_r(&now, &info);
+		int16_t minute = info.tm_hour * 60 + info.tm_min;
+		if (minute != _rulesMinute) {
+			// Not on the first check, so a restart does not repeat the rules of that minute
+			if (_rulesMinute >= 0) {
+				_rules.run(RULE_TRIGGER_TIME, minute);
+			}
+			_rulesMinute = minute;
+		}
+	}
+}
+
+void JBWoprMqttDevice::_handleDisplayCommand(JBWoprMqttCommand command, const JBStringView& payload) {
+	switch (command) {
+		case MQTT_COMMAND_DISPLAY_STATE:
 			if (payload == STATE_ON) {
 				displaySetState(true);
 			} else if (payload == STATE_OFF) {
 				displaySetState(false);
 			} else {
-				_log->error("Unsupported payload: %s, %s: %s", subEntity.c_str(), command.c_str(), payload.c_str());
+				_log->error("Unsupported payload: %i: %.*s", command, (int)payload.length, payload.data);
 			}
-		} else {
-			_log->error("Unsupported command: %s %s", subEntity.c_str(), command.c_str());
-		}
-	} else if (subEntity == SUBENTITY_NAME_TEXT) {
-		if (command == COMMAND_SET) {
-			displayShowText(payload);
-		} else {
-			_log->error("Unsupported command: %s %s", subEntity.c_str(), command.c_str());
-		}
-	} else if (subEntity == SUBENTITY_NAME_SCROLLTEXT) {
-		if (command == COMMAND_SET) {
-			displayScrollText(payload);
-		} else {
-			_log->error("Unsupported command: %s %s", subEntity.c_str(), command.c_str());
-		}
-	} else if (subEntity == SUBENTITY_NAME_BRIGHTNESS) {
-		if (command == COMMAND_SET) {
-			uint8_t brightness = atoi(payload.c_str());
-			displaySetBrightness(brightness);
-		} else {
-			_log->error("Unsupported command: %s %s", subEntity.c_str(), command.c_str());
+			break;
+		case MQTT_COMMAND_DISPLAY_TEXT:
+			displayShowText(payload.toString());
+			break;
+		case MQTT_COMMAND_DISPLAY_SCROLLTEXT: {
+			std::string text = payload.toString();
+			if (displayStartScrollText(text)) {
+				_mqttStateScrollText = text;
+				_mqttPublishState(MQTT_STATE_DISPLAY_SCROLLTEXT, MQTT_TOPIC_DISPLAY_SCROLLTEXT, text.c_str());
+			}
+			break;
 		}
-	} else {
-		_log->error("Unsupported sub entity: %s", subEntity.c_str());
+		case MQTT_COMMAND_DISPLAY_BRIGHTNESS:
+			displaySetBrightness(payload.toInt());
+			break;
+		default:
+			_log->error("Unsupported command: %i", command);
+			break;
 	}
 }
 
-void JBWoprMqttDevice::_handleDefconCommand(const std::string& subEntity,
-											const std::string& command,
-											const std::string& payload) {
-	if (subEntity == SUBENTITY_NAME_STATE) {
-		if (command == COMMAND_SET) {
+void JBWoprMqttDevice::_handleDefconCommand(JBWoprMqttCommand command, const JBStringView& payload) {
+	switch (command) {
+		case MQTT_COMMAND_DEFCON_STATE:
 			if (payload == STATE_ON) {
 				defconLedsSetState(true);
 			} else if (payload == STATE_OFF) {
 				defconLedsSetState(false);
 			} else {
-				_log->error("Unsupported payload: %s, %s: %s", subEntity.c_str(), command.c_str(), payload.c_str());
+				_log->error("Unsupported payload: %i: %.*s", command, (int)payload.length, payload.data);
 			}
-		} else {
-			_log->error("Unsupported command: %s %s", subEntity.c_str(), command.c_str());
+			break;
+		case MQTT_COMMAND_DEFCON_LEVEL:
+			defconLedsSetDefconLevel(_getDefconLevel(payload.toString()));
+			break;
+		case MQTT_COMMAND_DEFCON_COLOR:
+			defconLedsSetColor(JBStringHelper::stringToRgb(payload.toString()));
+			break;
+		case MQTT_COMMAND_DEFCON_BRIGHTNESS:
+			defconLedsSetBrightness(payload.toInt());
+			break;
+		default:
+			_log->error("Unsupported command: %i", command);
+			break;
+	}
+}
+
+void JBWoprMqttDevice::_handleBatchCommand(const JBStringView& payload) {
+	JsonDocument jsonDoc;
+	DeserializationError error = deserializeJson(jsonDoc, payload.data, payload.length);
+	if (error) {
+		_log->error("Invalid batch JSON: %s", error.c_str());
+		return;
+	}
+	if (jsonDoc.is<JsonObjectConst>() && !jsonDoc[JSON_KEY_BATCH_AT].isNull()) {
+		// Scheduled on the synchronized clock, so devices in a group switch at the same time
+		uint64_t at = jsonDoc[JSON_KEY_BATCH_AT].as<uint64_t>();
+		uint64_t now = _getUnixTimeMs();
+		if (now == 0) {
+			_log->warning("Clock not synchronized, applying scheduled batch now");
+		} else if (at > now + JBWOPR_MQTT_SCHEDULE_MAX) {
+			_log->error("Command batch scheduled too far ahead");
+			return;
+		} else if (at > now) {
+			if (_mqttScheduledTime != 0) {
+				_log->warning("Replacing scheduled command batch");
+			}
+			_mqttScheduledBatch = std::move(jsonDoc);
+			_mqttScheduledTime = at;
+			_log->debug("Command batch scheduled in %u ms", (uint32_t)(at - now));
+			return;
 		}
-	} else if (subEntity == SUBENTITY_NAME_LEVEL) {
-		if (command == COMMAND_SET) {
-			JBDefconLevel level = _getDefconLevel(payload);
-			defconLedsSetDefconLevel(level);
-		} else {
-			_log->error("Unsupported command: %s %s", subEntity.c_str(), command.c_str());
+	}
+	JsonArrayConst items = jsonDoc.is<JsonObjectConst>() ? jsonDoc[JSON_KEY_BATCH_COMMANDS].as<JsonArrayConst>() : jsonDoc.as<JsonArrayConst>();
+	if (items.isNull()) {
+		_log->error("Command batch is not an array");
+		return;
+	}
+	_applyBatch(items);
+}
+
+void JBWoprMqttDevice::_applyBatch(JsonArrayConst items) {
+	if (!_mqttBeginBatch()) {
+		return;
+	}
+	std::string topic;
+	std::string value;
+	for (JsonVariantConst item : items) {
+		const char* name = item[JSON_KEY_BATCH_COMMAND].as<const char*>();
+		if (name == nullptr) {
+			_log->error("Command batch entry has no command");
+			continue;
 		}
-	} else if (subEntity == SUBENTITY_NAME_COLOR) {
-		if (command == COMMAND_SET) {
-			uint32_t color = JBStringHelper::stringToRgb(payload);
-			defconLedsSetColor(color);
-		} else {
-			_log->error("Unsupported command: %s %s", subEntity.c_str(), command.c_str());
+		topic = name;
+		topic += '/';
+		topic += COMMAND_SET;
+		JBWoprMqttCommand command = _findCommand(topic.c_str());
+		if (command == MQTT_COMMAND_COUNT || command == MQTT_COMMAND_BATCH || command == MQTT_COMMAND_BINARY) {
+			_log->error("Unsupported batch command: %s", name);
+			continue;
 		}
-	} else if (subEntity == SUBENTITY_NAME_BRIGHTNESS) {
-		if (command == COMMAND_SET) {
-			uint8_t brightness = atoi(payload.c_str());
-			defconLedsSetBrightness(brightness);
-		} else {
-			_log->error("Unsupported command: %s %s", subEntity.c_str(), command.c_str());
+		// Script and playlist commands take a JSON value
+		JsonVariantConst itemValue = item[JSON_KEY_BATCH_VALUE];
+		value.clear();
+		if (itemValue.is<const char*>()) {
+			value = itemValue.as<const char*>();
+		} else if (!itemValue.isNull()) {
+			serializeJson(itemValue, value);
 		}
-	} else {
-		_log->error("Unsupported sub entity: %s", subEntity.c_str());
+		_handleCommand(command, JBStringView { value.data(), value.size() });
+	}
+	_mqttEndBatch();
+	_log->debug("Command batch applied, %u commands", items.size());
+}
+
+void JBWoprMqttDevice::_handleBinaryCommand(const JBStringView& payload) {
+	if (!_mqttConfig.useBinary) {
+		_log->error("MessagePack topics are not enabled");
+		return;
+	}
+	JBMsgPackReader reader(reinterpret_cast<const uint8_t*>(payload.data), payload.length);
+	size_t count;
+	if (!reader.readArray(count)) {
+		_log->error("MessagePack commands are not an array");
+		return;
+	}
+	if (!_mqttBeginBatch()) {
+		return;
+	}
+	for (size_t i = 0; i < count; i++) {
+		size_t size;
+		uint32_t command;
+		if (!reader.readArray(size) || size != 2 || !reader.readUInt(command)) {
+			// The rest of the payload can not be trusted
+			_log->error("Invalid MessagePack command %u", i);
+			break;
+		}
+		if (command >= MQTT_COMMAND_COUNT || command == MQTT_COMMAND_BATCH || command == MQTT_COMMAND_BINARY) {
+			_log->error("Unsupported MessagePack command: %u", command);
+			reader.skip();
+			continue;
+		}
+		if (!_handleBinaryValue((JBWoprMqttCommand)command, reader)) {
+			_log->error("Invalid value for MessagePack command: %u", command);
+			reader.skip();
+		}
+	}
+	_mqttEndBatch();
+}
+
+bool JBWoprMqttDevice::_handleBinaryValue(JBWoprMqttCommand command, JBMsgPackReader& reader) {
+	bool flag;
+	uint32_t number;
+	int32_t signedNumber;
+	JBStringView text { "", 0 };
+	char buffer[JBWOPR_MQTT_BINARY_TEXT_SIZE + 1];
+
+	// Typed values are applied directly, instead of being parsed from text
+	switch (command) {
+		case MQTT_COMMAND_EFFECT_STATE:
+			if (!reader.readBool(flag)) {
+				return false;
+			}
+			if (flag) {
+				effectsStartCurrentEffect();
+			} else {
+				effectsStopCurrentEffect();
+			}
+			return true;
+		case MQTT_COMMAND_EFFECT_ID:
+			if (!reader.readUInt(number)) {
+				return false;
+			}
+			effectsStartEffectById(number);
+			return true;
+		case MQTT_COMMAND_DISPLAY_STATE:
+			if (!reader.readBool(flag)) {
+				return false;
+			}
+			displaySetState(flag);
+			return true;
+		case MQTT_COMMAND_DISPLAY_TEXT: {
+			if (!reader.readString(text)) {
+				return false;
+			}
+			size_t length = std::min<size_t>(text.length, JBWOPR_MQTT_BINARY_TEXT_SIZE);
+			memcpy(buffer, text.data, length);
+			buffer[length] = 0;
+			displayShowText(buffer);
+			return true;
+		}
+		case MQTT_COMMAND_DISPLAY_BRIGHTNESS:
+			if (!reader.readUInt(number)) {
+				return false;
+			}
+			displaySetBrightness(std::min<uint32_t>(number, 100));
+			return true;
+		case MQTT_COMMAND_DEFCON_STATE:
+			if (!reader.readBool(flag)) {
+				return false;
+			}
+			defconLedsSetState(flag);
+			return true;
+		case MQTT_COMMAND_DEFCON_LEVEL:
+			if (!reader.readUInt(number) || number > JBDefconLevel::DEFCON_NONE) {
+				return false;
+			}
+			defconLedsSetDefconLevel((JBDefconLevel)number);
+			return true;
+		case MQTT_COMMAND_DEFCON_COLOR:
+			if (!reader.readUInt(number)) {
+				return false;
+			}
+			defconLedsSetColor(number & 0xFFFFFF);
+			return true;
+		case MQTT_COMMAND_DEFCON_BRIGHTNESS:
+			if (!reader.readUInt(number)) {
+				return false;
+			}
+			defconLedsSetBrightness(std::min<uint32_t>(number, 100));
+			return true;
+		default:
+			break;
 	}
+
+	// Other commands use the text handlers
+	switch (reader.peek()) {
+		case MSGPACK_STRING:
+			if (!reader.readString(text)) {
+				return false;
+			}
+			break;
+		case MSGPACK_UINT:
+		case MSGPACK_INT:
+			if (!reader.readInt(signedNumber)) {
+				return false;
+			}
+			text = { buffer, (size_t)snprintf(buffer, sizeof(buffer), "%i", signedNumber) };
+			break;
+		case MSGPACK_BOOL:
+			if (!reader.readBool(flag)) {
+				return false;
+			}
+			text = { flag ? STATE_ON : STATE_OFF, strlen(flag ? STATE_ON : STATE_OFF) };
+			break;
+		case MSGPACK_NIL:
+			reader.readNil();
+			text = { "", 0 };
+			break;
+		default:
+			return false;
+	}
+	_handleCommand(command, text);
+	return true;
+}
+
+bool JBWoprMqttDevice::_mqttBeginBatch() {
+	if (_mqttBatchActive) {
+		_log->error("Nested command batch is not supported");
+		return false;
+	}
+	// Display and LED output, and state publishing, are deferred until all commands are applied
+	_mqttBatchFrame = _effectsBeginFrame();
+	_mqttBatchActive = true;
+	_mqttBatchChanges = 0;
+	return true;
+}
+
+void JBWoprMqttDevice::_mqttEndBatch() {
+	_mqttBatchActive = false;
+	if (_mqttBatchFrame) {
+		_effectsEndFrame();
+	}
+	_mqttPublishStateFields(_mqttBatchChanges);
 }
 
-std::string JBWoprMqttDevice::_getTopic(const char* entityId, const char* subEntityId) {
-	// <mqttprefix>/<deviceid>/<entity>/<subentity>
-	return _mqttConfig.mqttPrefix + "/" + _getDeviceName() + "/" + entityId + "/" + subEntityId;
+const char* JBWoprMqttDevice::_getTopic(JBWoprMqttTopic topic) const {
+	return _mqttTopics.c_str() + _mqttTopicOffsets[topic];
 }
 
-std::string JBWoprMqttDevice::_getTopic(const std::string& entityId, const std::string& subEntityId) {
-	return _getTopic(entityId.c_str(), subEntityId.c_str());
+std::string JBWoprMqttDevice::_getTopic(const char* entityId, const char* subEntityId, const char* command) const {
+	// <mqttprefix>/<deviceid>/<entity>/<subentity>[/<command>]
+	std::string topic = _mqttTopicBase + entityId + "/" + subEntityId;
+	if (*command != 0) {
+		topic += "/";
+		topic += command;
+	}
+	return topic;
+}
+
+uint8_t JBWoprMqttDevice::_getTopicIndex(const char* topic) const {
+	const char* table = _mqttTopics.c_str();
+	if (topic < table || topic >= table + _mqttTopics.size()) {
+		return MQTT_TOPIC_COUNT;
+	}
+	for (uint8_t i = 0; i < MQTT_TOPIC_COUNT; i++) {
+		if (table + _mqttTopicOffsets[i] == topic) {
+			return i;
+		}
+	}
+	return MQTT_TOPIC_COUNT;
+}
+
+const char* JBWoprMqttDevice::_getCommandTopic(const char* topic, bool& isGroup) const {
+	isGroup = false;
+	if (strncmp(topic, _mqttTopicBase.c_str(), _mqttTopicBase.size()) == 0) {
+		return topic + _mqttTopicBase.size();
+	}
+	for (const auto& base : _mqttGroupTopicBases) {
+		if (strncmp(topic, base.c_str(), base.size()) == 0) {
+			isGroup = true;
+			return topic + base.size();
+		}
+	}
+	return nullptr;
+}
+
+uint64_t JBWoprMqttDevice::_getUnixTimeMs() const {
+	struct timeval now;
+	gettimeofday(&now, nullptr);
+	if (now.tv_sec < JBWOPR_MQTT_VALID_TIME) {
+		return 0;
+	}
+	return (uint64_t)now.tv_sec * 1000 + now.tv_usec / 1000;
 }
 
-std::string JBWoprMqttDevice::_getSubscriptionTopic() {
+const char* JBWoprMqttDevice::_getSubscriptionTopic() const {
 	// <mqttprefix>/<deviceid>/<entity>/<subentity>/<command>
-	return _mqttConfig.mqttPrefix + "/" + _getDeviceName() + "/+/+/+";
+	return _getTopic(MQTT_TOPIC_SUBSCRIPTION);
 }
 
-std::string JBWoprMqttDevice::_getAvailabilityTopic() {
-	// <mqttprefix>/<deviceid>/availability"
-	return _mqttConfig.mqttPrefix + "/" + _getDeviceName() + "/availability";
+const char* JBWoprMqttDevice::_getAvailabilityTopic() const {
+	// <mqttprefix>/<deviceid>/availability
+	return _getTopic(MQTT_TOPIC_AVAILABILITY);
 }
 
 // ====================================================================
@@ -651,64 +1986,72 @@ std::string JBWoprMqttDevice::_getAvailabilityTopic() {
 void JBWoprMqttDevice::_buttonFrontLeftClick()
 {
 	JBWoprWiFiDevice::_buttonFrontLeftClick();
+	_rules.run(RULE_TRIGGER_BUTTON, JBWoprRules::getButtonKey(0, false));
 	if (_mqttConfig.useMqtt) {
-		mqttPublishMessage(_getTopic(ENTITY_NAME_BUTTON_FRONT_LEFT, SUBENTITY_NAME_EVENT), EVENT_CLICK);
+		mqttPublishEvent(_getTopic(MQTT_TOPIC_BUTTON_FRONT_LEFT_EVENT), EVENT_CLICK);
 	}
 }
 
 void JBWoprMqttDevice::_buttonFrontLeftDoubleClick()
 {
 	JBWoprWiFiDevice::_buttonFrontLeftDoubleClick();
+	_rules.run(RULE_TRIGGER_BUTTON, JBWoprRules::getButtonKey(0, true));
 	if (_mqttConfig.useMqtt) {
-		mqttPublishMessage(_getTopic(ENTITY_NAME_BUTTON_FRONT_LEFT, SUBENTITY_NAME_EVENT), EVENT_DOUBLE_CLICK);
+		mqttPublishEvent(_getTopic(MQTT_TOPIC_BUTTON_FRONT_LEFT_EVENT), EVENT_DOUBLE_CLICK);
 	}
 }
 
 void JBWoprMqttDevice::_buttonFrontRightClick()
 {
 	JBWoprWiFiDevice::_buttonFrontRightClick();
+	_rules.run(RULE_TRIGGER_BUTTON, JBWoprRules::getButtonKey(1, false));
 	if (_mqttConfig.useMqtt) {
-		mqttPublishMessage(_getTopic(ENTITY_NAME_BUTTON_FRONT_RIGHT, SUBENTITY_NAME_EVENT), EVENT_CLICK);
+		mqttPublishEvent(_getTopic(MQTT_TOPIC_BUTTON_FRONT_RIGHT_EVENT), EVENT_CLICK);
 	}
 }
 
 void JBWoprMqttDevice::_buttonFrontRightDoubleClick()
 {
 	JBWoprWiFiDevice::_buttonFrontRightDoubleClick();
+	_rules.run(RULE_TRIGGER_BUTTON, JBWoprRules::getButtonKey(1, true));
 	if (_mqttConfig.useMqtt) {
-		mqttPublishMessage(_getTopic(ENTITY_NAME_BUTTON_FRONT_RIGHT, SUBENTITY_NAME_EVENT), EVENT_DOUBLE_CLICK);
+		mqttPublishEvent(_getTopic(MQTT_TOPIC_BUTTON_FRONT_RIGHT_EVENT), EVENT_DOUBLE_CLICK);
 	}
 }
 
 void JBWoprMqttDevice::_buttonBackTopClick()
 {
 	JBWoprWiFiDevice::_buttonBackTopClick();
+	_rules.run(RULE_TRIGGER_BUTTON, JBWoprRules::getButtonKey(2, false));
 	if (_mqttConfig.useMqtt) {
-		mqttPublishMessage(_getTopic(ENTITY_NAME_BUTTON_BACK_TOP, SUBENTITY_NAME_EVENT), EVENT_CLICK);
+		mqttPublishEvent(_getTopic(MQTT_TOPIC_BUTTON_BACK_TOP_EVENT), EVENT_CLICK);
 	}
 }
 
 void JBWoprMqttDevice::_buttonBackTopDoubleClick()
 {
 	JBWoprWiFiDevice::_buttonBackTopDoubleClick();
+	_rules.run(RULE_TRIGGER_BUTTON, JBWoprRules::getButtonKey(2, true));
 	if (_mqttConfig.useMqtt) {
-		mqttPublishMessage(_getTopic(ENTITY_NAME_BUTTON_BACK_TOP, SUBENTITY_NAME_EVENT), EVENT_DOUBLE_CLICK);
+		mqttPublishEvent(_getTopic(MQTT_TOPIC_BUTTON_BACK_TOP_EVENT), EVENT_DOUBLE_CLICK);
 	}
 }
 
 void JBWoprMqttDevice::_buttonBackBottomClick()
 {
 	JBWoprWiFiDevice::_buttonBackBottomClick();
+	_rules.run(RULE_TRIGGER_BUTTON, JBWoprRules::getButtonKey(3, false));
 	if (_mqttConfig.useMqtt) {
-		mqttPublishMessage(_getTopic(ENTITY_NAME_BUTTON_BACK_BOTTOM, SUBENTITY_NAME_EVENT), EVENT_CLICK);
+		mqttPublishEvent(_getTopic(MQTT_TOPIC_BUTTON_BACK_BOTTOM_EVENT), EVENT_CLICK);
 	}
 }
 
 void JBWoprMqttDevice::_buttonBackBottomDoubleClick()
 {
 	JBWoprWiFiDevice::_buttonBackBottomDoubleClick();
+	_rules.run(RULE_TRIGGER_BUTTON, JBWoprRules::getButtonKey(3, true));
 	if (_mqttConfig.useMqtt) {
-		mqttPublishMessage(_getTopic(ENTITY_NAME_BUTTON_BACK_BOTTOM, SUBENTITY_NAME_EVENT), EVENT_DOUBLE_CLICK);
+		mqttPublishEvent(_getTopic(MQTT_TOPIC_BUTTON_BACK_BOTTOM_EVENT), EVENT_DOUBLE_CLICK);
 	}
 }
 
@@ -11,12 +11,36 @@
 
 #include "jbwoprwifi.h"
 #include <PubSubClient.h>				   	// https://github.com/knolleary/pubsubclient
+#include <WiFiClientSecure.h>
 #include <WiFiManager.h>
 #include <JBLogger.h>
 #include "effects/jbwopreffects.h"
+#include "jbwoprrules.h"
+#include "jbwoprbindings.h"
+#include "jbwoprmsgpack.h"
+#include "jbwoprspscqueue.h"
+#include <deque>
 
 #define DEFAULT_MQTT_PREFIX	"wopr"			///< Default MQTT prefix
 #define DEFAULT_MQTT_PORT 1883				///< Default MQTT port
+#define JBWOPR_MQTT_RETRY_MIN 1000			///< First reconnect delay, milliseconds
+#define JBWOPR_MQTT_RETRY_MAX 60000			///< Max reconnect delay, milliseconds
+#define JBWOPR_MQTT_CONNECT_TIMEOUT 1000	///< TCP connect timeout, milliseconds
+#define JBWOPR_MQTT_HANDSHAKE_TIMEOUT 10	///< TLS handshake timeout, seconds
+#define JBWOPR_MQTT_SOCKET_TIMEOUT 5		///< MQTT socket timeout, seconds
+#define JBWOPR_MQTT_RESOLVE_ATTEMPTS 5		///< Failed attempts before the server name is resolved again
+#define JBWOPR_MQTT_QUEUE_SIZE 32			///< Max number of messages in the outbound queue
+#define JBWOPR_MQTT_BATCH_SIZE 8			///< Max number of queued messages sent per loop
+#define JBWOPR_MQTT_COMMAND_QUEUE_SIZE 16	///< Max number of received commands waiting for loop()
+#define JBWOPR_MQTT_STATE_INTERVAL 500		///< Default min interval for rapidly changing state topics, milliseconds
+#define JBWOPR_MQTT_STATE_DOCUMENT_INTERVAL 250	///< Min interval between state documents, milliseconds
+#define JBWOPR_MQTT_BINARY_STATE_INTERVAL 50	///< Min interval between binary state messages, milliseconds
+#define JBWOPR_MQTT_BINARY_TEXT_SIZE 64		///< Max length of text in binary commands
+#define JBWOPR_MQTT_METRICS_INTERVAL 60		///< Default metrics interval, seconds
+#define JBWOPR_MQTT_SESSION_PROBE_TIMEOUT 3000	///< Max wait for the echo that confirms a resumed session, milliseconds
+#define JBWOPR_MQTT_SCHEDULE_MAX 600000		///< Max time a command batch can be scheduled ahead, milliseconds
+#define JBWOPR_MQTT_VALID_TIME 1700000000	///< Earliest Unix time accepted as synchronized, seconds
+#define JBWOPR_MQTT_BINDING_QUEUE_SIZE 8	///< Max number of rendered bindings waiting for loop()
 
 // ====================================================================
 //
@@ -31,6 +55,103 @@ struct JBWoprMqttConfig {
 	std::string mqttUserName;               ///< MQTT user name
 	std::string mqttPassword;               ///< MQTT password
 	std::string mqttPrefix;                 ///< MQTT prefix
+	bool useStateDocument;                  ///< Publish state as one JSON document
+	bool useBinary;                         ///< Use MessagePack command and state topics
+	uint16_t metricsInterval;               ///< Metrics interval in seconds, 0 disables metrics
+	bool persistentSession;                 ///< Keep MQTT session and retained state between connections
+	bool useBroadcast;                      ///< Accept commands on <mqtt_prefix>/all/
+	std::string mqttGroups;                 ///< Comma separated groups, accepts commands on <mqtt_prefix>/group/<name>/
+	bool useTls;                            ///< Connect with TLS, using the CA certificate in LittleFS
+};
+
+/// @brief MQTT topics, index in the topic table
+enum JBWoprMqttTopic {
+	MQTT_TOPIC_AVAILABILITY = 0,			///< Availability topic
+	MQTT_TOPIC_SUBSCRIPTION,				///< Command subscription topic
+	MQTT_TOPIC_CONFIG_STATE,				///< Configuration state
+	MQTT_TOPIC_DIAGNOSTIC_STATE,			///< Diagnostics state
+	MQTT_TOPIC_EFFECT_STATE,				///< Effect state
+	MQTT_TOPIC_EFFECT_NAME,					///< Effect name
+	MQTT_TOPIC_EFFECT_ID,					///< Effect ID
+	MQTT_TOPIC_PLAYLIST_STATE,				///< Playlist state
+	MQTT_TOPIC_PLAYLIST_CONFIG,				///< Playlist configuration
+	MQTT_TOPIC_DISPLAY_STATE,				///< Display state
+	MQTT_TOPIC_DISPLAY_TEXT,				///< Display text
+	MQTT_TOPIC_DISPLAY_SCROLLTEXT,			///< Display scroll text
+	MQTT_TOPIC_DISPLAY_BRIGHTNESS,			///< Display brightness
+	MQTT_TOPIC_DEFCON_STATE,				///< DEFCON LEDs state
+	MQTT_TOPIC_DEFCON_LEVEL,				///< DEFCON level
+	MQTT_TOPIC_DEFCON_COLOR,				///< DEFCON LEDs color
+	MQTT_TOPIC_DEFCON_BRIGHTNESS,			///< DEFCON LEDs brightness
+	MQTT_TOPIC_BUTTON_FRONT_LEFT_EVENT,		///< Front left button event
+	MQTT_TOPIC_BUTTON_FRONT_RIGHT_EVENT,	///< Front right button event
+	MQTT_TOPIC_BUTTON_BACK_TOP_EVENT,		///< Back top button event
+	MQTT_TOPIC_BUTTON_BACK_BOTTOM_EVENT,	///< Back bottom button event
+	MQTT_TOPIC_STATE,						///< JSON state document
+	MQTT_TOPIC_BINARY_STATE,				///< MessagePack state
+	MQTT_TOPIC_METRICS,						///< Client metrics
+	MQTT_TOPIC_RULES_CONFIG,				///< Rules configuration
+	MQTT_TOPIC_BINDINGS_CONFIG,				///< Data bindings configuration
+	MQTT_TOPIC_COUNT						///< Number of topics
+};
+
+/// @brief Fields of the JSON state document, bits in its change mask
+enum JBWoprMqttStateField {
+	MQTT_STATE_EFFECT = 0x0001,				///< Effect state
+	MQTT_STATE_EFFECT_NAME = 0x0002,		///< Effect name
+	MQTT_STATE_EFFECT_ID = 0x0004,			///< Effect ID
+	MQTT_STATE_DISPLAY = 0x0008,			///< Display state
+	MQTT_STATE_DISPLAY_TEXT = 0x0010,		///< Display text
+	MQTT_STATE_DISPLAY_SCROLLTEXT = 0x0020,	///< Display scroll text
+	MQTT_STATE_DISPLAY_BRIGHTNESS = 0x0040,	///< Display brightness
+	MQTT_STATE_DEFCON = 0x0080,				///< DEFCON LEDs state
+	MQTT_STATE_DEFCON_LEVEL = 0x0100,		///< DEFCON level
+	MQTT_STATE_DEFCON_COLOR = 0x0200,		///< DEFCON LEDs color
+	MQTT_STATE_DEFCON_BRIGHTNESS = 0x0400,	///< DEFCON LEDs brightness
+	MQTT_STATE_ALL = 0x07FF					///< All fields
+};
+
+/// @brief MQTT topic classes, used for publish metrics
+enum JBWoprMqttTopicClass {
+	MQTT_CLASS_STATE = 0,					///< State topics
+	MQTT_CLASS_EVENT,						///< Button events
+	MQTT_CLASS_DIAGNOSTIC,					///< Availability, configuration, diagnostics and metrics
+	MQTT_CLASS_OTHER,						///< Topics not in the topic table, like discovery
+	MQTT_CLASS_COUNT						///< Number of topic classes
+};
+
+/// @brief MQTT commands, index in the command table
+/// @details The values are used as command IDs on the MessagePack command topic,
+/// so new commands must be added last.
+enum JBWoprMqttCommand {
+	MQTT_COMMAND_DEVICE_STATE = 0,			///< Device state, restart
+	MQTT_COMMAND_CONFIG_TIME_FORMAT,		///< Time format
+	MQTT_COMMAND_CONFIG_DATE_FORMAT,		///< Date format
+	MQTT_COMMAND_CONFIG_DISPLAY_BRIGHTNESS,	///< Default display brightness
+	MQTT_COMMAND_CONFIG_DEFCON_BRIGHTNESS,	///< Default DEFCON LEDs brightness
+	MQTT_COMMAND_CONFIG_EFFECTS_TIMEOUT,	///< Effects timeout
+	MQTT_COMMAND_CONFIG_EFFECTS_SPEED,		///< Effects speed
+	MQTT_COMMAND_CONFIG_USE_WEB_PORTAL,		///< Use web portal
+	MQTT_COMMAND_EFFECT_STATE,				///< Start or stop effect
+	MQTT_COMMAND_EFFECT_NAME,				///< Start effect by name
+	MQTT_COMMAND_EFFECT_ID,					///< Start effect by ID
+	MQTT_COMMAND_EFFECT_SCRIPT,				///< Load script effect
+	MQTT_COMMAND_PLAYLIST_STATE,			///< Start or stop playlist
+	MQTT_COMMAND_PLAYLIST_CONFIG,			///< Set playlist
+	MQTT_COMMAND_DISPLAY_STATE,				///< Display state
+	MQTT_COMMAND_DISPLAY_TEXT,				///< Display text
+	MQTT_COMMAND_DISPLAY_SCROLLTEXT,		///< Display scroll text
+	MQTT_COMMAND_DISPLAY_BRIGHTNESS,		///< Display brightness
+	MQTT_COMMAND_DEFCON_STATE,				///< DEFCON LEDs state
+	MQTT_COMMAND_DEFCON_LEVEL,				///< DEFCON level
+	MQTT_COMMAND_DEFCON_COLOR,				///< DEFCON LEDs color
+	MQTT_COMMAND_DEFCON_BRIGHTNESS,			///< DEFCON LEDs brightness
+	MQTT_COMMAND_BATCH,						///< Batch of commands, applied in one frame
+	MQTT_COMMAND_BINARY,					///< MessagePack commands, applied in one frame
+	MQTT_COMMAND_DIAGNOSTIC_ECHO,			///< Round trip echo, sent by the device itself
+	MQTT_COMMAND_RULES_CONFIG,				///< Set rules
+	MQTT_COMMAND_BINDINGS_CONFIG,			///< Set data bindings, handled by the network task
+	MQTT_COMMAND_COUNT						///< Number of commands
 };
 
 /// @brief W.O.P.R. WiFi and MQTT device class
@@ -99,6 +220,15 @@ public:
 	/// @return True if successful
 	bool mqttPublishMessage(const std::string& topic, const std::string& value, bool retain = false);
 
+	/// @brief MQTT publish message
+	/// @ingroup MqttGroup
+	/// @details This method will publish a message to the MQTT broker.
+	/// @param topic MQTT topic
+	/// @param jsonDoc JSON document
+	/// @param retain Retain message, default value is false
+	/// @return True if successful
+	bool mqttPublishMessage(const char* topic, JsonDocument &jsonDoc, bool retain = false);
+
 	/// @brief MQTT publish message
 	/// @ingroup MqttGroup
 	/// @details This method will publish a message to the MQTT broker.
@@ -106,8 +236,94 @@ public:
 	/// @param value MQTT payload value
 	/// @param retain Retain message, default value is false
 	/// @return True if successful
+	bool mqttPublishMessage(const char* topic, const std::string& value, bool retain = false);
+
+	/// @brief MQTT publish message
+	/// @ingroup MqttGroup
+	/// @details This method will queue a state message for the MQTT broker. A queued
+	/// message to the same topic is replaced, so only the latest state is sent.
+	/// The message is skipped if the last message published to the topic had the
+	/// same payload. Messages queued while disconnected are sent after reconnect.
+	/// @param topic MQTT topic
+	/// @param value MQTT payload value
+	/// @param retain Retain message, default value is false
+	/// @return True if queued
 	bool mqttPublishMessage(const char* topic, const char* value, bool retain = false);
 
+	/// @brief MQTT publish event
+	/// @ingroup MqttGroup
+	/// @details This method will queue an event message for the MQTT broker. Events
+	/// are never replaced or skipped, and are sent in the order they were queued.
+	/// @param topic MQTT topic
+	/// @param value MQTT payload value
+	/// @return True if queued
+	bool mqttPublishEvent(const char* topic, const char* value);
+
+	/// @brief Clear the published messages cache
+	/// @ingroup MqttGroup
+	/// @details The next message to each topic is published even if the payload is
+	/// unchanged. Called when connected to the MQTT broker.
+	void mqttClearPublishCache();
+
+	/// @brief Get number of published messages
+	/// @ingroup MqttGroup
+	/// @return Number of messages sent to the MQTT broker
+	uint32_t mqttGetPublishedCount() const;
+
+	/// @brief Get number of suppressed messages
+	/// @ingroup MqttGroup
+	/// @return Number of messages skipped because the payload was unchanged
+	uint32_t mqttGetSuppressedCount() const;
+
+	/// @brief Get number of queued messages
+	/// @ingroup MqttGroup
+	/// @return Number of messages waiting to be sent
+	size_t mqttGetQueueLength() const;
+
+	/// @brief Get number of dropped messages
+	/// @ingroup MqttGroup
+	/// @return Number of messages dropped because the queue was full
+	uint32_t mqttGetDroppedCount() const;
+
+	/// @brief Get number of coalesced messages
+	/// @ingroup MqttGroup
+	/// @return Number of queued messages replaced by a newer message to the same topic
+	uint32_t mqttGetCoalescedCount() const;
+
+	/// @brief Get max queue latency
+	/// @ingroup MqttGroup
+	/// @return Longest time a message has waited in the queue, milliseconds
+	uint32_t mqttGetMaxLatency() const;
+
+	/// @brief Get client metrics
+	/// @ingroup MqttGroup
+	/// @details Fills the document with publish counters per topic class, failures,
+	/// connection counters and histograms for reconnect time, command latency and
+	/// broker round trip time. This is the document published to the metrics topic.
+	/// Counters are read without locking, so they may be from slightly different moments.
+	/// @param jsonDoc JSON document
+	void mqttGetMetrics(JsonDocument& jsonDoc);
+
+	/// @brief Set min publish interval for topic
+	/// @ingroup MqttGroup
+	/// @details Messages to the topic are sent at most once per interval. Messages queued
+	/// within the interval replace each other, and the last one is sent when the interval
+	/// has passed. Display text, brightness and DEFCON topics default to JBWOPR_MQTT_STATE_INTERVAL.
+	/// @param topic Topic
+	/// @param interval Interval in milliseconds, 0 sends messages at once
+	void mqttSetPublishInterval(JBWoprMqttTopic topic, uint16_t interval);
+
+	/// @brief Get min publish interval for topic
+	/// @ingroup MqttGroup
+	/// @param topic Topic
+	/// @return Interval in milliseconds
+	uint16_t mqttGetPublishInterval(JBWoprMqttTopic topic) const;
+
+	/// @brief Check if connected to the MQTT broker
+	/// @ingroup MqttGroup
+	/// @return True if connected
+	bool mqttIsConnected();
+
 	// ====================================================================
 	// Effects
 	//
@@ -125,17 +341,8 @@ public:
 	/// @param effect Effect
 	void effectsStartEffect(JBWoprEffectBase* effect) override;
 
-	/// @brief Effects start effect
-	/// @ingroup EffectsGroup
-	/// @details This method will start the name effect.
-	/// @param effect Effect name
-	void effectsStartEffect(const std::string& effect) override;
-
-	/// @brief Effects start effect
-	/// @ingroup EffectsGroup
-	/// @details This method will start the named effect.
-	/// @param effect Effect name
-	void effectsStartEffect(const char* effect) override;
+	// Named and ID effect starts resolve the effect and call the method above
+	using JBWoprWiFiDevice::effectsStartEffect;
 
 	// ====================================================================
 	// Display
@@ -316,6 +523,18 @@ protected:
 	const char* JSON_KEY_MQTT_USER_NAME = "mqttUserName";				///< MQTT user name key name
 	const char* JSON_KEY_MQTT_PASSWORD = "mqttPassword";				///< MQTT password key name
 	const char* JSON_KEY_CONF_MQTT_PREFIX = "mqttPrefix";				///< MQTT prefix key name
+	const char* JSON_KEY_MQTT_STATE_DOCUMENT = "mqttStateDocument";	///< Use state document key name
+	const char* JSON_KEY_MQTT_BINARY = "mqttBinary";					///< Use binary topics key name
+	const char* JSON_KEY_MQTT_METRICS_INTERVAL = "mqttMetricsInterval";	///< Metrics interval key name
+	const char* JSON_KEY_MQTT_PERSISTENT_SESSION = "mqttPersistentSession";	///< Persistent session key name
+	const char* JSON_KEY_MQTT_BROADCAST = "mqttBroadcast";				///< Use broadcast topics key name
+	const char* JSON_KEY_MQTT_GROUPS = "mqttGroups";					///< Groups key name
+	const char* JSON_KEY_MQTT_TLS = "mqttTls";							///< Use TLS key name
+	const char* TLS_CA_FILE_NAME = "/mqtt/ca.pem";						///< TLS CA certificate file name
+	const char* TLS_CERT_FILE_NAME = "/mqtt/cert.pem";					///< TLS client certificate file name
+	const char* TLS_KEY_FILE_NAME = "/mqtt/key.pem";					///< TLS client private key file name
+	const char* RULES_FILE_NAME = "/rules.json";						///< Rules file name
+	const char* BINDINGS_FILE_NAME = "/bindings.json";					///< Data bindings file name
 
 	/// @brief Set JBWoprMqttDevice specific config values from JSON document
 	/// @ingroup ConfigurationGroup
@@ -336,9 +555,14 @@ protected:
 	// WiFi
 	//
 	WiFiClient _wifiClient;											///< WiFi client
+	WiFiClientSecure _wifiClientSecure;								///< WiFi client, used if useTls is set
+	std::string _tlsCaCert;											///< TLS CA certificate, PEM, referenced by _wifiClientSecure
+	std::string _tlsClientCert;										///< TLS client certificate, PEM, referenced by _wifiClientSecure
+	std::string _tlsClientKey;										///< TLS client private key, PEM, referenced by _wifiClientSecure
 
 	const char* HTML_MQTT_TITLE = "<h2>MQTT settings</h2>";			///< MQTT title
 	char _mqttServerPortValue[6];									///< MQTT server port value
+	char _mqttMetricsIntervalValue[6];								///< Metrics interval value
 
 	// WifiManager parameters
 	WiFiManagerParameter* _mqttTitleParam;							///< MQTT title WiFiManager parameter
@@ -348,6 +572,13 @@ protected:
 	WiFiManagerParameter* _mqttUserNameParam;						///< MQTT user name WiFiManager parameter
 	WiFiManagerParameter* _mqttPasswordParam;						///< MQTT password WiFiManager parameter
 	WiFiManagerParameter* _mqttPrefixParam;							///< MQTT prefix WiFiManager parameter
+	WiFiManagerParameter* _mqttStateDocumentParam;					///< Use state document WiFiManager parameter
+	WiFiManagerParameter* _mqttBinaryParam;							///< Use binary topics WiFiManager parameter
+	WiFiManagerParameter* _mqttMetricsIntervalParam;				///< Metrics interval WiFiManager parameter
+	WiFiManagerParameter* _mqttPersistentSessionParam;				///< Persistent session WiFiManager parameter
+	WiFiManagerParameter* _mqttBroadcastParam;						///< Use broadcast topics WiFiManager parameter
+	WiFiManagerParameter* _mqttGroupsParam;							///< Groups WiFiManager parameter
+	WiFiManagerParameter* _mqttTlsParam;							///< Use TLS WiFiManager parameter
 	WiFiManagerParameter* _break2Param;								///< Break  WiFiManagerparameter
 
 	/// @brief Setup WiFiManager
@@ -355,23 +586,138 @@ protected:
 	/// @details This method will setup WiFiManager.
 	void _setupWiFiManager() override;
 
-	/// @brief Set WiFiManager parameter callback
+	/// @brief Set JSON document values from WiFiManager parameters
 	/// @ingroup WiFiGroup
-	/// @details This method will set the WiFiManager parameter callback.
-	/// This will be called when the user clicks Save in the configuration portal.
-	void _saveParamsCallback() override;
+	/// @details Called from loop() when the user clicks Save in the configuration portal.
+	/// @param jsonDoc JSON document
+	void _setJsonDocumentFromParams(JsonDocument &jsonDoc) override;
 
 	// ====================================================================
 	// MQTT
 	//
 	PubSubClient* _mqttClient;											///< MQTT client
-	bool _mqttActive = false;											///< MQTT active flag, set tp true after initialization
+	std::atomic<bool> _mqttActive { false };							///< MQTT active flag, set tp true after initialization
+	std::unordered_map<uint32_t, uint32_t> _mqttPublishCache;			///< Hash of last payload, keyed by topic hash
+	uint32_t _mqttPublishedCount = 0;									///< Number of published messages
+	uint32_t _mqttSuppressedCount = 0;									///< Number of suppressed messages
+	std::string _mqttTopicBase;											///< Topic prefix, <mqtt_prefix>/<device_id>/
+	std::string _mqttTopics;											///< Topic table, null separated topics
+	uint16_t _mqttTopicOffsets[MQTT_TOPIC_COUNT] {};					///< Offset of each topic in topic table
+	std::vector<std::string> _mqttGroupTopicBases;						///< Broadcast and group topic prefixes, <mqtt_prefix>/group/<name>/
+	JsonDocument _mqttScheduledBatch;									///< Command batch waiting for its scheduled time
+	uint64_t _mqttScheduledTime = 0;									///< Scheduled time of _mqttScheduledBatch, Unix time in milliseconds
+
+	/// @brief Command table entry
+	struct MqttCommandEntry {
+		uint32_t hash;													///< Hash of <entity>/<subentity>/<command>
+		const char* entity;												///< Entity name
+		const char* subEntity;											///< Sub entity name
+		JBWoprMqttCommand command;										///< Command
+	};
+	MqttCommandEntry _mqttCommands[MQTT_COMMAND_COUNT] {};				///< Command table, sorted by hash
+	uint32_t _mqttCommandHashes[MQTT_COMMAND_COUNT] {};					///< Hash of <entity>/<subentity>/set, in JBWoprMqttCommand order
+	std::atomic<bool> _mqttConnected { false };							///< True while connected to the broker
+	uint32_t _mqttRetryTime = 0;										///< Time of next connection attempt
+	uint32_t _mqttRetryDelay = 0;										///< Current reconnect delay, milliseconds
+	uint8_t _mqttFailedAttempts = 0;									///< Failed attempts since server name was resolved
+	JBRandom _mqttRandom;												///< Random generator for reconnect jitter, used by network task
+	IPAddress _mqttServerAddress;										///< Cached MQTT server address
+	bool _mqttServerResolved = false;									///< True if _mqttServerAddress is valid
+
+	/// @brief Outbound queue entry
+	struct MqttQueueEntry {
+		std::string topic;												///< Topic
+		std::string payload;											///< Payload
+		uint32_t topicHash;												///< Hash of topic
+		uint32_t queueTime;												///< Time when first queued
+		bool retain;													///< Retain message
+		bool coalesce;													///< Replaced by newer message to the same topic
+		uint8_t topicIndex;												///< JBWoprMqttTopic, MQTT_TOPIC_COUNT if not in topic table
+	};
+	/// @brief Received command, passed from the network task to loop()
+	struct MqttCommandMessage {
+		JBWoprMqttCommand command;										///< Command
+		std::string payload;											///< Payload
+		uint32_t receiveTime;											///< Time when received, microseconds
+	};
+	JBSpscQueue<MqttQueueEntry, JBWOPR_MQTT_QUEUE_SIZE> _mqttOutbox;	///< Messages from loop() to the network task
+	JBSpscQueue<MqttCommandMessage, JBWOPR_MQTT_COMMAND_QUEUE_SIZE> _mqttCommandQueue;	///< Commands from the network task to loop()
+	std::deque<MqttQueueEntry> _mqttQueue;								///< Outbound queue, used by network task
+	std::atomic<size_t> _mqttQueueLength { 0 };							///< Number of messages in _mqttQueue
+	uint16_t _mqttPublishIntervals[MQTT_TOPIC_COUNT] {};				///< Min publish interval per topic, milliseconds
+	uint32_t _mqttPublishTimes[MQTT_TOPIC_COUNT] {};					///< Last publish time per topic
+	bool _mqttDirectPublish = false;									///< True while messages are sent without queueing
+	bool _mqttEffectRunning = true;										///< Effect state last published from loop()
+	bool _mqttBatchActive = false;										///< True while a command batch is applied
+	uint16_t _mqttBatchChanges = 0;										///< JBWoprMqttStateField bits changed by the command batch
+	bool _mqttBatchFrame = false;										///< True if the command batch started the frame
+	std::atomic<uint16_t> _mqttBinaryChanges { 0 };					///< JBWoprMqttStateField bits changed since last binary state
+	uint32_t _mqttBinaryTime = 0;										///< Time of last binary state
+
+	// Metrics
+	uint32_t _mqttClassCounts[MQTT_CLASS_COUNT] {};					///< Published messages per topic class
+	uint32_t _mqttClassBytes[MQTT_CLASS_COUNT] {};						///< Published payload bytes per topic class
+	uint32_t _mqttFailedCount = 0;										///< Number of failed publishes
+	uint32_t _mqttConnectCount = 0;										///< Number of successful connections
+	uint32_t _mqttConnectFailedCount = 0;								///< Number of failed connection attempts
+	uint32_t _mqttDisconnectCount = 0;									///< Number of lost connections
+	uint32_t _mqttDisconnectTime = 0;									///< Time when connection was lost
+	JBHistogram _mqttReconnectHistogram;								///< Time from lost connection to reconnected, milliseconds
+	JBHistogram _mqttHandshakeHistogram;								///< TCP connect and TLS handshake time, milliseconds
+	JBHistogram _mqttCommandHistogram;									///< Time from receiving to handling a command, microseconds
+	JBHistogram _mqttRoundTripHistogram;								///< Broker round trip time, milliseconds
+	uint32_t _mqttMetricsTime = 0;										///< Time of last metrics message
+	std::string _mqttEchoTopic;											///< Round trip echo topic
+	uint32_t _mqttResumedCount = 0;										///< Number of connections that resumed the session
+	JBHistogram _mqttReconnectBytesHistogram;							///< Bytes published after connecting, until the queue is empty
+	uint32_t _mqttReconnectBytes = 0;									///< Published bytes when the connection was made
+	bool _mqttReconnectMeasuring = false;								///< True until the queue is empty after connecting
+
+	// Session
+	bool _mqttHasSession = false;										///< True if the broker has a persistent session for this device
+	bool _mqttSessionResumed = false;									///< True if the current connection resumed the session
+
+	// Rules
+	JBWoprRules _rules;													///< Rules engine
+	JBWoprEffectBase* _rulesEffect = nullptr;							///< Running effect, for effect finished rules
+	uint32_t _rulesEffectHash = 0;										///< Hash of running effect name
+	int16_t _rulesMinute = -1;											///< Minute of day of last time rule check, -1 before first check
+	uint32_t _rulesTime = 0;											///< Time of last time rule check
+
+	// Data bindings
+	JBWoprBindings _bindings;											///< Data bindings, used by network task
+	std::vector<std::string> _mqttBindingTopics;						///< Subscribed binding topics
+	std::atomic<bool> _mqttBindingsChanged { false };					///< True if binding subscriptions must be updated
+	JBSpscQueue<JBWoprBindings::Render, JBWOPR_MQTT_BINDING_QUEUE_SIZE> _mqttBindingQueue;	///< Rendered bindings from the network task to loop()
+	JBWoprBindings::Render _mqttBindingRenders[JBWOPR_BINDINGS_MAX];	///< Latest rendered value per binding, used by loop()
+	bool _mqttSessionProbe = false;										///< True while waiting for the echo that confirms the session
+	uint32_t _mqttSessionProbeTime = 0;									///< Time when the session probe was sent
+	std::atomic<uint16_t> _mqttStateChanges { 0 };						///< JBWoprMqttStateField bits changed since last state document
+	uint32_t _mqttStateTime = 0;										///< Time of last state document
+	std::string _mqttStateText;											///< Display text, for the state document
+	std::string _mqttStateScrollText;									///< Display scroll text, for the state document
+	uint8_t _mqttStateDisplayBrightness = 100;							///< Display brightness 0-100, for the state document
+	uint8_t _mqttStateDefconBrightness = 100;							///< DEFCON LEDs brightness 0-100, for the state document
+	std::atomic<uint32_t> _mqttDroppedCount { 0 };						///< Number of dropped messages
+	uint32_t _mqttCoalescedCount = 0;									///< Number of coalesced messages
+	uint32_t _mqttMaxLatency = 0;										///< Longest queue latency, milliseconds
 
 	const char* ENTITY_NAME_DEVICE = "device";							///< Device entity name
 	const char* ENTITY_NAME_CONFIG = "config";							///< Config entity name
+	const char* ENTITY_NAME_DIAGNOSTIC = "diagnostic";					///< Diagnostics entity name
+	const char* ENTITY_NAME_AVAILABILITY = "availability";				///< Availability entity name
+	const char* ENTITY_NAME_STATE = "state";							///< State document entity name
+	const char* ENTITY_NAME_COMMAND = "command";						///< Command entity name
+	const char* ENTITY_NAME_BINARY = "bin";								///< MessagePack entity name
+	const char* ENTITY_NAME_SUBSCRIPTION = "+/+/+";						///< Subscription, matches <entity>/<subentity>/<command>
+	const char* GROUP_NAME_ALL = "all";									///< Broadcast topic name
+	const char* GROUP_NAME_GROUP = "group";								///< Group topic name
 	const char* ENTITY_NAME_EFFECT = "effect";							///< Effect entity name
 	const char* ENTITY_NAME_DISPLAY = "display";						///< Display text entity name
 	const char* ENTITY_NAME_DEFCON = "defcon";							///< DEFCON LED entity name
+	const char* ENTITY_NAME_PLAYLIST = "playlist";						///< Playlist entity name
+	const char* ENTITY_NAME_RULES = "rules";							///< Rules entity name
+	const char* ENTITY_NAME_BINDINGS = "bindings";						///< Data bindings entity name
 	const char* ENTITY_NAME_BUTTON_FRONT_LEFT = "button_front_left";	///< Button front left entity name
 	const char* ENTITY_NAME_BUTTON_FRONT_RIGHT = "button_front_right";	///< Button front right entity name
 	const char* ENTITY_NAME_BUTTON_BACK_TOP = "button_back_top";		///< Button back top entity name
@@ -385,7 +731,15 @@ protected:
 	const char* SUBENTITY_NAME_EVENT = "event";							///< Event subentity name
 	const char* SUBENTITY_NAME_LEVEL = "level";							///< Level subentity name
 	const char* SUBENTITY_NAME_NAME = "name";							///< Effect subentity name
+	const char* SUBENTITY_NAME_ID = "id";								///< Effect ID subentity name
+	const char* SUBENTITY_NAME_SCRIPT = "script";						///< Effect script subentity name
+	const char* SUBENTITY_NAME_CONFIG = "config";						///< Playlist config subentity name
+	const char* SUBENTITY_NAME_BATCH = "batch";							///< Command batch subentity name
+	const char* SUBENTITY_NAME_COMMAND = "command";						///< MessagePack command subentity name
+	const char* SUBENTITY_NAME_METRICS = "metrics";						///< Metrics subentity name
+	const char* SUBENTITY_NAME_ECHO = "echo";							///< Round trip echo subentity name
 	const char* SUBENTITY_NAME_EFFECTS_TIMEOUT = "effects_timeout";		///< Effects timeout key name
+	const char* SUBENTITY_NAME_EFFECTS_SPEED = "effects_speed";			///< Effects speed key name
 	const char* SUBENTITY_NAME_TIME_FORMAT = "time_format";				///< Time format key name
 	const char* SUBENTITY_NAME_DATE_FORMAT = "date_format";				///< Date Format key name
 	const char* SUBENTITY_NAME_DEFCON_BRIGHTNESS = "defcon_brightness";	///< DEFCON LEDs brightness key name
@@ -401,12 +755,50 @@ protected:
 
 	const char* COMMAND_SET = "set";									///< Set command
 
+	const char* JSON_KEY_STATE_EFFECT = "effect";						///< State document effect state key name
+	const char* JSON_KEY_STATE_EFFECT_NAME = "effectName";				///< State document effect name key name
+	const char* JSON_KEY_STATE_EFFECT_ID = "effectId";					///< State document effect ID key name
+	const char* JSON_KEY_STATE_DISPLAY = "display";					///< State document display state key name
+	const char* JSON_KEY_STATE_DISPLAY_TEXT = "text";					///< State document display text key name
+	const char* JSON_KEY_STATE_DISPLAY_SCROLLTEXT = "scrollText";		///< State document scroll text key name
+	const char* JSON_KEY_STATE_DISPLAY_BRIGHTNESS = "displayBrightness";	///< State document display brightness key name
+	const char* JSON_KEY_STATE_DEFCON = "defcon";						///< State document DEFCON state key name
+	const char* JSON_KEY_STATE_DEFCON_LEVEL = "defconLevel";			///< State document DEFCON level key name
+	const char* JSON_KEY_STATE_DEFCON_COLOR = "defconColor";			///< State document DEFCON color key name
+	const char* JSON_KEY_STATE_DEFCON_BRIGHTNESS = "defconBrightness";	///< State document DEFCON brightness key name
+	const char* JSON_KEY_STATE_CHANGED = "changed";					///< State document change mask key name
+	const char* JSON_KEY_BATCH_COMMAND = "command";					///< Batch entry command key name
+	const char* JSON_KEY_BATCH_VALUE = "value";						///< Batch entry value key name
+	const char* JSON_KEY_BATCH_AT = "at";								///< Batch scheduled time key name
+	const char* JSON_KEY_BATCH_COMMANDS = "commands";					///< Batch commands key name
+	const char* CLASS_NAMES[MQTT_CLASS_COUNT] { "state", "event", "diagnostic", "other" };	///< Topic class names, in JBWoprMqttTopicClass order
+
 	/// @brief Start MQTT
 	/// @ingroup MqttGroup
 	/// @details This method will initialize the MQTT client.
 	/// @return True if successful
 	bool _mqttStart();
 
+	/// @brief Load TLS credentials
+	/// @ingroup MqttGroup
+	/// @details Reads the CA certificate, and the optional client certificate and key,
+	/// from LittleFS once, so they are not read again on each reconnect.
+	/// @return True if the CA certificate was loaded
+	bool _mqttLoadTlsCredentials();
+
+	/// @brief Read file from LittleFS
+	/// @ingroup MqttGroup
+	/// @param fileName File name
+	/// @param content File content
+	/// @return True if the file was read
+	bool _readFile(const char* fileName, std::string& content);
+
+	/// @brief Build topic and command tables
+	/// @ingroup MqttGroup
+	/// @details Called when MQTT is started and when the configuration is changed,
+	/// so topics are not built when publishing or parsed when receiving.
+	void _mqttBuildTopics();
+
 	/// @brief Stop MQTT
 	/// @ingroup MqttGroup
 	/// @details This method will stop the MQTT client.
@@ -414,15 +806,169 @@ protected:
 
 	/// @brief Reconnect MQTT
 	/// @ingroup MqttGroup
-	/// @details This method will check if connection is lost and try to reconnect
-	/// the MQTT client as needed.
+	/// @details This method will check if connection is lost, and make one connection
+	/// attempt when the reconnect delay has passed. It returns at once while waiting,
+	/// so effects and buttons keep running while the broker is down.
+	/// @return True if connected
 	bool _mqttReconnect();
 
+	/// @brief Connect to MQTT broker
+	/// @ingroup MqttGroup
+	/// @details Makes one connection attempt, using the cached server address.
+	/// @return True if connected
+	bool _mqttConnect();
+
+	/// @brief Schedule next connection attempt
+	/// @ingroup MqttGroup
+	/// @details The delay is doubled for each failed attempt, up to JBWOPR_MQTT_RETRY_MAX,
+	/// with random jitter so several devices do not reconnect at the same time.
+	void _mqttScheduleReconnect();
+
 	/// @brief Called when MQTT client get connected
 	/// @ingroup MqttGroup
 	/// @details This method will be called when the MQTT client is connected.
+	/// Messages published from it are sent at once, before the queued messages.
+	/// If _mqttSessionResumed is set, the broker still has the subscription and
+	/// retained state, so only changed state needs to be published.
 	virtual bool _onMqttConnect();
 
+	/// @brief Start MQTT session
+	/// @ingroup MqttGroup
+	/// @details Calls _onMqttConnect() with _mqttDirectPublish set, and starts
+	/// measuring the bytes published after connecting.
+	void _mqttStartSession();
+
+	/// @brief Get total published bytes
+	/// @ingroup MqttGroup
+	/// @return Bytes published on all topic classes
+	uint32_t _mqttGetPublishedBytes() const;
+
+	/// @brief Add message to outbound queue
+	/// @ingroup MqttGroup
+	/// @details When the queue is full the oldest message is dropped.
+	/// @param topic MQTT topic
+	/// @param value MQTT payload value
+	/// @param retain Retain message
+	/// @param coalesce Replace queued message to the same topic
+	/// @return True if queued, or sent if called from the network task or _mqttDirectPublish is set
+	bool _mqttQueueMessage(const char* topic, std::string value, bool retain, bool coalesce);
+
+	/// @brief Get topic table index of topic
+	/// @ingroup MqttGroup
+	/// @param topic Topic, as returned by _getTopic(JBWoprMqttTopic)
+	/// @return Topic, MQTT_TOPIC_COUNT if the topic does not point into the topic table
+	uint8_t _getTopicIndex(const char* topic) const;
+
+	/// @brief Get topic class
+	/// @ingroup MqttGroup
+	/// @param topicIndex JBWoprMqttTopic, MQTT_TOPIC_COUNT if not in topic table
+	/// @return Topic class
+	JBWoprMqttTopicClass _getTopicClass(uint8_t topicIndex) const;
+
+	/// @brief Count published message
+	/// @ingroup MqttGroup
+	/// @param topic MQTT topic
+	/// @param length Payload length
+	void _mqttCountPublish(const char* topic, size_t length);
+
+	/// @brief Publish metrics
+	/// @ingroup MqttGroup
+	/// @details Sends a round trip echo and the metrics document. Called from
+	/// _networkLoop() every metricsInterval seconds while connected.
+	void _mqttPublishMetrics();
+
+	/// @brief Handle round trip echo
+	/// @ingroup MqttGroup
+	/// @param payload Payload, send time in milliseconds
+	void _mqttHandleEcho(const JBStringView& payload);
+
+	/// @brief Set JSON object from histogram
+	/// @ingroup MqttGroup
+	/// @param jsonObject JSON object
+	/// @param histogram Histogram
+	void _setHistogramJson(JsonObject jsonObject, const JBHistogram& histogram);
+
+	/// @brief Check if messages are sent without queueing
+	/// @ingroup MqttGroup
+	/// @return True if called from the network task, or from _onMqttConnect() without a network task
+	bool _mqttIsDirectPublish() const;
+
+	/// @brief Send queued messages
+	/// @ingroup MqttGroup
+	/// @details Moves messages from the outbox to the outbound queue, coalescing state
+	/// messages, then sends up to JBWOPR_MQTT_BATCH_SIZE messages if connected.
+	/// Called from _networkLoop().
+	void _mqttFlushQueue();
+
+	/// @brief Run network work
+	/// @ingroup MqttGroup
+	/// @details Reconnects, runs the MQTT client and sends queued messages.
+	void _networkLoop() override;
+
+	/// @brief Send message to MQTT broker
+	/// @ingroup MqttGroup
+	/// @param topic MQTT topic
+	/// @param value MQTT payload value, may contain null characters
+	/// @param length Length of payload
+	/// @param retain Retain message
+	/// @param useCache Skip message if payload is unchanged
+	/// @return True if successful, or if the payload is unchanged
+	bool _mqttSendMessage(const char* topic, const char* value, size_t length, bool retain, bool useCache);
+
+	/// @brief Send JSON message to MQTT broker
+	/// @ingroup MqttGroup
+	/// @details The document is serialized straight into the MQTT client, without
+	/// an intermediate buffer. The message is skipped if the payload is unchanged.
+	/// @param topic MQTT topic
+	/// @param jsonDoc JSON document
+	/// @param retain Retain message
+	/// @return True if successful, or if the payload is unchanged
+	bool _mqttSendMessage(const char* topic, JsonDocument &jsonDoc, bool retain);
+
+	/// @brief Check publish cache
+	/// @ingroup MqttGroup
+	/// @param topicHash Hash of topic
+	/// @param valueHash Hash of payload
+	/// @return True if the payload was the last payload published to the topic
+	bool _mqttIsPublished(uint32_t topicHash, uint32_t valueHash);
+
+	/// @brief Defer state publish
+	/// @ingroup MqttGroup
+	/// @details Marks the fields as changed if the state document is used, or if
+	/// a command batch is applied.
+	/// @param fields JBWoprMqttStateField bits
+	/// @return True if deferred, false if the fields should be published now
+	bool _mqttDeferState(uint16_t fields);
+
+	/// @brief Publish state value
+	/// @ingroup MqttGroup
+	/// @details Publishes the value to its state topic, unless deferred by _mqttDeferState().
+	/// @param field JBWoprMqttStateField
+	/// @param topic State topic
+	/// @param value MQTT payload value
+	void _mqttPublishState(JBWoprMqttStateField field, JBWoprMqttTopic topic, const char* value);
+
+	/// @brief Publish JSON state document
+	/// @ingroup MqttGroup
+	/// @details The document always holds all fields, so the retained message is
+	/// complete. The change mask tells which fields changed since the last document.
+	/// @param changes JBWoprMqttStateField bits
+	/// @return True if successful
+	bool _mqttPublishStateDocument(uint16_t changes);
+
+	/// @brief Publish state topics
+	/// @ingroup MqttGroup
+	/// @details Publishes the current value of each field to its state topic.
+	/// @param fields JBWoprMqttStateField bits
+	void _mqttPublishStateFields(uint16_t fields);
+
+	/// @brief Publish MessagePack state
+	/// @ingroup MqttGroup
+	/// @details Publishes all fields as a MessagePack array, see README for the schema.
+	/// @param changes JBWoprMqttStateField bits
+	/// @return True if successful
+	bool _mqttPublishBinaryState(uint16_t changes);
+
 	/// @brief MQTT callback
 	/// @ingroup MqttGroup
 	/// @details This method is the callback for the MQTT client, and will
@@ -435,75 +981,183 @@ protected:
 	/// @brief Handle MQTT command message
 	/// @ingroup MqttGroup
 	/// @details This method will handle incoming MQTT command messages.
-	/// @param entity Entity name
-	/// @param subEntity Sub entity name
 	/// @param command Command
-	/// @param payload Payload
-	virtual void _handleCommand(const std::string& entity, const std::string& subEntity, const std::string& command, const std::string& payload);
+	/// @param payload Payload, not null terminated
+	virtual void _handleCommand(JBWoprMqttCommand command, const JBStringView& payload);
 
 	/// @brief Handle MQTT device command message
 	/// @ingroup MqttGroup
 	/// @details This method will handle incoming MQTT device command messages.
-	/// @param subEntity Sub entity name
 	/// @param command Command
-	/// @param payload Payload
-	virtual void _handleDeviceCommand(const std::string& subEntity, const std::string& command, const std::string& payload);
+	/// @param payload Payload, not null terminated
+	virtual void _handleDeviceCommand(JBWoprMqttCommand command, const JBStringView& payload);
 
 	/// @brief Handle MQTT config command message
 	/// @ingroup MqttGroup
 	/// @details This method will handle incoming MQTT config command messages.
-	/// @param subEntity Sub entity name
 	/// @param command Command
-	/// @param payload Payload
-	virtual void _handleConfigCommand(const std::string& subEntity, const std::string& command, const std::string& payload);
+	/// @param payload Payload, not null terminated
+	virtual void _handleConfigCommand(JBWoprMqttCommand command, const JBStringView& payload);
 
 	/// @brief Handle MQTT effect command message
 	/// @ingroup MqttGroup
 	/// @details This method will handle incoming MQTT effect command messages.
-	/// @param subEntity Sub entity name
 	/// @param command Command
+	/// @param payload Payload, not null terminated
+	virtual void _handleEffectCommand(JBWoprMqttCommand command, const JBStringView& payload);
+
+	/// @brief Handle MQTT playlist command message
+	/// @ingroup MqttGroup
+	/// @details This method will handle incoming MQTT playlist command messages.
+	/// @param command Command
+	/// @param payload Payload, not null terminated
+	virtual void _handlePlaylistCommand(JBWoprMqttCommand command, const JBStringView& payload);
+
+	/// @brief Handle MQTT rules command message
+	/// @ingroup MqttGroup
+	/// @details Compiles the rules, saves them to LittleFS and publishes them retained.
+	/// @param payload Payload, not null terminated
+	void _handleRulesCommand(const JBStringView& payload);
+
+	/// @brief Load rules from LittleFS
+	/// @ingroup MqttGroup
+	void _loadRules();
+
+	/// @brief Handle MQTT data bindings command message
+	/// @ingroup MqttGroup
+	/// @details Called from _mqttCallback(), as the bindings are used by the network task.
+	/// Compiles the bindings, saves them to LittleFS and publishes them retained.
+	/// Subscriptions are updated from _networkLoop().
+	/// @param payload Payload, not null terminated
+	void _handleBindingsCommand(const JBStringView& payload);
+
+	/// @brief Load data bindings from LittleFS
+	/// @ingroup MqttGroup
+	void _loadBindings();
+
+	/// @brief Update binding subscriptions
+	/// @ingroup MqttGroup
+	/// @details Unsubscribes topics that are no longer bound, and subscribes to all bound topics.
+	void _mqttSubscribeBindings();
+
+	/// @brief Handle message on a bound topic
+	/// @ingroup MqttGroup
+	/// @details The payload is parsed and rendered here, and only a changed result is
+	/// passed to loop().
+	/// @param index Binding index
 	/// @param payload Payload
-	virtual void _handleEffectCommand(const std::string& subEntity, const std::string& command, const std::string& payload);
+	/// @param length Payload length
+	void _mqttHandleBinding(uint8_t index, const byte* payload, unsigned int length);
+
+	/// @brief Show rendered binding
+	/// @ingroup MqttGroup
+	/// @param render Rendered binding
+	void _renderBinding(const JBWoprBindings::Render& render);
+
+	/// @brief Run time of day and effect finished rules
+	/// @ingroup MqttGroup
+	/// @details Called from loop().
+	void _rulesLoop();
 
 	/// @brief Handle MQTT display command message
 	/// @ingroup MqttGroup
 	/// @details This method will handle incoming MQTT display command messages.
-	/// @param subEntity Sub entity name
 	/// @param command Command
-	/// @param payload Payload
-	virtual void _handleDisplayCommand(const std::string& subEntity, const std::string& command, const std::string& payload);
+	/// @param payload Payload, not null terminated
+	virtual void _handleDisplayCommand(JBWoprMqttCommand command, const JBStringView& payload);
 
 	/// @brief Handle MQTT defcon command message
 	/// @ingroup MqttGroup
 	/// @details This method will handle incoming MQTT defcon command messages.
-	/// @param subEntity Sub entity name
 	/// @param command Command
+	/// @param payload Payload, not null terminated
+	virtual void _handleDefconCommand(JBWoprMqttCommand command, const JBStringView& payload);
+
+	/// @brief Handle MQTT command batch
+	/// @ingroup MqttGroup
+	/// @details The payload is a JSON array of commands, for example
+	/// `[{"command":"display/text","value":"HELLO"},{"command":"defcon/level","value":"DEFCON 3"}]`.
+	/// All commands are applied in one frame, so the display and DEFCON LEDs are
+	/// written once and state is published once per changed field.
+	/// @param payload Payload, not null terminated
+	void _handleBatchCommand(const JBStringView& payload);
+
+	/// @brief Apply command batch
+	/// @ingroup MqttGroup
+	/// @param items Array of `{ "command": ..., "value": ... }` entries
+	void _applyBatch(JsonArrayConst items);
+
+	/// @brief Get current time
+	/// @ingroup MqttGroup
+	/// @return Unix time in milliseconds, 0 if the clock is not synchronized
+	uint64_t _getUnixTimeMs() const;
+
+	/// @brief Find command topic
+	/// @ingroup MqttGroup
+	/// @details Matches the device topic prefix, then the broadcast and group prefixes.
+	/// @param topic Received topic
+	/// @param isGroup Set to true if a broadcast or group prefix matched
+	/// @return Topic without prefix, nullptr if no prefix matched
+	const char* _getCommandTopic(const char* topic, bool& isGroup) const;
+
+	/// @brief Handle MessagePack commands
+	/// @ingroup MqttGroup
+	/// @details The payload is a MessagePack array of `[command, value]` arrays, where
+	/// command is a JBWoprMqttCommand. Values are decoded in place, without allocating
+	/// memory for display, DEFCON and effect ID commands. Other commands are passed
+	/// to _handleCommand() as text. All commands are applied in one frame.
 	/// @param payload Payload
-	virtual void _handleDefconCommand(const std::string& subEntity, const std::string& command, const std::string& payload);
+	void _handleBinaryCommand(const JBStringView& payload);
 
-	/// @brief Get publish topic for specified entity
+	/// @brief Apply one MessagePack command
 	/// @ingroup MqttGroup
-	/// @param entityId Entity ID
-	/// @param subEntityId Sub entity ID
-	/// @return Topic
-	virtual std::string _getTopic(const char * entityId, const char* subEntityId);
+	/// @param command Command
+	/// @param reader Reader, positioned at the command value
+	/// @return False if the value has the wrong type
+	bool _handleBinaryValue(JBWoprMqttCommand command, JBMsgPackReader& reader);
+
+	/// @brief Begin command batch
+	/// @ingroup MqttGroup
+	/// @details Defers display and DEFCON LED output, and state publishing, until _mqttEndBatch().
+	/// @return False if a batch is already active
+	bool _mqttBeginBatch();
+
+	/// @brief End command batch
+	/// @ingroup MqttGroup
+	/// @details Writes deferred output and publishes the changed state once.
+	void _mqttEndBatch();
+
+	/// @brief Find command for topic
+	/// @ingroup MqttGroup
+	/// @details The topic is matched in place, using the command hash table.
+	/// @param topic Topic, without <mqttprefix>/<deviceid>/
+	/// @return Command, MQTT_COMMAND_COUNT if not found
+	JBWoprMqttCommand _findCommand(const char* topic) const;
+
+	/// @brief Get topic from topic table
+	/// @ingroup MqttGroup
+	/// @param topic Topic
+	/// @return Topic, valid until the topic table is rebuilt
+	const char* _getTopic(JBWoprMqttTopic topic) const;
 
-	/// @brief Get publish topic for specified entity
+	/// @brief Build topic for specified entity
 	/// @ingroup MqttGroup
+	/// @details Use _getTopic(JBWoprMqttTopic) for topics in the topic table.
 	/// @param entityId Entity ID
 	/// @param subEntityId Sub entity ID
+	/// @param command (optional) Command, appended if not empty
 	/// @return Topic
-	virtual std::string _getTopic(const std::string& entityId, const std::string& subEntityId);
+	std::string _getTopic(const char* entityId, const char* subEntityId, const char* command = "") const;
 
 	/// @brief Get subscription topic
 	/// @ingroup MqttGroup
 	/// @return Subscription topic
-	virtual std::string _getSubscriptionTopic();
+	const char* _getSubscriptionTopic() const;
 
 	/// @brief Get availability topic
 	/// @ingroup MqttGroup
 	/// @return Availability topic
-	virtual std::string _getAvailabilityTopic();
+	const char* _getAvailabilityTopic() const;
 
 	// ====================================================================
 	// Buttons
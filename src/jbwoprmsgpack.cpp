@@ -0,0 +1,335 @@
+/// @file jbwoprmsgpack.cpp
+/// @author Jonny Bergdahl
+/// @brief Source file for the JBMsgPackReader and JBMsgPackWriter classes.
+/// @details Contains implementation of the MessagePack codec.
+/// This code is distributed under the MIT License. See LICENSE for details.
+/// @date Created: 2026-10-18
+/// @copyright Copyright© 2026, Jonny Bergdahl
+///
+#include "jbwoprmsgpack.h"
+#include <cstring>
+
+// ====================================================================
+// Reader
+//
+JBMsgPackReader::JBMsgPackReader(const uint8_t* data, size_t length) : _data(data), _length(length) {
+}
+
+JBMsgPackType JBMsgPackReader::peek() const {
+	if (_position >= _length) {
+		return MSGPACK_NONE;
+	}
+	uint8_t b = _data[_position];
+	if (b <= 0x7f || (b >= 0xcc && b <= 0xcf)) {
+		return MSGPACK_UINT;
+	}
+	if (b >= 0xe0 || (b >= 0xd0 && b <= 0xd3)) {
+		return MSGPACK_INT;
+	}
+	if ((b & 0xe0) == 0xa0 || (b >= 0xd9 && b <= 0xdb)) {
+		return MSGPACK_STRING;
+	}
+	if ((b & 0xf0) == 0x90 || b == 0xdc || b == 0xdd) {
+		return MSGPACK_ARRAY;
+	}
+	if ((b & 0xf0) == 0x80 || b == 0xde || b == 0xdf) {
+		return MSGPACK_MAP;
+	}
+	if (b == 0xc0) {
+		return MSGPACK_NIL;
+	}
+	if (b == 0xc2 || b == 0xc3) {
+		return MSGPACK_BOOL;
+	}
+	return MSGPACK_OTHER;
+}
+
+bool JBMsgPackReader::atEnd() const {
+	return _position >= _length;
+}
+
+bool JBMsgPackReader::readNil() {
+	if (peek() != MSGPACK_NIL) {
+		return false;
+	}
+	_position++;
+	return true;
+}
+
+bool JBMsgPackReader::readBool(bool& value) {
+	if (peek() != MSGPACK_BOOL) {
+		return false;
+	}
+	value = _data[_position++] == 0xc3;
+	return true;
+}
+
+bool JBMsgPackReader::readUInt(uint32_t& value) {
+	size_t position = _position;
+	int64_t result;
+	if (!_readInteger(result) || result < 0 || result > UINT32_MAX) {
+		_position = position;
+		return false;
+	}
+	value = (uint32_t)result;
+	return true;
+}
+
+bool JBMsgPackReader::readInt(int32_t& value) {
+	size_t position = _position;
+	int64_t result;
+	if (!_readInteger(result) || result < INT32_MIN || result > INT32_MAX) {
+		_position = position;
+		return false;
+	}
+	value = (int32_t)result;
+	return true;
+}
+
+bool JBMsgPackReader::readString(JBStringView& value) {
+	if (peek() != MSGPACK_STRING) {
+		return false;
+	}
+	uint8_t b = _data[_position];
+	size_t header = b == 0xd9 ? 2 : b == 0xda ? 3 : b == 0xdb ? 5 : 1;
+	size_t size = header == 1 ? (b & 0x1f) : 0;
+	if ((header > 1 && !_readLength(header - 1, size)) || _length - _position - header < size) {
+		return false;
+	}
+	value = { reinterpret_cast<const char*>(_data + _position + header), size };
+	_position += header + size;
+	return true;
+}
+
+bool JBMsgPackReader::readArray(size_t& size) {
+	if (peek() != MSGPACK_ARRAY) {
+		return false;
+	}
+	uint8_t b = _data[_position];
+	size_t header = b == 0xdc ? 3 : b == 0xdd ? 5 : 1;
+	size_t result = header == 1 ? (b & 0x0f) : 0;
+	if (header > 1 && !_readLength(header - 1, result)) {
+		return false;
+	}
+	size = result;
+	_position += header;
+	return true;
+}
+
+bool JBMsgPackReader::skip() {
+	size_t position = _position;
+	size_t pending = 1;
+	while (pending > 0) {
+		pending--;
+		if (!_skipOne(pending)) {
+			_position = position;
+			return false;
+		}
+	}
+	return true;
+}
+
+bool JBMsgPackReader::_readLength(size_t bytes, size_t& value) const {
+	if (_length - _position <= bytes) {
+		return false;
+	}
+	value = 0;
+	for (size_t i = 1; i <= bytes; i++) {
+		value = (value << 8) | _data[_position + i];
+	}
+	return true;
+}
+
+bool JBMsgPackReader::_readInteger(int64_t& value) {
+	if (_position >= _length) {
+		return false;
+	}
+	uint8_t b = _data[_position];
+	if (b <= 0x7f || b >= 0xe0) {
+		value = b <= 0x7f ? (int64_t)b : (int64_t)(int8_t)b;
+		_position++;
+		return true;
+	}
+	if (b < 0xcc || b > 0xd3) {
+		return false;
+	}
+	size_t bytes = 1 << ((b - 0xcc) & 0x03);
+	if (_length - _position <= bytes) {
+		return false;
+	}
+	uint64_t raw = 0;
+	for (size_t i = 1; i <= bytes; i++) {
+		raw = (raw << 8) | _data[_position + i];
+	}
+	if (b >= 0xd0 && bytes < 8) {
+		// Sign extend
+		uint64_t sign = 1ull << (bytes * 8 - 1);
+		value = (int64_t)((raw ^ sign) - sign);
+	} else {
+		value = (int64_t)raw;
+	}
+	_position += 1 + bytes;
+	return true;
+}
+
+bool JBMsgPackReader::_skipOne(size_t& pending) {
+	JBMsgPackType type = peek();
+	if (type == MSGPACK_NONE) {
+		return false;
+	}
+	uint8_t b = _data[_position];
+	size_t size = 0;
+	switch (type) {
+		case MSGPACK_NIL:
+		case MSGPACK_BOOL:
+			_position++;
+			return true;
+		case MSGPACK_UINT:
+		case MSGPACK_INT: {
+			int64_t value;
+			return _readInteger(value);
+		}
+		case MSGPACK_STRING: {
+			JBStringView value { "", 0 };
+			return readString(value);
+		}
+		case MSGPACK_ARRAY:
+			if (!readArray(size)) {
+				return false;
+			}
+			pending += size;
+			return true;
+		case MSGPACK_MAP: {
+			size_t header = b == 0xde ? 3 : b == 0xdf ? 5 : 1;
+			size = header == 1 ? (b & 0x0f) : 0;
+			if (header > 1 && !_readLength(header - 1, size)) {
+				return false;
+			}
+			_position += header;
+			pending += size * 2;
+			return true;
+		}
+		default:
+			break;
+	}
+
+	// Float, binary and extension types are skipped by size
+	size_t header;
+	switch (b) {
+		case 0xca: header = 1; size = 4; break;
+		case 0xcb: header = 1; size = 8; break;
+		case 0xd4: header = 2; size = 1; break;
+		case 0xd5: header = 2; size = 2; break;
+		case 0xd6: header = 2; size = 4; break;
+		case 0xd7: header = 2; size = 8; break;
+		case 0xd8: header = 2; size = 16; break;
+		case 0xc4: case 0xc5: case 0xc6:
+			header = 1 + (1 << (b - 0xc4));
+			if (!_readLength(header - 1, size)) {
+				return false;
+			}
+			break;
+		case 0xc7: case 0xc8: case 0xc9:
+			header = 2 + (1 << (b - 0xc7));
+			if (!_readLength(header - 2, size)) {
+				return false;
+			}
+			break;
+		default:
+			return false;
+	}
+	if (_length - _position < header || _length - _position - header < size) {
+		return false;
+	}
+	_position += header + size;
+	return true;
+}
+
+// ====================================================================
+// Writer
+//
+JBMsgPackWriter::JBMsgPackWriter(uint8_t* buffer, size_t capacity) : _buffer(buffer), _capacity(capacity) {
+}
+
+void JBMsgPackWriter::writeNil() {
+	_write(0xc0);
+}
+
+void JBMsgPackWriter::writeBool(bool value) {
+	_write(value ? 0xc3 : 0xc2);
+}
+
+void JBMsgPackWriter::writeUInt(uint32_t value) {
+	if (value <= 0x7f) {
+		_write(value);
+	} else if (value <= 0xff) {
+		_write(0xcc);
+		_writeBig(value, 1);
+	} else if (value <= 0xffff) {
+		_write(0xcd);
+		_writeBig(value, 2);
+	} else {
+		_write(0xce);
+		_writeBig(value, 4);
+	}
+}
+
+void JBMsgPackWriter::writeString(const char* data, size_t length) {
+	if (length <= 0x1f) {
+		_write(0xa0 | length);
+	} else if (length <= 0xff) {
+		_write(0xd9);
+		_writeBig(length, 1);
+	} else if (length <= 0xffff) {
+		_write(0xda);
+		_writeBig(length, 2);
+	} else {
+		_write(0xdb);
+		_writeBig(length, 4);
+	}
+	if (_length + length > _capacity) {
+		_overflow = true;
+		return;
+	}
+	memcpy(_buffer + _length, data, length);
+	_length += length;
+}
+
+void JBMsgPackWriter::writeString(const std::string& value) {
+	writeString(value.data(), value.size());
+}
+
+void JBMsgPackWriter::writeArray(size_t size) {
+	if (size <= 0x0f) {
+		_write(0x90 | size);
+	} else if (size <= 0xffff) {
+		_write(0xdc);
+		_writeBig(size, 2);
+	} else {
+		_write(0xdd);
+		_writeBig(size, 4);
+	}
+}
+
+size_t JBMsgPackWriter::getLength() const {
+	return _length;
+}
+
+bool JBMsgPackWriter::hasOverflow() const {
+	return _overflow;
+}
+
+void JBMsgPackWriter::_write(uint8_t value) {
+	if (_length >= _capacity) {
+		_overflow = true;
+		return;
+	}
+	_buffer[_length++] = value;
+}
+
+void JBMsgPackWriter::_writeBig(uint32_t value, uint8_t bytes) {
+	while (bytes > 0) {
+		bytes--;
+		_write((value >> (bytes * 8)) & 0xff);
+	}
+}
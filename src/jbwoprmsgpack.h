@@ -0,0 +1,164 @@
+/// @file jbwoprmsgpack.h
+/// @author Jonny Bergdahl
+/// @brief Header file for the JBMsgPackReader and JBMsgPackWriter classes.
+/// @details Contains a small MessagePack codec, without Arduino dependencies.
+/// This code is distributed under the MIT License. See LICENSE for details.
+/// @date Created: 2026-10-18
+/// @copyright Copyright© 2026, Jonny Bergdahl
+///
+#ifndef ARDUINO_WOPR_JBWOPRMSGPACK_H
+#define ARDUINO_WOPR_JBWOPRMSGPACK_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include "jbwoprstringview.h"
+
+/// @brief MessagePack value types
+enum JBMsgPackType {
+	MSGPACK_NONE = 0,						///< End of data
+	MSGPACK_NIL,							///< Nil
+	MSGPACK_BOOL,							///< Boolean
+	MSGPACK_UINT,							///< Unsigned integer
+	MSGPACK_INT,							///< Negative integer
+	MSGPACK_STRING,							///< String
+	MSGPACK_ARRAY,							///< Array
+	MSGPACK_MAP,							///< Map
+	MSGPACK_OTHER							///< Float, binary or extension
+};
+
+/// @brief MessagePack reader
+/// @details Reads values in place from a buffer, without allocating memory.
+/// Strings are returned as views into the buffer. All methods return false,
+/// and do not move the read position, if the next value has another type or
+/// the data is truncated.
+class JBMsgPackReader {
+public:
+	/// @brief Constructor
+	/// @param data MessagePack data
+	/// @param length Length of data
+	JBMsgPackReader(const uint8_t* data, size_t length);
+
+	/// @brief Get type of next value
+	/// @return Type, MSGPACK_NONE at end of data
+	JBMsgPackType peek() const;
+
+	/// @brief Check if all data is read
+	/// @return True at end of data
+	bool atEnd() const;
+
+	/// @brief Read nil
+	/// @return True if successful
+	bool readNil();
+
+	/// @brief Read boolean
+	/// @param value Value, set if successful
+	/// @return True if successful
+	bool readBool(bool& value);
+
+	/// @brief Read unsigned integer
+	/// @param value Value, set if successful
+	/// @return True if successful, false if the value is negative or too large
+	bool readUInt(uint32_t& value);
+
+	/// @brief Read signed integer
+	/// @param value Value, set if successful
+	/// @return True if successful, false if the value is too large
+	bool readInt(int32_t& value);
+
+	/// @brief Read string
+	/// @param value View into the buffer, set if successful
+	/// @return True if successful
+	bool readString(JBStringView& value);
+
+	/// @brief Read array header
+	/// @details The elements follow as separate values.
+	/// @param size Number of elements, set if successful
+	/// @return True if successful
+	bool readArray(size_t& size);
+
+	/// @brief Skip next value, including the elements of arrays and maps
+	/// @return True if successful
+	bool skip();
+
+private:
+	const uint8_t* _data;					///< MessagePack data
+	size_t _length;							///< Length of data
+	size_t _position = 0;					///< Read position
+
+	/// @brief Read big endian length following the type byte
+	/// @param bytes Number of bytes, 1, 2 or 4
+	/// @param value Value, set if successful
+	/// @return True if successful
+	bool _readLength(size_t bytes, size_t& value) const;
+
+	/// @brief Read integer of any size
+	/// @param value Value, set if successful
+	/// @return True if successful
+	bool _readInteger(int64_t& value);
+
+	/// @brief Skip one value, arrays and maps add their elements to pending
+	/// @param pending Number of values left to skip
+	/// @return True if successful
+	bool _skipOne(size_t& pending);
+};
+
+/// @brief MessagePack writer
+/// @details Writes values to a fixed size buffer, without allocating memory.
+class JBMsgPackWriter {
+public:
+	/// @brief Constructor
+	/// @param buffer Buffer
+	/// @param capacity Size of buffer
+	JBMsgPackWriter(uint8_t* buffer, size_t capacity);
+
+	/// @brief Write nil
+	void writeNil();
+
+	/// @brief Write boolean
+	/// @param value Value
+	void writeBool(bool value);
+
+	/// @brief Write unsigned integer, using the smallest format
+	/// @param value Value
+	void writeUInt(uint32_t value);
+
+	/// @brief Write string
+	/// @param data Characters
+	/// @param length Number of characters
+	void writeString(const char* data, size_t length);
+
+	/// @brief Write string
+	/// @param value String
+	void writeString(const std::string& value);
+
+	/// @brief Write array header
+	/// @details The elements are written as separate values.
+	/// @param size Number of elements
+	void writeArray(size_t size);
+
+	/// @brief Get number of bytes written
+	/// @return Length
+	size_t getLength() const;
+
+	/// @brief Check if the buffer was too small
+	/// @return True if data was lost
+	bool hasOverflow() const;
+
+private:
+	uint8_t* _buffer;						///< Buffer
+	size_t _capacity;						///< Size of buffer
+	size_t _length = 0;						///< Number of bytes written
+	bool _overflow = false;					///< True if the buffer was too small
+
+	/// @brief Write byte
+	/// @param value Byte
+	void _write(uint8_t value);
+
+	/// @brief Write big endian value
+	/// @param value Value
+	/// @param bytes Number of bytes
+	void _writeBig(uint32_t value, uint8_t bytes);
+};
+
+#endif //ARDUINO_WOPR_JBWOPRMSGPACK_H
@@ -0,0 +1,171 @@
+/// @file jbwoprrules.cpp
+/// @author Jonny Bergdahl
+/// @brief Source file for the JBWoprRules class.
+/// @details Contains implementation of the on-device rules engine.
+/// This code is distributed under the MIT License. See LICENSE for details.
+/// @date Created: 2026-10-18
+/// @copyright Copyright© 2026, Jonny Bergdahl
+///
+#include "jbwoprrules.h"
+#include "jbwopr.h"
+#include <algorithm>
+
+JBLogger JBWoprRules::_log {"rules" };
+
+JBWoprRules::JBWoprRules(JBWoprDevice* woprDevice) : _woprDevice(woprDevice) {
+}
+
+bool JBWoprRules::setFromJsonDocument(const JsonDocument& jsonDoc) {
+	JsonArrayConst items = jsonDoc[JSON_KEY_RULES].as<JsonArrayConst>();
+	if (items.isNull()) {
+		_log.error("Rules document has no rules array");
+		return false;
+	}
+
+	std::vector<Rule> rules;
+	std::string texts;
+	uint8_t triggers = 0;
+	for (JsonVariantConst item : items) {
+		Rule rule { 0, 0, 0, 0, 0 };
+		if (!_compileTrigger(item[JSON_KEY_WHEN].as<JsonObjectConst>(), rule)) {
+			continue;
+		}
+		// One compiled rule per action, so a lookup only walks a contiguous range
+		for (JsonPairConst action : item[JSON_KEY_THEN].as<JsonObjectConst>()) {
+			if (action.key() == JSON_KEY_EFFECT || action.key() == JSON_KEY_TEXT) {
+				const char* text = action.value().as<const char*>();
+				if (text == nullptr) {
+					_log.warning("Rule action %s has no text", action.key().c_str());
+					continue;
+				}
+				rule.action = action.key() == JSON_KEY_EFFECT ? RULE_ACTION_EFFECT : RULE_ACTION_TEXT;
+				rule.value = texts.size();
+				texts += text;
+				texts += '\0';
+			} else if (action.key() == JSON_KEY_DEFCON) {
+				uint8_t level = action.value().as<uint8_t>();
+				if (level < 1 || level > 5) {
+					_log.warning("Invalid rule DEFCON level: %u", level);
+					continue;
+				}
+				rule.action = RULE_ACTION_DEFCON;
+				rule.value = level - 1;
+			} else {
+				_log.warning("Unsupported rule action: %s", action.key().c_str());
+				continue;
+			}
+			rules.push_back(rule);
+			triggers |= 1 << rule.trigger;
+		}
+	}
+	if (rules.size() > JBWOPR_RULES_MAX) {
+		_log.error("Too many rules, %u actions", rules.size());
+		return false;
+	}
+
+	// Rules with the same trigger keep document order
+	std::stable_sort(rules.begin(), rules.end(), [](const Rule& a, const Rule& b) {
+		return a.trigger != b.trigger ? a.trigger < b.trigger : a.key < b.key;
+	});
+	_rules = std::move(rules);
+	_texts = std::move(texts);
+	_triggers = triggers;
+	_log.debug("Rules compiled, %u actions", _rules.size());
+	return true;
+}
+
+uint8_t JBWoprRules::run(JBWoprRuleTrigger trigger, uint32_t key, uint32_t match) {
+	if (!hasTrigger(trigger)) {
+		return 0;
+	}
+	auto rule = std::lower_bound(_rules.begin(), _rules.end(), Rule { key, 0, 0, (uint8_t)trigger, 0 },
+		[](const Rule& a, const Rule& b) {
+			return a.trigger != b.trigger ? a.trigger < b.trigger : a.key < b.key;
+		});
+	uint8_t count = 0;
+	for (; rule != _rules.end() && rule->trigger == trigger && rule->key == key; ++rule) {
+		if (rule->match != 0 && rule->match != match) {
+			continue;
+		}
+		_runAction(*rule);
+		count++;
+	}
+	return count;
+}
+
+bool JBWoprRules::hasTrigger(JBWoprRuleTrigger trigger) const {
+	return _triggers & (1 << trigger);
+}
+
+const std::vector<JBWoprRules::Rule>& JBWoprRules::getRules() const {
+	return _rules;
+}
+
+uint32_t JBWoprRules::getButtonKey(uint8_t button, bool doubleClick) {
+	return button * 2 + (doubleClick ? 1 : 0);
+}
+
+bool JBWoprRules::_compileTrigger(JsonObjectConst when, Rule& rule) {
+	if (when.isNull()) {
+		_log.warning("Rule has no trigger");
+		return false;
+	}
+	if (!when[JSON_KEY_BUTTON].isNull()) {
+		const char* name = when[JSON_KEY_BUTTON].as<const char*>();
+		for (uint8_t i = 0; name != nullptr && i < 4; i++) {
+			if (strcmp(name, BUTTON_NAMES[i]) == 0) {
+				const char* event = when[JSON_KEY_EVENT].as<const char*>();
+				rule.trigger = RULE_TRIGGER_BUTTON;
+				rule.key = getButtonKey(i, event != nullptr && strcmp(event, EVENT_DOUBLE_CLICK) == 0);
+				return true;
+			}
+		}
+		_log.warning("Unknown rule button: %s", name == nullptr ? "" : name);
+		return false;
+	}
+	if (!when[JSON_KEY_COMMAND].isNull()) {
+		// Same hash as the MQTT command table, so no topic is built when a command is received
+		std::string topic = when[JSON_KEY_COMMAND].as<std::string>() + "/set";
+		rule.trigger = RULE_TRIGGER_COMMAND;
+		rule.key = JBStringHelper::hash(topic.c_str());
+		const char* value = when[JSON_KEY_VALUE].as<const char*>();
+		rule.match = value == nullptr ? 0 : JBStringHelper::hash(value, strlen(value));
+		return true;
+	}
+	if (!when[JSON_KEY_TIME].isNull()) {
+		unsigned int hour = 0;
+		unsigned int minute = 0;
+		const char* time = when[JSON_KEY_TIME].as<const char*>();
+		if (time == nullptr || sscanf(time, "%u:%u", &hour, &minute) != 2 || hour > 23 || minute > 59) {
+			_log.warning("Invalid rule time: %s", time == nullptr ? "" : time);
+			return false;
+		}
+		rule.trigger = RULE_TRIGGER_TIME;
+		rule.key = hour * 60 + minute;
+		return true;
+	}
+	if (!when[JSON_KEY_FINISHED].isNull()) {
+		const char* name = when[JSON_KEY_FINISHED].as<const char*>();
+		rule.trigger = RULE_TRIGGER_EFFECT;
+		rule.key = name == nullptr || strcmp(name, "*") == 0 ? 0 : JBStringHelper::hash(name);
+		return true;
+	}
+	_log.warning("Unsupported rule trigger");
+	return false;
+}
+
+void JBWoprRules::_runAction(const Rule& rule) {
+	switch (rule.action) {
+		case RULE_ACTION_EFFECT:
+			_woprDevice->effectsStartEffect(_texts.c_str() + rule.value);
+			break;
+		case RULE_ACTION_DEFCON:
+			_woprDevice->defconLedsSetDefconLevel((JBDefconLevel)rule.value);
+			break;
+		case RULE_ACTION_TEXT:
+			_woprDevice->displayShowText(_texts.c_str() + rule.value);
+			break;
+		default:
+			break;
+	}
+}
@@ -0,0 +1,133 @@
+/// @file jbwoprrules.h
+/// @author Jonny Bergdahl
+/// @brief Header file for the JBWoprRules class.
+/// @details Contains declarations for the on-device rules engine.
+/// This code is distributed under the MIT License. See LICENSE for details.
+/// @date Created: 2026-10-18
+/// @copyright Copyright© 2026, Jonny Bergdahl
+///
+#ifndef ARDUINO_WOPR_JBWOPRRULES_H
+#define ARDUINO_WOPR_JBWOPRRULES_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <JBLogger.h>
+#include <string>
+#include <vector>
+
+class JBWoprDevice;
+
+#define JBWOPR_RULES_MAX 64					///< Max number of compiled rules
+
+/// @brief Rule triggers
+enum JBWoprRuleTrigger {
+	RULE_TRIGGER_BUTTON = 0,				///< Button event, key is button index * 2, plus 1 for double click
+	RULE_TRIGGER_COMMAND,					///< Received command, key is hash of <entity>/<subentity>/set
+	RULE_TRIGGER_TIME,						///< Time of day, key is minutes since midnight
+	RULE_TRIGGER_EFFECT,					///< Effect finished, key is hash of effect name, 0 for any effect
+	RULE_TRIGGER_COUNT						///< Number of triggers
+};
+
+/// @brief Rule actions
+enum JBWoprRuleAction {
+	RULE_ACTION_EFFECT = 0,					///< Start effect, value is offset in text pool
+	RULE_ACTION_DEFCON,						///< Set DEFCON level, value is JBDefconLevel
+	RULE_ACTION_TEXT						///< Show text, value is offset in text pool
+};
+
+/// @brief On-device rules engine
+/// @details Rules map local triggers to actions, so common interactions do not
+/// need a round trip through the broker. A rules document is compiled once into
+/// a flat table sorted by trigger and key, and a trigger is looked up with a
+/// binary search, so running rules does not allocate memory.
+///
+/// @code{.json}
+/// {
+///   "rules": [
+///     { "when": { "button": "front_left", "event": "click" }, "then": { "effect": "Matrix" } },
+///     { "when": { "command": "defcon/level", "value": "DEFCON 1" }, "then": { "text": "ALERT" } },
+///     { "when": { "time": "07:30" }, "then": { "defcon": 5, "text": "GOOD MORNING" } },
+///     { "when": { "finished": "*" }, "then": { "effect": "Clock" } }
+///   ]
+/// }
+/// @endcode
+///
+/// Actions in `then` are run in document order. All rules with a matching
+/// trigger are run, in document order.
+class JBWoprRules {
+public:
+	/// @brief Compiled rule
+	struct Rule {
+		uint32_t key;						///< Trigger key
+		uint32_t match;						///< Hash of command value, 0 matches any value
+		uint32_t value;						///< Action value
+		uint8_t trigger;					///< JBWoprRuleTrigger
+		uint8_t action;						///< JBWoprRuleAction
+	};
+
+	/// @brief Constructor
+	/// @param woprDevice JBWoprDevice instance
+	explicit JBWoprRules(JBWoprDevice* woprDevice);
+
+	/// @brief Compile rules from JSON document
+	/// @details The previous rules are kept if the document is invalid.
+	/// @param jsonDoc JSON document
+	/// @return True if successful
+	bool setFromJsonDocument(const JsonDocument& jsonDoc);
+
+	/// @brief Run rules for trigger
+	/// @param trigger Trigger
+	/// @param key Trigger key
+	/// @param match Hash of received value, for RULE_TRIGGER_COMMAND
+	/// @return Number of actions run
+	uint8_t run(JBWoprRuleTrigger trigger, uint32_t key, uint32_t match = 0);
+
+	/// @brief Check if there are rules for a trigger
+	/// @param trigger Trigger
+	/// @return True if at least one rule uses the trigger
+	bool hasTrigger(JBWoprRuleTrigger trigger) const;
+
+	/// @brief Get compiled rules
+	/// @return Rules, sorted by trigger and key
+	const std::vector<Rule>& getRules() const;
+
+	/// @brief Get button trigger key
+	/// @param button Button index, 0 front left, 1 front right, 2 back top, 3 back bottom
+	/// @param doubleClick True for double click
+	/// @return Trigger key
+	static uint32_t getButtonKey(uint8_t button, bool doubleClick);
+
+protected:
+	JBWoprDevice* _woprDevice;				///< JBWoprDevice instance
+	static JBLogger _log;					///< Logger instance
+	std::vector<Rule> _rules;				///< Compiled rules, sorted by trigger and key
+	std::string _texts;						///< Text pool, null separated
+	uint8_t _triggers = 0;					///< Bit mask of used triggers
+
+	const char* JSON_KEY_RULES = "rules";						///< Rules key name
+	const char* JSON_KEY_WHEN = "when";							///< Trigger key name
+	const char* JSON_KEY_THEN = "then";							///< Actions key name
+	const char* JSON_KEY_BUTTON = "button";						///< Button trigger key name
+	const char* JSON_KEY_EVENT = "event";						///< Button event key name
+	const char* JSON_KEY_COMMAND = "command";					///< Command trigger key name
+	const char* JSON_KEY_VALUE = "value";						///< Command value key name
+	const char* JSON_KEY_TIME = "time";							///< Time trigger key name
+	const char* JSON_KEY_FINISHED = "finished";					///< Effect finished trigger key name
+	const char* JSON_KEY_EFFECT = "effect";						///< Start effect action key name
+	const char* JSON_KEY_DEFCON = "defcon";						///< DEFCON level action key name
+	const char* JSON_KEY_TEXT = "text";							///< Show text action key name
+	const char* EVENT_DOUBLE_CLICK = "double_click";			///< Double click event
+	const char* BUTTON_NAMES[4] { "front_left", "front_right", "back_top", "back_bottom" };	///< Button names, in key order
+
+	/// @brief Compile trigger
+	/// @param when Trigger JSON object
+	/// @param rule Rule, trigger, key and match are set
+	/// @return True if successful
+	bool _compileTrigger(JsonObjectConst when, Rule& rule);
+
+	/// @brief Run action
+	/// @param rule Rule
+	void _runAction(const Rule& rule);
+};
+
+#endif //ARDUINO_WOPR_JBWOPRRULES_H
@@ -0,0 +1,64 @@
+/// @file jbwoprspscqueue.h
+/// @author Jonny Bergdahl
+/// @brief Header file for the JBSpscQueue class.
+/// @details Contains a lock free queue used between loop() and the network task.
+/// This code is distributed under the MIT License. See LICENSE for details.
+/// @date Created: 2026-10-18
+/// @copyright Copyright© 2026, Jonny Bergdahl
+///
+#ifndef ARDUINO_WOPR_JBWOPRSPSCQUEUE_H
+#define ARDUINO_WOPR_JBWOPRSPSCQUEUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <utility>
+
+/// @brief Lock free single producer, single consumer queue
+/// @details One task may push and one other task may pop at the same time,
+/// without locks. Items are moved in and out of a fixed size buffer.
+/// @tparam T Item type
+/// @tparam N Max number of items, must be a power of two
+template <typename T, size_t N>
+class JBSpscQueue {
+	static_assert((N & (N - 1)) == 0, "JBSpscQueue size must be a power of two");
+
+public:
+	/// @brief Add item, called from the producer task only
+	/// @param item Item, moved into the queue if successful
+	/// @return True if added, false if the queue is full
+	bool push(T& item) {
+		size_t tail = _tail.load(std::memory_order_relaxed);
+		if (tail - _head.load(std::memory_order_acquire) >= N) {
+			return false;
+		}
+		_items[tail % N] = std::move(item);
+		_tail.store(tail + 1, std::memory_order_release);
+		return true;
+	}
+
+	/// @brief Remove item, called from the consumer task only
+	/// @param item Item, set if successful
+	/// @return True if an item was removed, false if the queue is empty
+	bool pop(T& item) {
+		size_t head = _head.load(std::memory_order_relaxed);
+		if (head == _tail.load(std::memory_order_acquire)) {
+			return false;
+		}
+		item = std::move(_items[head % N]);
+		_head.store(head + 1, std::memory_order_release);
+		return true;
+	}
+
+	/// @brief Get number of items
+	/// @return Number of items, may be changed by the other task at once
+	size_t size() const {
+		return _tail.load(std::memory_order_acquire) - _head.load(std::memory_order_acquire);
+	}
+
+private:
+	T _items[N];								///< Item buffer
+	std::atomic<size_t> _head { 0 };			///< Total number of removed items, written by consumer
+	std::atomic<size_t> _tail { 0 };			///< Total number of added items, written by producer
+};
+
+#endif //ARDUINO_WOPR_JBWOPRSPSCQUEUE_H
@@ -0,0 +1,87 @@
+/// @file jbwoprstringview.h
+/// @author Jonny Bergdahl
+/// @brief Header file for the JBStringView struct.
+/// @details Contains a non owning string view, without Arduino dependencies.
+/// This code is distributed under the MIT License. See LICENSE for details.
+/// @date Created: 2026-10-18
+/// @copyright Copyright© 2026, Jonny Bergdahl
+///
+#ifndef ARDUINO_WOPR_JBWOPRSTRINGVIEW_H
+#define ARDUINO_WOPR_JBWOPRSTRINGVIEW_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+/// @brief Non owning view of a character buffer
+/// @details Used for MQTT payloads, which are not null terminated, so they
+/// can be handled without being copied.
+struct JBStringView {
+	const char* data;						///< Characters, not null terminated
+	size_t length;							///< Number of characters
+
+	/// @brief Compare with null terminated string
+	/// @param str String to compare with
+	/// @return True if equal
+	bool operator==(const char* str) const {
+		// A payload may contain a null character, so compare lengths first
+		return strlen(str) == length && memcmp(data, str, length) == 0;
+	}
+
+	/// @brief Compare with null terminated string
+	/// @param str String to compare with
+	/// @return True if not equal
+	bool operator!=(const char* str) const {
+		return !(*this == str);
+	}
+
+	/// @brief Check if view is empty
+	/// @return True if empty
+	bool empty() const {
+		return length == 0;
+	}
+
+	/// @brief Get copy as string
+	/// @return String
+	std::string toString() const {
+		return std::string(data, length);
+	}
+
+	/// @brief Parse decimal integer
+	/// @details Parses an optional sign followed by digits, like atoi.
+	/// @return Value, 0 if not a number
+	int32_t toInt() const {
+		if (length > 0 && (data[0] == '-' || data[0] == '+')) {
+			int32_t value = JBStringView { data + 1, length - 1 }.toUInt();
+			return data[0] == '-' ? -value : value;
+		}
+		return toUInt();
+	}
+
+	/// @brief Check if view is an unsigned decimal integer
+	/// @return True if not empty and all characters are digits
+	bool isUInt() const {
+		if (length == 0) {
+			return false;
+		}
+		for (size_t i = 0; i < length; i++) {
+			if (data[i] < '0' || data[i] > '9') {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	/// @brief Parse unsigned decimal integer
+	/// @return Value, 0 if not a number
+	uint32_t toUInt() const {
+		uint32_t value = 0;
+		for (size_t i = 0; i < length && data[i] >= '0' && data[i] <= '9'; i++) {
+			value = value * 10 + (data[i] - '0');
+		}
+		return value;
+	}
+};
+
+#endif //ARDUINO_WOPR_JBWOPRSTRINGVIEW_H
@@ -43,6 +43,8 @@ bool JBWoprWiFiDevice::begin(JBWoprBoardVariant variant, JBWoprBoardPins pins) {
 	else {
 		// Load configuration
 		_loadConfiguration();
+		_loadPlaylist();
+		_loadScriptEffects();
 	}
 
 	JBTimeHelper::configure(_log, _wifiConfig.ntpServer, _wifiConfig.tzName);
@@ -79,17 +81,20 @@ bool JBWoprWiFiDevice::begin(JBWoprBoardVariant variant, JBWoprBoardPins pins) {
 		return false;
 	}
 
+	_networkStartTask();
 	return true;
 }
 
 void JBWoprWiFiDevice::loop() {
 	JBWoprDevice::loop();
 
-	_wifiManager->process();
+	if (_networkTask == nullptr) {
+		_networkLoop();
+	}
 
 	if (_shouldSaveConfig) {
 		_shouldSaveConfig = false;
-		_saveConfiguration();
+		_saveParams();
 		esp_restart();
 	}
 }
@@ -115,9 +120,14 @@ bool JBWoprWiFiDevice::startWiFi()
 		// If WiFiManager is unable to connect to WiFi, it starts AP mode
 		// and we end up here.
 		std::string text = "AP " + _apName + ", IP " + "192.168.4.1";
-		auto effect = new JBWoprScrollTextDisplayEffect(this, text);
+		auto effect = _scrollTextPool.create(this, text);
 		defconLedsSetColor(0xFF0000);
-		effectsStartEffect(effect);
+		if (effect != nullptr) {
+			effectsStartEffect(effect);
+		} else {
+			_log->warning("No free scroll text effect");
+			displayShowText(text);
+		}
 		_log->info("WiFi Manager started in AP Mode: %s", _apName.c_str());
 		while (true)
 		{
@@ -125,7 +135,7 @@ bool JBWoprWiFiDevice::startWiFi()
 			// AP mode.
 			if (_shouldSaveConfig) {
 				_shouldSaveConfig = false;
-				_saveConfiguration();
+				_saveParams();
 				_wifiManager->reboot();
 			}
 			loop();
@@ -138,8 +148,63 @@ bool JBWoprWiFiDevice::startWiFi()
 	return true;
 }
 
+void JBWoprWiFiDevice::_networkLoop() {
+	// Started and stopped here, as process() uses the web server
+	switch (_webPortalRequest.exchange(WEB_PORTAL_REQUEST_NONE)) {
+		case WEB_PORTAL_REQUEST_START:
+			webPortalStart();
+			break;
+		case WEB_PORTAL_REQUEST_STOP:
+			webPortalStop();
+			break;
+		default:
+			break;
+	}
+	_wifiManager->process();
+}
+
+bool JBWoprWiFiDevice::_networkStartTask() {
+#if JBWOPR_NETWORK_TASK
+	if (_networkTask != nullptr) {
+		return true;
+	}
+	if (xTaskCreatePinnedToCore(_networkTaskFunction,
+								"wopr_network",
+								JBWOPR_NETWORK_TASK_STACK,
+								this,
+								JBWOPR_NETWORK_TASK_PRIORITY,
+								&_networkTask,
+								JBWOPR_NETWORK_TASK_CORE) != pdPASS) {
+		_log->error("Failed to start network task, running network in loop()");
+		_networkTask = nullptr;
+		return false;
+	}
+	_log->debug("Network task started on core %i", JBWOPR_NETWORK_TASK_CORE);
+	return true;
+#else
+	return false;
+#endif
+}
+
+bool JBWoprWiFiDevice::_isNetworkTask() const {
+	return _networkTask != nullptr && xTaskGetCurrentTaskHandle() == _networkTask;
+}
+
+void JBWoprWiFiDevice::_networkTaskFunction(void* param) {
+	auto device = static_cast<JBWoprWiFiDevice*>(param);
+	while (true) {
+		device->_networkLoop();
+		// Let the idle task run, so the watchdog is fed
+		vTaskDelay(1);
+	}
+}
+
 void JBWoprWiFiDevice::webPortalStart()
 {
+	if (_networkTask != nullptr && !_isNetworkTask()) {
+		_webPortalRequest = WEB_PORTAL_REQUEST_START;
+		return;
+	}
 	std::vector<const char *> menu = {"param", "sep", "info", "update", "erase", "sep", "restart"};
 	_wifiManager->setMenu(menu);
 	_wifiManager->startWebPortal();
@@ -147,6 +212,10 @@ void JBWoprWiFiDevice::webPortalStart()
 
 void JBWoprWiFiDevice::webPortalStop()
 {
+	if (_networkTask != nullptr && !_isNetworkTask()) {
+		_webPortalRequest = WEB_PORTAL_REQUEST_STOP;
+		return;
+	}
 	_log->trace("Stopping web portal");
 	_wifiManager->stopWebPortal();
 }
@@ -192,6 +261,20 @@ void JBWoprWiFiDevice::_saveConfiguration()
 	// Set the values in the JSON document
 	_setJsonDocumentFromConfig(jsonDoc);
 	_dumpConfig();
+	_writeConfiguration(jsonDoc);
+}
+
+void JBWoprWiFiDevice::_saveParams()
+{
+	_log->trace("Saving web portal parameters");
+	JsonDocument jsonDoc;
+	_setJsonDocumentFromConfig(jsonDoc);
+	_setJsonDocumentFromParams(jsonDoc);
+	_writeConfiguration(jsonDoc);
+}
+
+void JBWoprWiFiDevice::_writeConfiguration(const JsonDocument& jsonDoc)
+{
 	File settingsFile = LittleFS.open(CONFIG_FILE_NAME, "w");
 	if (!settingsFile) {
 		_log->error("Failed to open configuration file for writing!");
@@ -201,6 +284,81 @@ void JBWoprWiFiDevice::_saveConfiguration()
 	settingsFile.close();
 }
 
+void JBWoprWiFiDevice::_loadPlaylist()
+{
+	_log->trace("Load playlist");
+	File playlistFile = LittleFS.open(PLAYLIST_FILE_NAME, "r");
+	if (!playlistFile) {
+		_log->debug("No playlist file");
+		return;
+	}
+
+	JsonDocument jsonDoc;
+	DeserializationError error = deserializeJson(jsonDoc, playlistFile);
+	playlistFile.close();
+	if (error) {
+		_log->error("Error parsing playlist JSON file!");
+		return;
+	}
+	_playlist.setFromJsonDocument(jsonDoc);
+}
+
+void JBWoprWiFiDevice::_savePlaylist()
+{
+	_log->trace("Saving playlist");
+	JsonDocument jsonDoc;
+	_playlist.setJsonDocument(jsonDoc);
+	File playlistFile = LittleFS.open(PLAYLIST_FILE_NAME, "w");
+	if (!playlistFile) {
+		_log->error("Failed to open playlist file for writing!");
+		return;
+	}
+	serializeJson(jsonDoc, playlistFile);
+	playlistFile.close();
+}
+
+void JBWoprWiFiDevice::_loadScriptEffects()
+{
+	_log->trace("Load script effects");
+	File dir = LittleFS.open(SCRIPTS_DIR_NAME, "r");
+	if (!dir || !dir.isDirectory()) {
+		_log->debug("No script effects directory");
+		return;
+	}
+
+	File scriptFile = dir.openNextFile();
+	while (scriptFile) {
+		JsonDocument jsonDoc;
+		DeserializationError error = deserializeJson(jsonDoc, scriptFile);
+		if (error) {
+			_log->error("Error parsing script effect file %s", scriptFile.name());
+		} else {
+			effectsLoadScriptEffect(jsonDoc);
+		}
+		scriptFile.close();
+		scriptFile = dir.openNextFile();
+	}
+	dir.close();
+}
+
+void JBWoprWiFiDevice::_saveScriptEffect(const JsonDocument& jsonDoc)
+{
+	std::string name = JBWoprScriptEffect::getNameFromJsonDocument(jsonDoc);
+	_log->trace("Saving script effect %s", name.c_str());
+	char fileName[32];
+	snprintf(fileName, sizeof(fileName), "%s/%08x.json", SCRIPTS_DIR_NAME, JBStringHelper::hash(name.c_str()));
+	if (!LittleFS.exists(SCRIPTS_DIR_NAME)) {
+		LittleFS.mkdir(SCRIPTS_DIR_NAME);
+	}
+	File scriptFile = LittleFS.open(fileName, "w");
+	if (!scriptFile) {
+		_log->error("Failed to open script effect file for writing!");
+		return;
+	}
+	serializeJson(jsonDoc, scriptFile);
+	scriptFile.close();
+}
+
 void JBWoprWiFiDevice::_setConfigFromJsonDocument(const JsonDocument &jsonDoc) {
 	_log->trace("JBWoprWiFiDevice: Setting configuration from JSON document");
 	if (!jsonDoc[JSON_KEY_TIME_FORMAT].isNull()) {
@@ -218,6 +376,9 @@ void JBWoprWiFiDevice::_setConfigFromJsonDocument(const JsonDocument &jsonDoc) {
 	if (!jsonDoc[JSON_KEY_EFFECTS_TIMEOUT].isNull()) {
 		_config.effectsTimeout = jsonDoc[JSON_KEY_EFFECTS_TIMEOUT].as<uint8_t>();
 	}
+	if (!jsonDoc[JSON_KEY_EFFECTS_SPEED].isNull()) {
+		effectsSetSpeed(jsonDoc[JSON_KEY_EFFECTS_SPEED].as<uint16_t>());
+	}
 	if (!jsonDoc[JSON_KEY_WIFI_HOST_NAME].isNull()) {
 		_wifiConfig.hostName = jsonDoc[JSON_KEY_WIFI_HOST_NAME].as<std::string>();
 	}
@@ -238,12 +399,25 @@ void JBWoprWiFiDevice::_setJsonDocumentFromConfig(JsonDocument &jsonDoc) {
 	jsonDoc[JSON_KEY_DEFCON_BRIGHTNESS] = _config.defconLedsBrightness;
 	jsonDoc[JSON_KEY_DISPLAY_BRIGHTNESS] = _config.displayBrightness;
 	jsonDoc[JSON_KEY_EFFECTS_TIMEOUT] = _config.effectsTimeout;
+	jsonDoc[JSON_KEY_EFFECTS_SPEED] = _config.effectsSpeed;
 	jsonDoc[JSON_KEY_WIFI_HOST_NAME] = _wifiConfig.hostName;
 	jsonDoc[JSON_KEY_WIFI_NTP_SERVER] = _wifiConfig.ntpServer;
 	jsonDoc[JSON_KEY_WIFI_TIMEZONE] = _wifiConfig.tzName;
 	jsonDoc[JSON_KEY_WIFI_USE_WEB_PORTAL] = _wifiConfig.useWebPortal;
 }
 
+void JBWoprWiFiDevice::_setJsonDocumentFromParams(JsonDocument &jsonDoc) {
+	jsonDoc[JSON_KEY_TIME_FORMAT] = _timeFormatParam->getValue();
+	jsonDoc[JSON_KEY_DATE_FORMAT] = _dateFormatParam->getValue();
+	jsonDoc[JSON_KEY_DEFCON_BRIGHTNESS] = atoi(_defconLedsBrightnessParam->getValue());
+	jsonDoc[JSON_KEY_DISPLAY_BRIGHTNESS] = atoi(_displayBrightnessParam->getValue());
+	jsonDoc[JSON_KEY_EFFECTS_TIMEOUT] = atoi(_effectsTimeoutParam->getValue());
+	jsonDoc[JSON_KEY_WIFI_HOST_NAME] = _hostNameParam->getValue();
+	jsonDoc[JSON_KEY_WIFI_NTP_SERVER] = _ntpServerNameParam->getValue();
+	jsonDoc[JSON_KEY_WIFI_TIMEZONE] = _paramsTzName;
+	jsonDoc[JSON_KEY_WIFI_USE_WEB_PORTAL] = strncmp(_useWebPortalParam->getValue(), "T", 1) == 0;
+}
+
 void JBWoprWiFiDevice::_dumpConfig() {
 	_log->trace("Current configuration");
 	_log->trace("  Time format: %s", _config.timeFormat.c_str());
@@ -251,6 +425,7 @@ void JBWoprWiFiDevice::_dumpConfig() {
 	_log->trace("  DEFCON LEDs brightness: %u", _config.defconLedsBrightness);
 	_log->trace("  Display brightness: %u", _config.displayBrightness);
 	_log->trace("  Effects timeout: %u", _config.effectsTimeout);
+	_log->trace("  Effects speed: %u", _config.effectsSpeed);
 	_log->trace("  Host name: %s", _wifiConfig.hostName.c_str());
 	_log->trace("  NTP server: %s", _wifiConfig.ntpServer.c_str());
 	_log->trace("  Timezone name: %s", _wifiConfig.tzName.c_str());
@@ -260,7 +435,7 @@ void JBWoprWiFiDevice::_dumpConfig() {
 // ====================================================================
 // WiFi
 //
-std::string JBWoprWiFiDevice::_getDeviceName() {
+const std::string& JBWoprWiFiDevice::_getDeviceName() const {
 	return _wifiConfig.hostName;
 }
 
@@ -337,15 +512,8 @@ void JBWoprWiFiDevice::_setupWiFiManager() {
 
 void JBWoprWiFiDevice::_saveParamsCallback () {
 	_log->trace("JBWoprWiFiDevice Callback: Save params");
-	_config.timeFormat = _timeFormatParam->getValue();
-	_config.dateFormat = _dateFormatParam->getValue();
-	_config.displayBrightness = atoi(_displayBrightnessParam->getValue());
-	_config.defconLedsBrightness = atoi(_defconLedsBrightnessParam->getValue());
-	_config.effectsTimeout = atoi(_effectsTimeoutParam->getValue());
-	_wifiConfig.hostName = _hostNameParam->getValue();
-	_wifiConfig.ntpServer = _ntpServerNameParam->getValue();
-	_wifiConfig.tzName = _wifiManager->server->arg(JSON_KEY_WIFI_TIMEZONE).c_str();
-	_wifiConfig.useWebPortal = strncmp(_useWebPortalParam->getValue(), "T", 1) == 0;
+	// The parameters keep their values, the running configuration is owned by loop()
+	_paramsTzName = _wifiManager->server->arg(JSON_KEY_WIFI_TIMEZONE).c_str();
 	_shouldSaveConfig = true;
 }
 
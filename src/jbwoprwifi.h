@@ -12,6 +12,9 @@
 #include "jbwopr.h"
 #include <WiFiManager.h>                   	// https://github.com/tzapu/WiFiManager
 #include <JBLogger.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <atomic>
 
 // ====================================================================
 //
@@ -20,6 +23,25 @@
 // ====================================================================
 
 #define WIFI_NTP_SERVER "pool.ntp.org"
+
+#ifndef JBWOPR_NETWORK_TASK
+#if portNUM_PROCESSORS > 1
+#define JBWOPR_NETWORK_TASK 1				///< Run network work in a separate task, default on dual core boards
+#else
+#define JBWOPR_NETWORK_TASK 0				///< Run network work in a separate task, default on dual core boards
+#endif
+#endif
+#define JBWOPR_NETWORK_TASK_CORE 0			///< Core used by network task, Arduino loop() runs on core 1
+#define JBWOPR_NETWORK_TASK_STACK 8192		///< Network task stack size
+#define JBWOPR_NETWORK_TASK_PRIORITY 1		///< Network task priority
+
+/// @brief Web portal requests, passed to the network task
+enum JBWoprWebPortalRequest {
+	WEB_PORTAL_REQUEST_NONE = 0,			///< No request
+	WEB_PORTAL_REQUEST_START,				///< Start web portal
+	WEB_PORTAL_REQUEST_STOP					///< Stop web portal
+};
+
 /// @brief JBWoprWiFiDevice WiFi configuration
 struct JBWoprWiFiConfiguration {
 	std::string hostName;						///< Host name
@@ -97,12 +119,14 @@ public:
 	/// @brief Start web portal
 	/// @ingroup WiFiGroup
 	/// @details This method will start a web portal for configuration.
-	/// This will be done automatically if the configured.
+	/// This will be done automatically if the configured. If the network task is
+	/// running, the portal is started by the network task.
 	void webPortalStart();
 
 	/// @brief Stop web portal
 	/// @ingroup WiFiGroup
-	/// @details This method will stop the web portal.
+	/// @details This method will stop the web portal. If the network task is
+	/// running, the portal is stopped by the network task.
 	void webPortalStop();
 
 protected:
@@ -110,9 +134,11 @@ protected:
 	// Configuration
 	//
 	JBWoprWiFiConfiguration _wifiConfig;				///< WiFi configuration
-	bool _shouldSaveConfig = false;						///< Flag to save configuration
+	std::atomic<bool> _shouldSaveConfig { false };		///< Flag to save configuration, set by the network task
 
 	const char* CONFIG_FILE_NAME = "/config.json";		///< Configuration file name
+	const char* PLAYLIST_FILE_NAME = "/playlist.json";	///< Playlist file name
+	const char* SCRIPTS_DIR_NAME = "/effects";			///< Script effects directory name
 
 	/// @brief Load configuration from file
 	/// @ingroup ConfigurationGroup
@@ -125,6 +151,40 @@ protected:
 	/// @ingroup ConfigurationGroup
 	void _saveConfiguration();
 
+	/// @brief Save web portal parameters to file
+	/// @ingroup ConfigurationGroup
+	/// @details Called from loop() after the Save button is pressed in the web portal. The
+	/// parameters are written to the file without changing the running configuration, as
+	/// the device restarts after saving.
+	void _saveParams();
+
+	/// @brief Write configuration JSON document to file
+	/// @ingroup ConfigurationGroup
+	/// @param jsonDoc JSON document
+	void _writeConfiguration(const JsonDocument& jsonDoc);
+
+	/// @brief Load playlist from file
+	/// @ingroup ConfigurationGroup
+	/// @details Called on startup.
+	void _loadPlaylist();
+
+	/// @brief Save playlist to file
+	/// @ingroup ConfigurationGroup
+	/// @details Called when the playlist is changed over MQTT.
+	void _savePlaylist();
+
+	/// @brief Load script effects from files
+	/// @ingroup ConfigurationGroup
+	/// @details Called on startup, loads all files in SCRIPTS_DIR_NAME.
+	void _loadScriptEffects();
+
+	/// @brief Save script effect to file
+	/// @ingroup ConfigurationGroup
+	/// @details The file is named from the hash of the script name, so loading
+	/// a script with the same name replaces the file.
+	/// @param jsonDoc Script JSON document
+	void _saveScriptEffect(const JsonDocument& jsonDoc);
+
 	/// @brief Get configuration
 	/// @ingroup ConfigurationGroup
 	/// @details Called when JSON document have been loaded from file.
@@ -137,6 +197,12 @@ protected:
 	/// @param jsonDoc JSON document
 	virtual void _setJsonDocumentFromConfig(JsonDocument &jsonDoc);
 
+	/// @brief Set JSON document from web portal parameters
+	/// @ingroup ConfigurationGroup
+	/// @details Called from loop() when the web portal parameters are saved.
+	/// @param jsonDoc JSON document
+	virtual void _setJsonDocumentFromParams(JsonDocument &jsonDoc);
+
 	/// @brief Dump configuration to logger
 	/// @ingroup ConfigurationGroup
 	/// @details Called when configuration is to be written to the logger.
@@ -146,10 +212,13 @@ protected:
 	// WiFi
 	//
 	WiFiManager* _wifiManager;										///< WiFi manager
+	TaskHandle_t _networkTask = nullptr;							///< Network task, nullptr if network work runs in loop()
+	std::atomic<uint8_t> _webPortalRequest { WEB_PORTAL_REQUEST_NONE };	///< JBWoprWebPortalRequest for the network task
 	std::string _apName = "";										///< AP name
 
 	const char* WEB_PORTAL_PASSWORD = "wopr1234";       			///< AP portal password
 	const char* JSON_KEY_EFFECTS_TIMEOUT = "effectsTimeout";		///< Effects timeout key name
+	const char* JSON_KEY_EFFECTS_SPEED = "effectsSpeed";			///< Effects speed key name
 	const char* JSON_KEY_TIME_FORMAT = "timeFormat";				///< Time format key name
 	const char* JSON_KEY_DATE_FORMAT = "dateFormat";				///< Date Format key name
 	const char* JSON_KEY_DEFCON_BRIGHTNESS = "defconBrightness";	///< DEFCON LEDs brightness key name
@@ -178,6 +247,7 @@ protected:
 	WiFiManagerParameter* _tzStringParam;							///< Timezone string
 	WiFiManagerParameter* _useWebPortalParam;						///< Use web portal parameter
 	std::string _tzHtml;											///< Timezone HTML string
+	std::string _paramsTzName;										///< Timezone name from the web portal, set before _shouldSaveConfig
 
 	char _effectsTimeoutValue[4];									///< Effects timeout value, set in WiFiManager callback
 	char _defconLedsBrightnessValue[4];								///< DEFCON LEDs brightness value, set in WiFiManager callback
@@ -186,7 +256,7 @@ protected:
 	/// @brief Get device name
 	/// @ingroup WiFiGroup
 	/// @return Device name, from WiFi configuration
-	std::string _getDeviceName();
+	const std::string& _getDeviceName() const;
 
 	/// @brief Get initial device name
 	/// @ingroup WiFiGroup
@@ -202,9 +272,11 @@ protected:
 	virtual void _setupWiFiManager();
 
 	/// @brief Save parameters callback
-	/// @details Calleb by WiFiManager when Save button is pressed.
+	/// @details Called by WiFiManager when Save button is pressed, on the network task.
+	/// Only keeps the time zone, which is a request argument, and sets _shouldSaveConfig.
+	/// The parameters are saved by loop().
 	/// @ingroup WiFiGroup
-	virtual void _saveParamsCallback();
+	void _saveParamsCallback();
 
 	/// @brief AP callback
 	/// @ingroup WiFiGroup
@@ -217,7 +289,29 @@ protected:
 	/// @details Called by WiFiManager when it starts up as a web server.
 	void _webServerCallback();
 
+	/// @brief Run network work
+	/// @ingroup WiFiGroup
+	/// @details Called from the network task, or from loop() if there is no network task.
+	/// Must not touch the display, LEDs or audio.
+	virtual void _networkLoop();
+
+	/// @brief Start network task
+	/// @ingroup WiFiGroup
+	/// @details Starts a task pinned to JBWOPR_NETWORK_TASK_CORE that runs _networkLoop(),
+	/// if JBWOPR_NETWORK_TASK is set. Called at the end of begin().
+	/// @return True if the task is running
+	bool _networkStartTask();
+
+	/// @brief Check if called from the network task
+	/// @ingroup WiFiGroup
+	/// @return True if called from the network task
+	bool _isNetworkTask() const;
+
 private:
+	/// @brief Network task function
+	/// @param param JBWoprWiFiDevice instance
+	static void _networkTaskFunction(void* param);
+
 	// ====================================================================
 	// Logger
 	//
@@ -0,0 +1,234 @@
+/// @file test_main.cpp
+/// @author Jonny Bergdahl
+/// @brief Host unit tests for the MessagePack codec.
+/// @details Run with "pio test -e native".
+/// This code is distributed under the MIT License. See LICENSE for details.
+/// @date Created: 2026-10-18
+/// @copyright Copyright© 2026, Jonny Bergdahl
+///
+#include <unity.h>
+#include "jbwoprmsgpack.h"
+#include "jbwoprmsgpack.cpp"
+
+void setUp() {
+}
+
+void tearDown() {
+}
+
+// ====================================================================
+// Truncated data
+//
+void test_truncated_fixstr() {
+	const uint8_t data[] = { 0xa3, 'a', 'b' };
+	JBMsgPackReader reader(data, sizeof(data));
+	JBStringView value { "", 0 };
+	TEST_ASSERT_FALSE(reader.readString(value));
+	TEST_ASSERT_EQUAL(MSGPACK_STRING, reader.peek());
+}
+
+void test_truncated_str8_header() {
+	const uint8_t data[] = { 0xd9 };
+	JBMsgPackReader reader(data, sizeof(data));
+	JBStringView value { "", 0 };
+	TEST_ASSERT_FALSE(reader.readString(value));
+}
+
+void test_truncated_str16_body() {
+	const uint8_t data[] = { 0xda, 0x00, 0x04, 'a', 'b', 'c' };
+	JBMsgPackReader reader(data, sizeof(data));
+	JBStringView value { "", 0 };
+	TEST_ASSERT_FALSE(reader.readString(value));
+	TEST_ASSERT_FALSE(reader.skip());
+	TEST_ASSERT_EQUAL(MSGPACK_STRING, reader.peek());
+}
+
+void test_truncated_uint32() {
+	const uint8_t data[] = { 0xce, 0x00, 0x01, 0x00 };
+	JBMsgPackReader reader(data, sizeof(data));
+	uint32_t value = 0;
+	TEST_ASSERT_FALSE(reader.readUInt(value));
+	TEST_ASSERT_EQUAL(MSGPACK_UINT, reader.peek());
+}
+
+void test_truncated_array16_header() {
+	const uint8_t data[] = { 0xdc, 0x00 };
+	JBMsgPackReader reader(data, sizeof(data));
+	size_t size = 0;
+	TEST_ASSERT_FALSE(reader.readArray(size));
+	TEST_ASSERT_EQUAL(MSGPACK_ARRAY, reader.peek());
+}
+
+void test_truncated_bin8() {
+	const uint8_t data[] = { 0xc4, 0x05, 0x01, 0x02 };
+	JBMsgPackReader reader(data, sizeof(data));
+	TEST_ASSERT_FALSE(reader.skip());
+	TEST_ASSERT_FALSE(reader.atEnd());
+}
+
+// ====================================================================
+// Out of range values
+//
+void test_uint64_too_large() {
+	const uint8_t data[] = { 0xcf, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00 };
+	JBMsgPackReader reader(data, sizeof(data));
+	uint32_t value = 0;
+	TEST_ASSERT_FALSE(reader.readUInt(value));
+	TEST_ASSERT_TRUE(reader.skip());
+	TEST_ASSERT_TRUE(reader.atEnd());
+}
+
+void test_uint_negative() {
+	const uint8_t data[] = { 0xff };
+	JBMsgPackReader reader(data, sizeof(data));
+	uint32_t uvalue = 0;
+	int32_t value = 0;
+	TEST_ASSERT_FALSE(reader.readUInt(uvalue));
+	TEST_ASSERT_TRUE(reader.readInt(value));
+	TEST_ASSERT_EQUAL_INT32(-1, value);
+}
+
+void test_int64_too_small() {
+	const uint8_t data[] = { 0xd3, 0xff, 0xff, 0xff, 0xfe, 0xff, 0xff, 0xff, 0xff };
+	JBMsgPackReader reader(data, sizeof(data));
+	int32_t value = 0;
+	TEST_ASSERT_FALSE(reader.readInt(value));
+	TEST_ASSERT_EQUAL(MSGPACK_INT, reader.peek());
+}
+
+void test_int_sign_extend() {
+	const uint8_t data[] = { 0xd1, 0xff, 0x38, 0xd2, 0x80, 0x00, 0x00, 0x00 };
+	JBMsgPackReader reader(data, sizeof(data));
+	int32_t value = 0;
+	TEST_ASSERT_TRUE(reader.readInt(value));
+	TEST_ASSERT_EQUAL_INT32(-200, value);
+	TEST_ASSERT_TRUE(reader.readInt(value));
+	TEST_ASSERT_EQUAL_INT32(INT32_MIN, value);
+	TEST_ASSERT_TRUE(reader.atEnd());
+}
+
+// ====================================================================
+// Skipping
+//
+void test_skip_nested() {
+	// {"a": [1, [2, "x"]], "b": {"c": nil}}, 7
+	const uint8_t data[] = {
+		0x82,
+		0xa1, 'a', 0x92, 0x01, 0x92, 0x02, 0xa1, 'x',
+		0xa1, 'b', 0x81, 0xa1, 'c', 0xc0,
+		0x07
+	};
+	JBMsgPackReader reader(data, sizeof(data));
+	uint32_t value = 0;
+	TEST_ASSERT_EQUAL(MSGPACK_MAP, reader.peek());
+	TEST_ASSERT_TRUE(reader.skip());
+	TEST_ASSERT_TRUE(reader.readUInt(value));
+	TEST_ASSERT_EQUAL_UINT32(7, value);
+	TEST_ASSERT_TRUE(reader.atEnd());
+}
+
+void test_skip_nested_truncated() {
+	// [1, [2, "xy"]] with the last character missing
+	const uint8_t data[] = { 0x92, 0x01, 0x92, 0x02, 0xa2, 'x' };
+	JBMsgPackReader reader(data, sizeof(data));
+	size_t size = 0;
+	TEST_ASSERT_FALSE(reader.skip());
+	TEST_ASSERT_TRUE(reader.readArray(size));
+	TEST_ASSERT_EQUAL(2, size);
+}
+
+void test_skip_missing_elements() {
+	// Array of three with only two elements
+	const uint8_t data[] = { 0x93, 0x01, 0x02 };
+	JBMsgPackReader reader(data, sizeof(data));
+	TEST_ASSERT_FALSE(reader.skip());
+	TEST_ASSERT_EQUAL(MSGPACK_ARRAY, reader.peek());
+}
+
+void test_skip_float_and_ext() {
+	const uint8_t data[] = {
+		0xcb, 0, 0, 0, 0, 0, 0, 0, 0,
+		0xd6, 0x01, 0, 0, 0, 0,
+		0xc7, 0x02, 0x01, 0, 0,
+		0xc3
+	};
+	JBMsgPackReader reader(data, sizeof(data));
+	bool value = false;
+	TEST_ASSERT_EQUAL(MSGPACK_OTHER, reader.peek());
+	TEST_ASSERT_TRUE(reader.skip());
+	TEST_ASSERT_TRUE(reader.skip());
+	TEST_ASSERT_TRUE(reader.skip());
+	TEST_ASSERT_TRUE(reader.readBool(value));
+	TEST_ASSERT_TRUE(value);
+	TEST_ASSERT_TRUE(reader.atEnd());
+}
+
+void test_skip_unknown_type() {
+	const uint8_t data[] = { 0xc1 };
+	JBMsgPackReader reader(data, sizeof(data));
+	TEST_ASSERT_FALSE(reader.skip());
+}
+
+// ====================================================================
+// Writer
+//
+void test_writer_roundtrip() {
+	uint8_t buffer[64];
+	JBMsgPackWriter writer(buffer, sizeof(buffer));
+	std::string text(40, 'w');
+	writer.writeArray(5);
+	writer.writeNil();
+	writer.writeBool(false);
+	writer.writeUInt(300);
+	writer.writeUInt(70000);
+	writer.writeString(text);
+	TEST_ASSERT_FALSE(writer.hasOverflow());
+
+	JBMsgPackReader reader(buffer, writer.getLength());
+	size_t size = 0;
+	bool flag = true;
+	uint32_t value = 0;
+	JBStringView view { "", 0 };
+	TEST_ASSERT_TRUE(reader.readArray(size));
+	TEST_ASSERT_EQUAL(5, size);
+	TEST_ASSERT_TRUE(reader.readNil());
+	TEST_ASSERT_TRUE(reader.readBool(flag));
+	TEST_ASSERT_FALSE(flag);
+	TEST_ASSERT_TRUE(reader.readUInt(value));
+	TEST_ASSERT_EQUAL_UINT32(300, value);
+	TEST_ASSERT_TRUE(reader.readUInt(value));
+	TEST_ASSERT_EQUAL_UINT32(70000, value);
+	TEST_ASSERT_TRUE(reader.readString(view));
+	TEST_ASSERT_TRUE(view.toString() == text);
+	TEST_ASSERT_TRUE(reader.atEnd());
+}
+
+void test_writer_overflow() {
+	uint8_t buffer[8];
+	JBMsgPackWriter writer(buffer, sizeof(buffer));
+	writer.writeString("0123456789", 10);
+	TEST_ASSERT_TRUE(writer.hasOverflow());
+	TEST_ASSERT_TRUE(writer.getLength() <= sizeof(buffer));
+}
+
+int main() {
+	UNITY_BEGIN();
+	RUN_TEST(test_truncated_fixstr);
+	RUN_TEST(test_truncated_str8_header);
+	RUN_TEST(test_truncated_str16_body);
+	RUN_TEST(test_truncated_uint32);
+	RUN_TEST(test_truncated_array16_header);
+	RUN_TEST(test_truncated_bin8);
+	RUN_TEST(test_uint64_too_large);
+	RUN_TEST(test_uint_negative);
+	RUN_TEST(test_int64_too_small);
+	RUN_TEST(test_int_sign_extend);
+	RUN_TEST(test_skip_nested);
+	RUN_TEST(test_skip_nested_truncated);
+	RUN_TEST(test_skip_missing_elements);
+	RUN_TEST(test_skip_float_and_ext);
+	RUN_TEST(test_skip_unknown_type);
+	RUN_TEST(test_writer_roundtrip);
+	RUN_TEST(test_writer_overflow);
+	return UNITY_END();
+}